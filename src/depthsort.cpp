@@ -0,0 +1,282 @@
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <functional>
+
+#include "depthsort.h"
+
+// Fewer shapes than this aren't worth starting threads for.
+static const size_t minParallelCount = 16384;
+
+// The depth keys are this many bits, sorted this many at a time.
+static const int depthKeyBits = 22;
+static const int radixBits = 11;
+static const int radixBuckets = 1 << radixBits;
+
+// Runs task(first, last, piece) over [0, n), cut into nPieces pieces,
+// each on its own thread.
+template <typename T>
+static void runPieces(T& task, size_t n, int nPieces) {
+
+  size_t chunk = (n + nPieces - 1) / nPieces;
+  std::vector<std::thread> threads;
+
+  for (int p = 1; p < nPieces; p++) {
+    size_t first = std::min(n, p * chunk);
+    size_t last = std::min(n, first + chunk);
+    threads.push_back(std::thread(std::ref(task), first, last, p));
+  }
+  task(0, std::min(n, chunk), 0);
+
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+// Frustum test and depth for a range of bounding spheres.
+struct cullTask {
+  const MVec4* spheres;
+  MVec4 planes[6];
+  MVec4 depthRow;
+  char* visible;
+  float* depths;
+
+  void operator()(size_t first, size_t last, int piece) {
+    for (size_t i = first; i < last; i++) {
+      MVec4 center(MVec3(spheres[i]), 1.0f);
+      float radius = spheres[i].w;
+
+      char inside = 1;
+      for (int k = 0; k < 6; k++) {
+        if (glm::dot(planes[k], center) < -radius) {
+          inside = 0;
+          break;
+        }
+      }
+
+      visible[i] = inside;
+      depths[i] = glm::dot(depthRow, center);
+    }
+  };
+};
+
+// Counts the keys in each bucket, for one pass of the radix sort.
+struct histogramTask {
+  const uint64_t* keys;
+  int shift;
+  std::vector<uint32_t>* counts;
+
+  void operator()(size_t first, size_t last, int piece) {
+    uint32_t* count = &counts[piece][0];
+    for (size_t i = first; i < last; i++)
+      count[(keys[i] >> shift) & (radixBuckets - 1)]++;
+  };
+};
+
+// Moves the keys to their places, for one pass of the radix sort.
+// Each piece has its own starting offsets, so the pieces can work at
+// the same time and the sort stays stable.
+struct scatterTask {
+  const uint64_t* in;
+  uint64_t* out;
+  int shift;
+  std::vector<uint32_t>* offsets;
+
+  void operator()(size_t first, size_t last, int piece) {
+    uint32_t* offset = &offsets[piece][0];
+    for (size_t i = first; i < last; i++)
+      out[offset[(in[i] >> shift) & (radixBuckets - 1)]++] = in[i];
+  };
+};
+
+mvDepthSorter::mvDepthSorter(int nThreads) :
+  _reuseAngle(0.1f * M_PI / 180.0f), _gathered(false), _sorted(false) {
+
+  if (nThreads <= 0) nThreads = std::thread::hardware_concurrency();
+  _nThreads = (nThreads > 0) ? nThreads : 1;
+}
+
+void mvDepthSorter::gather(const std::vector<mvShape*>& shapes) {
+
+  if (_gathered) return;
+
+  // Most shapes don't move from one frame to the next, so their
+  // spheres are kept, and only the ones that are new in their place
+  // on the list, or whose bounds have changed, are worked out again.
+  size_t n = shapes.size();
+  _shapes.resize(n, NULL);
+  _spheres.resize(n);
+  _sphereVersions.resize(n, 0);
+  for (size_t i = 0; i < n; i++) {
+    mvShape* shape = shapes[i];
+    if (shape == _shapes[i] && shape->getBoundsVersion() == _sphereVersions[i])
+      continue;
+    _shapes[i] = shape;
+    _spheres[i] = shape->getWorldBoundingSphere();
+    _sphereVersions[i] = shape->getBoundsVersion();
+  }
+
+  _gathered = true;
+}
+
+void mvDepthSorter::cull(const MMat4& view, const MMat4& projection) {
+
+  size_t n = _shapes.size();
+  _newVisible.resize(n);
+  _depths.resize(n);
+  if (n == 0) return;
+
+  cullTask task;
+  task.spheres = &_spheres[0];
+  task.visible = &_newVisible[0];
+  task.depths = &_depths[0];
+
+  // The frustum planes come straight out of the rows of the combined
+  // matrix (Gribb and Hartmann).  They're normalized so that the plane
+  // equation gives a distance to compare with the radius.
+  MMat4 clip = projection * view;
+  MVec4 row[4];
+  for (int i = 0; i < 4; i++)
+    row[i] = MVec4(clip[0][i], clip[1][i], clip[2][i], clip[3][i]);
+
+  for (int i = 0; i < 3; i++) {
+    task.planes[2 * i] = row[3] + row[i];
+    task.planes[2 * i + 1] = row[3] - row[i];
+  }
+  for (int k = 0; k < 6; k++)
+    task.planes[k] /= glm::length(MVec3(task.planes[k]));
+
+  // The eye-space z, which is negative in front of the eye.
+  task.depthRow = MVec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+
+  runPieces(task, n, (n < minParallelCount) ? 1 : _nThreads);
+}
+
+void mvDepthSorter::radixSort() {
+
+  size_t n = _keys.size();
+  _keysTemp.resize(n);
+  if (n == 0) return;
+
+  int nPieces = (n < minParallelCount) ? 1 : _nThreads;
+  std::vector<std::vector<uint32_t> > counts(nPieces);
+
+  for (int shift = 32; shift < 32 + depthKeyBits; shift += radixBits) {
+
+    for (int p = 0; p < nPieces; p++) counts[p].assign(radixBuckets, 0);
+
+    histogramTask histogram;
+    histogram.keys = &_keys[0];
+    histogram.shift = shift;
+    histogram.counts = &counts[0];
+    runPieces(histogram, n, nPieces);
+
+    // Turn the counts into starting offsets: bucket by bucket, and
+    // within a bucket, piece by piece.
+    uint32_t total = 0;
+    for (int b = 0; b < radixBuckets; b++) {
+      for (int p = 0; p < nPieces; p++) {
+        uint32_t count = counts[p][b];
+        counts[p][b] = total;
+        total += count;
+      }
+    }
+
+    scatterTask scatter;
+    scatter.in = &_keys[0];
+    scatter.out = &_keysTemp[0];
+    scatter.shift = shift;
+    scatter.offsets = &counts[0];
+    runPieces(scatter, n, nPieces);
+
+    _keys.swap(_keysTemp);
+  }
+}
+
+// Orders shape numbers by depth.
+struct byDepth {
+  const std::vector<float>& depths;
+  byDepth(const std::vector<float>& d) : depths(d) {};
+  bool operator()(uint32_t a, uint32_t b) const { return depths[a] < depths[b]; };
+};
+
+bool mvDepthSorter::canReuse(const MMat4& viewMatrix) {
+
+  if (!_sorted) return false;
+
+  // The cosine of the angle between the two rotations is
+  // (trace(R1^T R2) - 1) / 2.
+  float trace = 0.0f;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++) trace += _sortedView[i][j] * viewMatrix[i][j];
+
+  return 0.5f * (trace - 1.0f) >= cosf(_reuseAngle);
+}
+
+void mvDepthSorter::reuse() {
+
+  // The shapes visible last time are still in the right order, so
+  // drop the ones that aren't visible now.  The ones that weren't
+  // visible before (there are usually only a few, at the edges of the
+  // view) get sorted by themselves and merged in.
+  std::vector<uint32_t> kept, added;
+  kept.reserve(_orderIndex.size());
+  for (size_t i = 0; i < _orderIndex.size(); i++)
+    if (_newVisible[_orderIndex[i]]) kept.push_back(_orderIndex[i]);
+
+  for (size_t i = 0; i < _shapes.size(); i++)
+    if (_newVisible[i] && !_visible[i]) added.push_back(i);
+
+  std::sort(added.begin(), added.end(), byDepth(_depths));
+
+  _orderIndex.resize(kept.size() + added.size());
+  std::merge(kept.begin(), kept.end(), added.begin(), added.end(),
+             _orderIndex.begin(), byDepth(_depths));
+}
+
+const std::vector<mvShape*>& mvDepthSorter::sort(const std::vector<mvShape*>& shapes,
+                                                   const MMat4& viewMatrix,
+                                                   const MMat4& projectionMatrix) {
+
+  gather(shapes);
+  cull(viewMatrix, projectionMatrix);
+
+  if (canReuse(viewMatrix)) {
+    reuse();
+  } else {
+    // Quantize the depths of the visible shapes.  The most negative z
+    // is the farthest away, so that gets the smallest key.
+    float zMin = 0.0f, zMax = 0.0f;
+    bool first = true;
+    for (size_t i = 0; i < _shapes.size(); i++) {
+      if (!_newVisible[i]) continue;
+      if (first || _depths[i] < zMin) zMin = _depths[i];
+      if (first || _depths[i] > zMax) zMax = _depths[i];
+      first = false;
+    }
+
+    const uint64_t maxKey = (1 << depthKeyBits) - 1;
+    float scale = (zMax > zMin) ? maxKey / (zMax - zMin) : 0.0f;
+
+    _keys.clear();
+    for (size_t i = 0; i < _shapes.size(); i++) {
+      if (!_newVisible[i]) continue;
+      uint64_t depthKey = std::min((uint64_t)((_depths[i] - zMin) * scale), maxKey);
+      _keys.push_back((depthKey << 32) | i);
+    }
+
+    radixSort();
+
+    _orderIndex.resize(_keys.size());
+    for (size_t i = 0; i < _keys.size(); i++) _orderIndex[i] = (uint32_t)_keys[i];
+
+    _sortedView = viewMatrix;
+    _sorted = true;
+  }
+
+  _visible.swap(_newVisible);
+
+  _order.resize(_orderIndex.size());
+  for (size_t i = 0; i < _orderIndex.size(); i++)
+    _order[i] = _shapes[_orderIndex[i]];
+
+  return _order;
+}
@@ -0,0 +1,82 @@
+#ifndef DEPTHSORT_H
+#define DEPTHSORT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "vecTypes.h"
+#include "mvShape.h"
+
+// Works out the order to draw blended shapes in.  With the depth test
+// off and the images blended over one another, the shapes have to be
+// drawn back to front or the wrong ones end up on top.
+//
+// For each eye, sort() drops the shapes that are outside the view
+// frustum, and sorts the rest by the depth of the centers of their
+// bounding spheres (see mvShape::getWorldBoundingSphere()).  The sort
+// is a radix sort on depth quantized to 22 bits, which takes time in
+// proportion to the number of shapes, and is split across threads when
+// there are a lot of them.
+//
+// The eyes of a stereo pair usually look in the same direction from
+// slightly different places.  Moving the eye without turning it adds
+// the same amount to every depth, which can't change the order, so
+// if the view directions are within a small angle of each other, the
+// second eye of a frame reuses the first eye's order.  Only the few
+// shapes at the edges of the view that the first eye couldn't see
+// need sorting, and they're merged in.
+//
+// Call newFrame() at the start of each frame, so that shapes that
+// have moved or been added are noticed.  Only those have their
+// spheres worked out again; the rest keep last frame's.
+class mvDepthSorter {
+ private:
+
+  int _nThreads;
+
+  // Views whose rotations differ by less than this many radians can
+  // share a sort.
+  float _reuseAngle;
+
+  // The shapes and their bounding spheres, gathered once a frame, and
+  // the mvShape::getBoundsVersion() each sphere was worked out at.
+  bool _gathered;
+  std::vector<mvShape*> _shapes;
+  std::vector<MVec4> _spheres;
+  std::vector<uint64_t> _sphereVersions;
+
+  // The result of the last sort, and what it was sorted for.
+  bool _sorted;
+  MMat4 _sortedView;
+  std::vector<char> _visible;
+  std::vector<uint32_t> _orderIndex;
+  std::vector<mvShape*> _order;
+
+  // Scratch space for the sort.
+  std::vector<char> _newVisible;
+  std::vector<float> _depths;
+  std::vector<uint64_t> _keys, _keysTemp;
+
+  void gather(const std::vector<mvShape*>& shapes);
+  void cull(const MMat4& view, const MMat4& projection);
+  void radixSort();
+  bool canReuse(const MMat4& viewMatrix);
+  void reuse();
+
+ public:
+  // With nThreads = 0, use as many threads as there are cores.
+  mvDepthSorter(int nThreads = 0);
+
+  void newFrame() { _gathered = false; _sorted = false; };
+
+  // Returns the shapes that can be seen from the given view, farthest
+  // first.  The vector is good until the next call.
+  const std::vector<mvShape*>& sort(const std::vector<mvShape*>& shapes,
+                                      const MMat4& viewMatrix,
+                                      const MMat4& projectionMatrix);
+
+  void setReuseAngle(float radians) { _reuseAngle = radians; };
+  float getReuseAngle() { return _reuseAngle; };
+};
+
+#endif
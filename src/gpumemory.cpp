@@ -0,0 +1,136 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+#include "gpumemory.h"
+
+std::atomic<size_t> mvGPUMemory::_bytes[gpuCATEGORIES];
+std::atomic<size_t> mvGPUMemory::_peak(0);
+std::atomic<size_t> mvGPUMemory::_budget(0);
+std::atomic<bool> mvGPUMemory::_overBudget(false);
+
+static const char* categoryNames[gpuCATEGORIES] = {
+  "textures", "meshes", "atlases"
+};
+
+static double megabytes(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+size_t mvGPUMemory::getTotalBytes() {
+
+  size_t total = 0;
+  for (int i = 0; i < gpuCATEGORIES; i++) total += _bytes[i];
+  return total;
+}
+
+void mvGPUMemory::allocate(mvGPUMemoryCategory category, size_t bytes) {
+
+  _bytes[category] += bytes;
+
+  size_t total = getTotalBytes();
+  size_t peak = _peak;
+  while (total > peak && !_peak.compare_exchange_weak(peak, total));
+
+  if (_budget > 0 && total > _budget && !_overBudget.exchange(true)) {
+    std::cerr << "Warning: GPU memory is over budget.  " << print() << std::endl;
+  }
+}
+
+void mvGPUMemory::release(mvGPUMemoryCategory category, size_t bytes) {
+
+  _bytes[category] -= bytes;
+  if (getTotalBytes() <= _budget) _overBudget = false;
+}
+
+std::string mvGPUMemory::print() {
+
+  std::stringstream out;
+  out << std::fixed << std::setprecision(1) << "GPU memory: "
+      << megabytes(getTotalBytes()) << " MB (";
+  for (int i = 0; i < gpuCATEGORIES; i++) {
+    out << (i ? ", " : "") << categoryNames[i] << " "
+        << megabytes(_bytes[i]) << " MB";
+  }
+  out << "), peak " << megabytes(_peak) << " MB";
+  if (_budget > 0) out << ", budget " << megabytes(_budget) << " MB";
+  out << ".";
+  return out.str();
+}
+
+size_t mvGPUMemory::textureBytes(GLint internalFormat, GLsizei width,
+                                 GLsizei height) {
+
+  size_t bytesPerTexel;
+  switch (internalFormat) {
+  case GL_R8:
+  case GL_RED:
+    bytesPerTexel = 1;
+    break;
+  case GL_RG8:
+  case GL_RG:
+  case GL_R16:
+  case GL_LUMINANCE16:
+    bytesPerTexel = 2;
+    break;
+  case GL_R32F:
+    bytesPerTexel = 4;
+    break;
+  case GL_RG32F:
+    bytesPerTexel = 8;
+    break;
+  case GL_RGBA32F:
+    bytesPerTexel = 16;
+    break;
+  default:
+    // RGB gets padded out to four bytes by most drivers, so it costs
+    // the same as RGBA.
+    bytesPerTexel = 4;
+    break;
+  }
+  return bytesPerTexel * width * height;
+}
+
+void mvGPUMemory::texImage2D(mvGPUMemoryCategory category, size_t& owned,
+                             GLenum target, GLint level, GLint internalFormat,
+                             GLsizei width, GLsizei height, GLint border,
+                             GLenum format, GLenum type, const void* data) {
+
+  glTexImage2D(target, level, internalFormat, width, height, border,
+               format, type, data);
+
+  size_t bytes = textureBytes(internalFormat, width, height);
+  owned += bytes;
+  allocate(category, bytes);
+}
+
+void mvGPUMemory::compressedTexImage2D(mvGPUMemoryCategory category, size_t& owned,
+                                       GLenum target, GLint level,
+                                       GLenum internalFormat, GLsizei width,
+                                       GLsizei height, GLint border,
+                                       GLsizei imageSize, const void* data) {
+
+  glCompressedTexImage2D(target, level, internalFormat, width, height, border,
+                         imageSize, data);
+
+  owned += imageSize;
+  allocate(category, imageSize);
+}
+
+void mvGPUMemory::bufferData(mvGPUMemoryCategory category, size_t& owned,
+                             GLenum target, GLsizeiptr size, const void* data,
+                             GLenum usage) {
+
+  glBufferData(target, size, data, usage);
+
+  owned += size;
+  allocate(category, size);
+}
+
+void mvGPUMemory::generateMipmap(mvGPUMemoryCategory category, size_t& owned,
+                                 GLenum target) {
+
+  glGenerateMipmap(target);
+
+  size_t bytes = owned / 3;
+  owned += bytes;
+  allocate(category, bytes);
+}
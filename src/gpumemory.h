@@ -0,0 +1,77 @@
+#ifndef GPUMEMORY_H
+#define GPUMEMORY_H
+
+#include <stddef.h>
+#include <string>
+#include <atomic>
+
+#include <GL/glew.h>
+
+// What GPU memory is being used for.
+typedef enum {
+  gpuTEXTURE = 0,  // Images, the ROIs and any others.
+  gpuMESH = 1,     // Vertex and index buffers.
+  gpuATLAS = 2,    // Textures holding pieces of many images.
+  gpuCATEGORIES = 3
+} mvGPUMemoryCategory;
+
+// Keeps count of the texture and buffer memory we ask OpenGL for, so
+// we can tell how close a display node is to running out, instead of
+// finding out from driver errors.
+//
+// The OpenGL calls that allocate memory are made through the wrappers
+// here, which make the call and add what it allocated to a running
+// total belonging to the caller.  When the caller deletes its textures
+// or buffers, it hands that total to release().  The sizes are
+// estimates: drivers add padding and alignment we can't see.
+//
+// If a budget is set, crossing it prints a warning, once each time.
+class mvGPUMemory {
+ private:
+  static std::atomic<size_t> _bytes[gpuCATEGORIES];
+  static std::atomic<size_t> _peak;
+  static std::atomic<size_t> _budget;
+  static std::atomic<bool> _overBudget;
+
+ public:
+  static void allocate(mvGPUMemoryCategory category, size_t bytes);
+  static void release(mvGPUMemoryCategory category, size_t bytes);
+
+  static size_t getBytes(mvGPUMemoryCategory category) { return _bytes[category]; };
+  static size_t getTotalBytes();
+  static size_t getPeakBytes() { return _peak; };
+
+  // Zero means no budget.
+  static void setBudget(size_t bytes) { _budget = bytes; };
+  static size_t getBudget() { return _budget; };
+
+  // A summary, in megabytes.
+  static std::string print();
+
+  // Roughly how much memory a texture level of this size and internal
+  // format takes.
+  static size_t textureBytes(GLint internalFormat, GLsizei width, GLsizei height);
+
+  // The counted versions of the OpenGL calls.  The first two
+  // arguments say what the memory is for, and whose total to add it
+  // to; the rest are as for the OpenGL functions.
+  static void texImage2D(mvGPUMemoryCategory category, size_t& owned,
+                         GLenum target, GLint level, GLint internalFormat,
+                         GLsizei width, GLsizei height, GLint border,
+                         GLenum format, GLenum type, const void* data);
+  static void compressedTexImage2D(mvGPUMemoryCategory category, size_t& owned,
+                                   GLenum target, GLint level,
+                                   GLenum internalFormat, GLsizei width,
+                                   GLsizei height, GLint border,
+                                   GLsizei imageSize, const void* data);
+  static void bufferData(mvGPUMemoryCategory category, size_t& owned,
+                         GLenum target, GLsizeiptr size, const void* data,
+                         GLenum usage);
+
+  // A full mipmap chain adds a third to the base level, which is
+  // taken to be everything owned so far.
+  static void generateMipmap(mvGPUMemoryCategory category, size_t& owned,
+                             GLenum target);
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "hash.h"
+#include "mappedfile.h"
+
+#include <cstring>
+
+static const uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little-endian reads.  memcpy() compiles down to a plain
+// load on the machines we care about.
+static inline uint64_t read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t round(uint64_t acc, uint64_t input) {
+  acc += input * prime2;
+  acc = rotl(acc, 31);
+  return acc * prime1;
+}
+
+static inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+  acc ^= round(0, val);
+  return acc * prime1 + prime4;
+}
+
+uint64_t mvHash64(const void* data, size_t length, uint64_t seed) {
+
+  const unsigned char* p = (const unsigned char*)data;
+  const unsigned char* end = p + length;
+  uint64_t h;
+
+  if (length >= 32) {
+    // Four independent lanes, so the CPU can overlap the multiplies.
+    const unsigned char* limit = end - 32;
+    uint64_t v1 = seed + prime1 + prime2;
+    uint64_t v2 = seed + prime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - prime1;
+
+    do {
+      v1 = round(v1, read64(p));      p += 8;
+      v2 = round(v2, read64(p));      p += 8;
+      v3 = round(v3, read64(p));      p += 8;
+      v4 = round(v4, read64(p));      p += 8;
+    } while (p <= limit);
+
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    h = mergeRound(h, v1);
+    h = mergeRound(h, v2);
+    h = mergeRound(h, v3);
+    h = mergeRound(h, v4);
+  } else {
+    h = seed + prime5;
+  }
+
+  h += (uint64_t)length;
+
+  // The leftovers.
+  while (p + 8 <= end) {
+    h ^= round(0, read64(p));
+    h = rotl(h, 27) * prime1 + prime4;
+    p += 8;
+  }
+
+  if (p + 4 <= end) {
+    h ^= (uint64_t)read32(p) * prime1;
+    h = rotl(h, 23) * prime2 + prime3;
+    p += 4;
+  }
+
+  while (p < end) {
+    h ^= (*p) * prime5;
+    h = rotl(h, 11) * prime1;
+    p++;
+  }
+
+  // Final mix.
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+bool mvHashFile(const std::string fileName, uint64_t* hash) {
+
+  mvMappedFile file;
+  if (!file.open(fileName)) return false;
+
+  *hash = mvHash64(file.getData(), file.getSize());
+  return true;
+}
+
+bool mvHash64Check() {
+
+  // xxHash's own sanity test: a buffer filled from a multiplicative
+  // generator, hashed at lengths that take each path through the code.
+  static const uint32_t prime = 2654435761U;
+  unsigned char buffer[222];
+  uint32_t byteGen = prime;
+  for (size_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = (unsigned char)(byteGen >> 24);
+    byteGen *= byteGen;
+  }
+
+  static const struct { size_t length; uint64_t seed, hash; } vectors[] = {
+    { 0,   0,     0xEF46DB3751D8E999ULL },
+    { 1,   0,     0x4FCE394CC88952D8ULL },
+    { 1,   prime, 0x739840CB819FA723ULL },
+    { 14,  0,     0xCFFA8DB881BC3A3DULL },
+    { 14,  prime, 0x5B9611585EFCC9CBULL },
+    { 222, 0,     0x9DD507880DEBB03DULL },
+    { 222, prime, 0xDC515172B8EE0600ULL }
+  };
+
+  for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+    if (mvHash64(buffer, vectors[i].length, vectors[i].seed) != vectors[i].hash)
+      return false;
+  }
+  return true;
+}
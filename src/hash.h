@@ -0,0 +1,23 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <string>
+
+// A fast, non-cryptographic 64-bit hash.  This is the XXH64 function
+// from Yann Collet's xxHash, re-implemented here so we don't have to
+// drag the library along.  It runs at several GB/s, which makes it
+// cheap enough to use on whole files and decoded images.  Don't use
+// it for anything where someone might be trying to make collisions
+// on purpose.
+uint64_t mvHash64(const void* data, size_t length, uint64_t seed = 0);
+
+// Whether mvHash64() gives the reference XXH64 values for xxHash's
+// test vectors.  The mesh cache checks this once in a DEBUG build.
+bool mvHash64Check();
+
+// Hash the contents of a file.  Returns false if it can't be read.
+bool mvHashFile(const std::string fileName, uint64_t* hash);
+
+#endif
@@ -0,0 +1,549 @@
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <algorithm>
+#include <sstream>
+
+#include <png.h>
+extern "C" {
+#include <jpeglib.h>
+}
+
+#include "imagedecoder.h"
+#include "pixelops.h"
+
+class mvPNGDecoder : public mvImageDecoder {
+ public:
+  std::string getName() const { return "png"; };
+  bool matches(const unsigned char* header, size_t length) const {
+    return length >= 8 && png_sig_cmp((png_const_bytep)header, 0, 8) == 0;
+  };
+  bool decode(const std::string& path, mvImageData& image,
+              const mvDecodeOptions& options) const;
+};
+
+class mvJPEGDecoder : public mvImageDecoder {
+ public:
+  std::string getName() const { return "jpg"; };
+  bool matches(const unsigned char* header, size_t length) const {
+    return length >= 3 &&
+      header[0] == 0xFF && header[1] == 0xD8 && header[2] == 0xFF;
+  };
+  bool decode(const std::string& path, mvImageData& image,
+              const mvDecodeOptions& options) const;
+};
+
+class mvBMPDecoder : public mvImageDecoder {
+ public:
+  std::string getName() const { return "bmp"; };
+  bool matches(const unsigned char* header, size_t length) const {
+    return length >= 2 && header[0] == 'B' && header[1] == 'M';
+  };
+  bool decode(const std::string& path, mvImageData& image,
+              const mvDecodeOptions& options) const;
+};
+
+class mvDDSDecoder : public mvImageDecoder {
+ public:
+  std::string getName() const { return "dds"; };
+  bool matches(const unsigned char* header, size_t length) const {
+    return length >= 4 && memcmp(header, "DDS ", 4) == 0;
+  };
+  bool decode(const std::string& path, mvImageData& image,
+              const mvDecodeOptions& options) const;
+};
+
+mvImageDecoderRegistry::mvImageDecoderRegistry() {
+
+  registerDecoder(new mvPNGDecoder(), "png");
+  registerDecoder(new mvJPEGDecoder(), "jpg jpeg");
+  registerDecoder(new mvBMPDecoder(), "bmp");
+  registerDecoder(new mvDDSDecoder(), "dds");
+}
+
+mvImageDecoderRegistry::~mvImageDecoderRegistry() {
+
+  for (size_t i = 0; i < _decoders.size(); i++) delete _decoders[i];
+}
+
+mvImageDecoderRegistry& mvImageDecoderRegistry::get() {
+
+  static mvImageDecoderRegistry registry;
+  return registry;
+}
+
+void mvImageDecoderRegistry::registerDecoder(mvImageDecoder* decoder,
+                                             const std::string& extensions) {
+
+  _decoders.push_back(decoder);
+
+  std::stringstream in(extensions);
+  std::string extension;
+  while (in >> extension) _extensions[extension] = decoder;
+}
+
+mvImageDecoder* mvImageDecoderRegistry::findByExtension(const std::string& extension) const {
+
+  std::string lower = extension;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+  extensionMap::const_iterator it = _extensions.find(lower);
+  return (it == _extensions.end()) ? NULL : it->second;
+}
+
+mvImageDecoder* mvImageDecoderRegistry::findForFile(const std::string& path) const {
+
+  unsigned char header[headerLength];
+  size_t length = 0;
+
+  FILE* fp = fopen(path.c_str(), "rb");
+  if (fp) {
+    length = fread(header, 1, headerLength, fp);
+    fclose(fp);
+  }
+
+  for (size_t i = 0; i < _decoders.size(); i++)
+    if (_decoders[i]->matches(header, length)) return _decoders[i];
+
+  size_t dot = path.find_last_of(".");
+  if (dot == std::string::npos || path.find_first_of("/", dot) != std::string::npos)
+    return NULL;
+  return findByExtension(path.substr(dot + 1));
+}
+
+// Decoders are handed images that may have been used before.  This
+// clears everything but the capacity of the pixel buffer.
+static void resetImage(mvImageData& image) {
+
+  std::vector<unsigned char> pixels;
+  pixels.swap(image.pixels);
+  image = mvImageData();
+  pixels.clear();
+  image.pixels.swap(pixels);
+}
+
+// libjpeg's default is to exit() on errors.  This jumps back to the
+// decoder instead, the way libpng does.
+struct jpegErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf jump;
+};
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(((jpegErrorManager*)cinfo->err)->jump, 1);
+}
+
+bool mvJPEGDecoder::decode(const std::string& imagePath, mvImageData &image,
+                           const mvDecodeOptions& options) const {
+
+  resetImage(image);
+
+  FILE *fp = fopen(imagePath.c_str(), "rb");
+  if (fp == 0) {
+    perror(imagePath.c_str());
+    return false;
+  }
+
+  jpeg_decompress_struct cinfo;
+  jpegErrorManager error;
+  cinfo.err = jpeg_std_error(&error.pub);
+  error.pub.error_exit = jpegErrorExit;
+
+  if (setjmp(error.jump)) {
+    fprintf(stderr, "%s: can't read JPEG.\n", imagePath.c_str());
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    return false;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo, fp);
+  jpeg_read_header(&cinfo, TRUE);
+
+  if (cinfo.num_components == 1) {
+    cinfo.out_color_space = JCS_GRAYSCALE;
+    image.format = GL_RED;
+    image.swizzle[1] = GL_RED;
+    image.swizzle[2] = GL_RED;
+    image.swizzle[3] = GL_ONE;
+  } else {
+    cinfo.out_color_space = JCS_RGB;
+    image.format = GL_RGB;
+  }
+
+  // The inverse DCT can produce the image at n/8 of its size for
+  // little more than the cost of the smaller image.  Use the smallest
+  // n that is still big enough.
+  int scale = 8;
+  if (options.neededWidth > 0 || options.neededHeight > 0) {
+    while (scale > 1 &&
+           (int)(cinfo.image_width * (scale - 1) + 7) / 8 >= options.neededWidth &&
+           (int)(cinfo.image_height * (scale - 1) + 7) / 8 >= options.neededHeight)
+      scale--;
+  }
+  cinfo.scale_num = scale;
+  cinfo.scale_denom = 8;
+
+  jpeg_start_decompress(&cinfo);
+
+  image.width = cinfo.output_width;
+  image.height = cinfo.output_height;
+  image.rowBytes = (cinfo.output_width * cinfo.output_components + 3) & ~3;
+  image.pixels.resize(image.rowBytes * image.height);
+
+  // Rows go in bottom up, like the PNGs.
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &image.pixels[(image.height - 1 - cinfo.output_scanline) *
+                                 image.rowBytes];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  fclose(fp);
+  return true;
+}
+
+// BMPs are never read at a reduced size; mvTexture shrinks them
+// afterwards when it needs to, as it does the other 8-bit images.
+bool mvBMPDecoder::decode(const std::string& imagepath, mvImageData &image,
+                          const mvDecodeOptions& /* options */) const {
+
+  resetImage(image);
+
+	printf("Reading image %s\n", imagepath.c_str());
+
+	// Data read from the header of the BMP file
+	unsigned char header[54];
+	unsigned int dataPos;
+	unsigned int imageSize;
+	unsigned int width, height;
+
+	// Open the file
+	FILE * file = fopen(imagepath.c_str(),"rb");
+	if (!file) {perror(imagepath.c_str()); return false;}
+
+	// Read the header, i.e. the 54 first bytes
+
+	// If less than 54 bytes are read, problem
+	if ( fread(header, 1, 54, file)!=54 ){ 
+		printf("Not a correct BMP file\n");
+		fclose(file);
+		return false;
+	}
+	// A BMP files always begins with "BM"
+	if ( header[0]!='B' || header[1]!='M' ){
+		printf("Not a correct BMP file\n");
+		fclose(file);
+		return false;
+	}
+	// Make sure this is a 24bpp file
+	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return false;}
+
+	// Read the information about the image
+	dataPos    = *(int*)&(header[0x0A]);
+	imageSize  = *(int*)&(header[0x22]);
+	width      = *(int*)&(header[0x12]);
+	height     = *(int*)&(header[0x16]);
+
+	// Some BMP files are misformatted, guess missing information
+	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
+	if (dataPos==0)      dataPos=54; // The BMP header is done that way
+
+	// Read the actual data from the file into the image
+	image.width = width;
+	image.height = height;
+	image.format = GL_BGR;
+	image.rowBytes = (width * 3 + 3) & ~3;
+	image.pixels.resize(imageSize);
+	fread(&image.pixels[0],1,imageSize,file);
+
+	// Everything is in memory now, the file can be closed
+	fclose (file);
+
+	return true;
+}
+
+
+
+#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
+#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
+#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+
+// A DDS image is compressed, and goes to OpenGL as it is, so there's
+// nothing for the options to change.
+bool mvDDSDecoder::decode(const std::string& imagepath, mvImageData &image,
+                          const mvDecodeOptions& /* options */) const {
+
+  resetImage(image);
+
+	unsigned char header[124];
+
+	FILE *fp; 
+ 
+	/* try to open the file */ 
+	fp = fopen(imagepath.c_str(), "rb"); 
+	if (fp == NULL){
+		perror(imagepath.c_str());
+		return false;
+	}
+   
+	/* verify the type of file */ 
+	char filecode[4]; 
+	fread(filecode, 1, 4, fp); 
+	if (strncmp(filecode, "DDS ", 4) != 0) { 
+		fclose(fp); 
+		return false; 
+	}
+	
+	/* get the surface desc */ 
+	fread(&header, 124, 1, fp); 
+
+	unsigned int height      = *(unsigned int*)&(header[8 ]);
+	unsigned int width	     = *(unsigned int*)&(header[12]);
+	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
+	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
+	unsigned int fourCC      = *(unsigned int*)&(header[80]);
+
+ 
+	unsigned int format;
+	switch(fourCC) 
+	{ 
+	case FOURCC_DXT1: 
+		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
+		break; 
+	case FOURCC_DXT3: 
+		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
+		break; 
+	case FOURCC_DXT5: 
+		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
+		break; 
+	default: 
+		fclose(fp);
+		return false; 
+	}
+
+	unsigned int bufsize;
+	/* how big is it going to be including all mipmaps? */ 
+	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
+	if (bufsize == 0) { fclose(fp); return false; }
+	image.pixels.resize(bufsize);
+	image.pixels.resize(fread(&image.pixels[0], 1, bufsize, fp));
+	/* close the file pointer */ 
+	fclose(fp);
+
+	image.width = width;
+	image.height = height;
+	image.format = format;
+	image.mipMapCount = mipMapCount;
+
+	return true;
+}
+
+
+bool mvPNGDecoder::decode(const std::string& imagePath, mvImageData &image,
+                          const mvDecodeOptions& options) const {
+
+  resetImage(image);
+  
+  // This function was originally written by David Grayson for
+  // https://github.com/DavidEGrayson/ahrs-visualizer
+
+  png_byte header[8];
+
+  FILE *fp = fopen(imagePath.c_str(), "rb");
+  if (fp == 0) {
+    perror(imagePath.c_str());
+    return false;
+  }
+
+  // read the header
+  fread(header, 1, 8, fp);
+
+  if (png_sig_cmp(header, 0, 8)) {
+    fprintf(stderr, "error: %s is not a PNG.\n", imagePath.c_str());
+    fclose(fp);
+    return false;
+  }
+
+  png_structp png_ptr =
+    png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (!png_ptr) {
+    fprintf(stderr, "error: png_create_read_struct returned 0.\n");
+    fclose(fp);
+    return false;
+  }
+
+  // create png info struct
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  if (!info_ptr) {
+    fprintf(stderr, "error: png_create_info_struct returned 0.\n");
+    png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
+    fclose(fp);
+    return false;
+  }
+
+  // create png info struct
+  png_infop end_info = png_create_info_struct(png_ptr);
+  if (!end_info) {
+    fprintf(stderr, "error: png_create_info_struct returned 0.\n");
+    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
+    fclose(fp);
+    return false;
+  }
+
+  // the code in this if statement gets called if libpng encounters an error
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    fprintf(stderr, "error from libpng\n");
+    png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+    fclose(fp);
+    return false;
+  }
+
+  // init png reading
+  png_init_io(png_ptr, fp);
+
+  // let libpng know you already read the first 8 bytes
+  png_set_sig_bytes(png_ptr, 8);
+
+  // read all the info up to the image data
+  png_read_info(png_ptr, info_ptr);
+
+  // variables to pass to get info
+  int bit_depth, color_type;
+  png_uint_32 temp_width, temp_height;
+
+  // get info about png
+  png_get_IHDR(png_ptr, info_ptr, &temp_width, &temp_height,
+               &bit_depth, &color_type,
+               NULL, NULL, NULL);
+
+  image.width = temp_width;
+  image.height = temp_height;
+  
+  //printf("%s: %lux%lu %d\n", imagePath, temp_width, temp_height, color_type);
+
+  // Palettes and gray images of fewer than 8 bits get unpacked to 8
+  // bits by libpng, and a transparency chunk becomes an alpha channel.
+  // 16-bit samples are left alone, and converted below.
+  if (color_type == PNG_COLOR_TYPE_PALETTE)
+    png_set_palette_to_rgb(png_ptr);
+  if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+    png_set_expand_gray_1_2_4_to_8(png_ptr);
+  if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
+    png_set_tRNS_to_alpha(png_ptr);
+  png_set_interlace_handling(png_ptr);
+
+  // Update the png info struct.
+  png_read_update_info(png_ptr, info_ptr);
+  color_type = png_get_color_type(png_ptr, info_ptr);
+  bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+  GLint format;
+  switch(color_type) {
+  case PNG_COLOR_TYPE_GRAY:
+    format = GL_RED;
+    image.swizzle[1] = GL_RED;
+    image.swizzle[2] = GL_RED;
+    image.swizzle[3] = GL_ONE;
+    break;
+  case PNG_COLOR_TYPE_GRAY_ALPHA:
+    format = GL_RG;
+    image.swizzle[1] = GL_RED;
+    image.swizzle[2] = GL_RED;
+    image.swizzle[3] = GL_GREEN;
+    break;
+  case PNG_COLOR_TYPE_RGB:
+    format = GL_RGB;
+    break;
+  case PNG_COLOR_TYPE_RGB_ALPHA:
+    format = GL_RGBA;
+    break;
+  default:
+    fprintf(stderr, "%s: Unknown libpng color type %d.\n", imagePath.c_str(), color_type);
+    png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+    fclose(fp);
+    return false;
+  }
+
+  // 16-bit samples are converted here, rather than by libpng: kept
+  // for gray images if we were asked to, and narrowed otherwise.
+  int samples = temp_width * png_get_channels(png_ptr, info_ptr);
+  bool keep = (bit_depth == 16) && options.keep16Bit &&
+    (format == GL_RED || format == GL_RG);
+  bool narrow = (bit_depth == 16) && !keep;
+
+  // Row size in bytes, as libpng reads it, and as we store it.
+  int readRowbytes = png_get_rowbytes(png_ptr, info_ptr);
+  int rowbytes = narrow ? samples : readRowbytes;
+
+  // glTexImage2d requires rows to be 4-byte aligned
+  readRowbytes += 3 - ((readRowbytes-1) % 4);
+  rowbytes += 3 - ((rowbytes-1) % 4);
+
+  image.format = format;
+  image.type = keep ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE;
+  png_byte ** row_pointers = NULL;
+
+  if (narrow && png_get_interlace_type(png_ptr, info_ptr) == PNG_INTERLACE_NONE) {
+
+    // Read a row at a time into scratch space past the end of the
+    // image, and narrow it into place while it's still in the cache.
+    image.pixels.resize(rowbytes * temp_height + readRowbytes);
+    png_byte * image_data = &image.pixels[0];
+    png_byte * scratch = image_data + rowbytes * temp_height;
+
+    for (unsigned int i = 0; i < temp_height; i++) {
+      png_read_row(png_ptr, scratch, NULL);
+      narrow16to8(scratch, image_data + (temp_height - 1 - i) * rowbytes,
+                  samples);
+    }
+
+  } else {
+
+    // Allocate the image data as a big block, to be given to opengl
+    image.pixels.resize(readRowbytes * temp_height * sizeof(png_byte)+15);
+    png_byte * image_data = &image.pixels[0];
+
+    // row_pointers is for pointing to image_data for reading the png with libpng
+    row_pointers = (png_byte **)malloc(temp_height * sizeof(png_byte *));
+    if (row_pointers == NULL) {
+      fprintf(stderr, "error: could not allocate memory for PNG row pointers\n");
+      png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+      fclose(fp);
+      return false;
+    }
+
+    // set the individual row_pointers to point at the correct offsets of image_data
+    for (unsigned int i = 0; i < temp_height; i++) {
+      row_pointers[temp_height - 1 - i] = image_data + i * readRowbytes;
+    }
+
+    // read the png into image_data through row_pointers
+    png_read_image(png_ptr, row_pointers);
+
+    // Interlaced images have to be read whole before they can be
+    // converted.  Narrowed rows are shorter, so they can be written
+    // over the ones already done.
+    for (unsigned int i = 0; i < temp_height && bit_depth == 16; i++) {
+      if (keep) {
+        swap16(image_data + i * readRowbytes, image_data + i * rowbytes, samples);
+      } else {
+        narrow16to8(image_data + i * readRowbytes, image_data + i * rowbytes,
+                    samples);
+      }
+    }
+  }
+
+  if (bit_depth == 16) image.pixels.resize(rowbytes * temp_height);
+  image.rowBytes = rowbytes;
+
+  // clean up
+  png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
+  free(row_pointers);
+  fclose(fp);
+  return true;
+}
@@ -0,0 +1,122 @@
+#ifndef IMAGEDECODER_H
+#define IMAGEDECODER_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include <GL/glew.h>
+
+// An image read from a file, ready to hand to OpenGL.  Reading and
+// decoding a file doesn't need an OpenGL context, so it can be done on
+// any thread.  Only the upload has to happen on the rendering thread.
+struct mvImageData {
+  GLsizei width, height;
+
+  // GL_RGB, GL_RGBA or GL_BGR, or one of the compressed formats, or
+  // GL_RED or GL_RG for gray images.
+  GLenum format;
+
+  // For GL_RED and GL_RG images, where the shaders' red, green, blue
+  // and alpha come from, as for GL_TEXTURE_SWIZZLE_RGBA.
+  GLint swizzle[4];
+
+  // GL_UNSIGNED_BYTE, or GL_UNSIGNED_SHORT for gray images kept at 16
+  // bits, in the machine's byte order.
+  GLenum type;
+
+  // For compressed images, which come with their mipmaps.
+  unsigned int mipMapCount;
+
+  // The length of a row of pixels, in bytes, for uncompressed
+  // images.  Rows are padded to a multiple of 4 bytes, as OpenGL
+  // expects by default.
+  int rowBytes;
+
+  std::vector<unsigned char> pixels;
+
+  mvImageData() :
+    width(0), height(0), format(GL_RGBA), type(GL_UNSIGNED_BYTE),
+    mipMapCount(0), rowBytes(0) {
+    swizzle[0] = GL_RED;
+    swizzle[1] = GL_GREEN;
+    swizzle[2] = GL_BLUE;
+    swizzle[3] = GL_ALPHA;
+  };
+};
+
+// Things a caller can ask of a decoder.  A decoder that can't do one
+// of them just ignores it.
+struct mvDecodeOptions {
+
+  // Keep 16-bit gray samples instead of narrowing them to 8 bits.
+  bool keep16Bit;
+
+  // The smallest image, in pixels, the caller can use.  Zero means
+  // full size.  A decoder that can shrink an image cheaply while it
+  // decodes (JPEG can) may return anything at least this big.
+  int neededWidth, neededHeight;
+
+  mvDecodeOptions() : keep16Bit(false), neededWidth(0), neededHeight(0) {};
+};
+
+// Reads one kind of image file.  Decoders keep no state between
+// calls, so one can be used from several threads at once.
+class mvImageDecoder {
+ public:
+  virtual ~mvImageDecoder() {};
+
+  virtual std::string getName() const = 0;
+
+  // Whether the first bytes of a file are the signature of this kind
+  // of image.  length is how many there are, which may be fewer than
+  // were asked for if the file is short.
+  virtual bool matches(const unsigned char* header, size_t length) const = 0;
+
+  // Reads the file into image, which belongs to the caller.  Its pixel
+  // buffer is resized rather than replaced, so a caller decoding lots
+  // of images can hand in the same one each time and not reallocate.
+  // Problems are printed, and make it return false.
+  virtual bool decode(const std::string& path, mvImageData& image,
+                      const mvDecodeOptions& options) const = 0;
+};
+
+// The decoders we know about, to be looked up by the signature at the
+// start of a file, or failing that by its extension.  PNG, JPEG, BMP
+// and DDS are registered to begin with.
+class mvImageDecoderRegistry {
+ private:
+  // The registry owns the decoders.
+  std::vector<mvImageDecoder*> _decoders;
+
+  typedef std::map<std::string, mvImageDecoder*> extensionMap;
+  extensionMap _extensions;
+
+  // The most signature bytes any decoder looks at.
+  static const size_t headerLength = 16;
+
+  mvImageDecoderRegistry();
+  ~mvImageDecoderRegistry();
+
+  // No copying.
+  mvImageDecoderRegistry(const mvImageDecoderRegistry&);
+  mvImageDecoderRegistry& operator=(const mvImageDecoderRegistry&);
+
+ public:
+  // There's just the one.  Register decoders before any threads start
+  // decoding; looking them up is safe from any thread.
+  static mvImageDecoderRegistry& get();
+
+  // Adds a decoder, which the registry then owns, for files with the
+  // given extensions (lower case, no dot, separated by spaces).
+  void registerDecoder(mvImageDecoder* decoder, const std::string& extensions);
+
+  // The decoder for files with this extension, or NULL.
+  mvImageDecoder* findByExtension(const std::string& extension) const;
+
+  // The decoder for this file, by its signature or else its
+  // extension, or NULL if there isn't one.
+  mvImageDecoder* findForFile(const std::string& path) const;
+};
+
+#endif
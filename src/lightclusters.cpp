@@ -0,0 +1,287 @@
+#include "lightclusters.h"
+
+#include <math.h>
+#include <algorithm>
+
+#include "gpumemory.h"
+
+// The constants are the ones in PlanktonShading.fragmentshader.
+static const float ambientCoefficient = 0.6f;
+static const float falloff = 0.01f;
+
+// Which of the textures is which.
+static const int lightTexture = 0;
+static const int gridTexture = 1;
+static const int indexTexture = 2;
+
+// The texture unit the first of them is bound to.
+static const int firstUnit = 2;
+
+mvLightClusters::mvLightClusters(mvLights* lights, int tilesX, int tilesY,
+                                 int slices) :
+  _lights(lights), _tilesX(tilesX), _tilesY(tilesY), _slices(slices),
+  _cutoff(1.0f / 256.0f), _boxesMade(false),
+  _near(0.1f), _far(100.0f), _depthScale(1.0f), _indexRows(1),
+  _ambient(0.0f, 0.0f, 0.0f),
+  _lightSamplerID(-1), _gridSamplerID(-1), _indexSamplerID(-1),
+  _lightCountID(-1), _indexRowsID(-1), _clusterSizeID(-1), _viewportID(-1),
+  _depthID(-1), _ambientID(-1), _programID(0) {
+
+  for (int i = 0; i < 3; i++) {
+    _textureIDs[i] = 0;
+    _textureWidth[i] = 0;
+    _textureHeight[i] = 0;
+    _gpuBytes[i] = 0;
+  }
+  _viewport[0] = _viewport[1] = 0;
+  _viewport[2] = _viewport[3] = 1;
+}
+
+mvLightClusters::~mvLightClusters() {
+
+  for (int i = 0; i < 3; i++) {
+    if (_textureIDs[i]) glDeleteTextures(1, &_textureIDs[i]);
+    mvGPUMemory::release(gpuTEXTURE, _gpuBytes[i]);
+  }
+}
+
+float mvLightClusters::getRadius(const MVec3& color) {
+
+  // The light falls off as 1 / (1 + falloff * d^2), so it's down to
+  // the cutoff where d^2 = (brightest / cutoff - 1) / falloff.
+  float brightest = std::max(color.x, std::max(color.y, color.z));
+  if (brightest <= _cutoff) return 0.0f;
+  return sqrtf((brightest / _cutoff - 1.0f) / falloff);
+}
+
+int mvLightClusters::sliceOf(float depth) {
+
+  if (depth <= _near) return 0;
+  int slice = (int)floorf(logf(depth / _near) * _depthScale);
+  return std::min(std::max(slice, 0), _slices - 1);
+}
+
+void mvLightClusters::makeBoxes(const MMat4& projection) {
+
+  MMat4 inverse = glm::inverse(projection);
+
+  // The near and far planes, from the middle of the screen.  A
+  // projection with its far plane at infinity gets one a long way out.
+  MVec4 nearPoint = inverse * MVec4(0.0f, 0.0f, -1.0f, 1.0f);
+  MVec4 farPoint = inverse * MVec4(0.0f, 0.0f, 1.0f, 1.0f);
+  _near = -nearPoint.z / nearPoint.w;
+  _far = (farPoint.w != 0.0f) ? -farPoint.z / farPoint.w : 0.0f;
+  if (!(_near > 0.0f)) _near = 0.01f;
+  if (!(_far > _near && _far < 1e30f)) _far = _near * 10000.0f;
+  _depthScale = _slices / logf(_far / _near);
+
+  // The directions through the corners of the tiles, scaled to one
+  // unit deep.  The frustum needn't be symmetric.
+  int cornersX = _tilesX + 1;
+  std::vector<MVec2> corners(cornersX * (_tilesY + 1));
+  for (int j = 0; j <= _tilesY; j++) {
+    for (int i = 0; i <= _tilesX; i++) {
+      MVec4 p = inverse * MVec4(-1.0f + 2.0f * i / _tilesX,
+                                -1.0f + 2.0f * j / _tilesY, -1.0f, 1.0f);
+      corners[j * cornersX + i] = MVec2(p.x, p.y) / (-p.z);
+    }
+  }
+
+  int clusters = getNumClusters();
+  _boxMin.resize(clusters);
+  _boxMax.resize(clusters);
+
+  for (int k = 0; k < _slices; k++) {
+    float depthNear = _near * expf(k / _depthScale);
+    float depthFar = (k == _slices - 1) ? _far : _near * expf((k + 1) / _depthScale);
+
+    for (int j = 0; j < _tilesY; j++) {
+      for (int i = 0; i < _tilesX; i++) {
+        MVec2 lo(1e30f, 1e30f), hi(-1e30f, -1e30f);
+        for (int c = 0; c < 4; c++) {
+          const MVec2& dir = corners[(j + c / 2) * cornersX + i + c % 2];
+          lo = glm::min(lo, glm::min(dir * depthNear, dir * depthFar));
+          hi = glm::max(hi, glm::max(dir * depthNear, dir * depthFar));
+        }
+        int cluster = (k * _tilesY + j) * _tilesX + i;
+        _boxMin[cluster] = MVec3(lo.x, lo.y, -depthFar);
+        _boxMax[cluster] = MVec3(hi.x, hi.y, -depthNear);
+      }
+    }
+  }
+
+  _boxProjection = projection;
+  _boxesMade = true;
+}
+
+void mvLightClusters::bin(const MMat4& viewMatrix) {
+
+  int numLights = _lights->getNumLights();
+  int clusters = getNumClusters();
+  int tiles = _tilesX * _tilesY;
+
+  _hitClusters.clear();
+  _hitLights.clear();
+  _ambient = MVec3(0.0f, 0.0f, 0.0f);
+  _lightData.assign(8 * std::max(numLights, 1), 0.0f);
+
+  for (int l = 0; l < numLights; l++) {
+    MVec3 color = _lights->getColor(l);
+    MVec3 center = MVec3(viewMatrix * MVec4(_lights->getPosition(l), 1.0f));
+    float radius = getRadius(color);
+    float brightest = std::max(color.x, std::max(color.y, color.z));
+
+    _ambient += ambientCoefficient * color;
+
+    float* data = &_lightData[8 * l];
+    data[0] = center.x;
+    data[1] = center.y;
+    data[2] = center.z;
+    data[3] = radius;
+    data[4] = color.x;
+    data[5] = color.y;
+    data[6] = color.z;
+    data[7] = (radius > 0.0f) ? _cutoff / brightest : 1.0f;
+
+    if (radius <= 0.0f) continue;
+
+    // The slices the light's sphere spans, then the clusters in them
+    // whose boxes it touches.
+    float front = -center.z - radius;
+    float back = -center.z + radius;
+    if (back < _near || front > _far) continue;
+    int firstSlice = sliceOf(front);
+    int lastSlice = sliceOf(back);
+
+    float radiusSquared = radius * radius;
+    for (int k = firstSlice; k <= lastSlice; k++) {
+      for (int cluster = k * tiles; cluster < (k + 1) * tiles; cluster++) {
+        MVec3 nearest = glm::clamp(center, _boxMin[cluster], _boxMax[cluster]);
+        MVec3 d = center - nearest;
+        if (glm::dot(d, d) <= radiusSquared) {
+          _hitClusters.push_back(cluster);
+          _hitLights.push_back(l);
+        }
+      }
+    }
+  }
+
+  // Count the lights in each cluster, turn the counts into where each
+  // list starts, and then fill in the lists.
+  _clusterData.assign(2 * clusters, 0.0f);
+  for (size_t h = 0; h < _hitClusters.size(); h++) {
+    _clusterData[2 * _hitClusters[h] + 1] += 1.0f;
+  }
+
+  _fill.resize(clusters);
+  int start = 0;
+  for (int c = 0; c < clusters; c++) {
+    _clusterData[2 * c] = (float)start;
+    _fill[c] = start;
+    start += (int)_clusterData[2 * c + 1];
+  }
+
+  _indexRows = std::max(1, (start + INDEX_WIDTH - 1) / INDEX_WIDTH);
+  _indexData.assign(_indexRows * INDEX_WIDTH, 0.0f);
+  for (size_t h = 0; h < _hitClusters.size(); h++) {
+    _indexData[_fill[_hitClusters[h]]++] = (float)_hitLights[h];
+  }
+}
+
+void mvLightClusters::upload(int texture, GLint internalFormat, GLenum format,
+                             int width, int height, const float* data) {
+
+  if (_textureIDs[texture] == 0) {
+    glGenTextures(1, &_textureIDs[texture]);
+    glBindTexture(GL_TEXTURE_2D, _textureIDs[texture]);
+
+    // These are tables, not pictures: no blending between texels.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, _textureIDs[texture]);
+  }
+
+  if (width == _textureWidth[texture] && height == _textureHeight[texture]) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, GL_FLOAT, data);
+  } else {
+    mvGPUMemory::release(gpuTEXTURE, _gpuBytes[texture]);
+    _gpuBytes[texture] = 0;
+    mvGPUMemory::texImage2D(gpuTEXTURE, _gpuBytes[texture], GL_TEXTURE_2D, 0,
+                            internalFormat, width, height, 0, format, GL_FLOAT,
+                            data);
+    _textureWidth[texture] = width;
+    _textureHeight[texture] = height;
+  }
+}
+
+void mvLightClusters::load(GLuint programID) {
+
+  // The names in ClusteredShading.fragmentshader.
+  _programID = programID;
+  glUseProgram(programID);
+  _lightSamplerID = glGetUniformLocation(programID, "mvClusterLights");
+  _gridSamplerID = glGetUniformLocation(programID, "mvClusterGrid");
+  _indexSamplerID = glGetUniformLocation(programID, "mvClusterIndices");
+  _lightCountID = glGetUniformLocation(programID, "mvLightCount");
+  _indexRowsID = glGetUniformLocation(programID, "mvIndexRows");
+  _clusterSizeID = glGetUniformLocation(programID, "mvClusterSize");
+  _viewportID = glGetUniformLocation(programID, "mvClusterViewport");
+  _depthID = glGetUniformLocation(programID, "mvClusterDepth");
+  _ambientID = glGetUniformLocation(programID, "mvAmbientLight");
+}
+
+void mvLightClusters::update(const MMat4& viewMatrix,
+                             const MMat4& projectionMatrix) {
+
+  glGetIntegerv(GL_VIEWPORT, _viewport);
+
+  // The boxes only change with the projection.  A stereo pair has two
+  // projections, so they're made over for each eye, which is cheap
+  // next to the binning.
+  if (!_boxesMade || projectionMatrix != _boxProjection) {
+    makeBoxes(projectionMatrix);
+  }
+  bin(viewMatrix);
+
+  upload(lightTexture, GL_RGBA32F, GL_RGBA,
+         2, std::max(_lights->getNumLights(), 1), &_lightData[0]);
+  upload(gridTexture, GL_RG32F, GL_RG,
+         _tilesX * _tilesY, _slices, &_clusterData[0]);
+  upload(indexTexture, GL_R32F, GL_RED,
+         INDEX_WIDTH, _indexRows, &_indexData[0]);
+
+  bind();
+}
+
+void mvLightClusters::bind() {
+
+  // The textures go in units no one else uses, so they stay bound
+  // for the whole view.  The shapes' own textures are in unit 0, and
+  // a virtual texture's page table is in unit 1.
+  glActiveTexture(GL_TEXTURE0 + firstUnit + lightTexture);
+  glBindTexture(GL_TEXTURE_2D, _textureIDs[lightTexture]);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + gridTexture);
+  glBindTexture(GL_TEXTURE_2D, _textureIDs[gridTexture]);
+  glActiveTexture(GL_TEXTURE0 + firstUnit + indexTexture);
+  glBindTexture(GL_TEXTURE_2D, _textureIDs[indexTexture]);
+  glActiveTexture(GL_TEXTURE0);
+
+  // Uniforms belong to the program, and keep their values until
+  // they're set again, so they only need setting once a view too.
+  if (_programID == 0) return;
+  glUseProgram(_programID);
+  glUniform1i(_lightSamplerID, firstUnit + lightTexture);
+  glUniform1i(_gridSamplerID, firstUnit + gridTexture);
+  glUniform1i(_indexSamplerID, firstUnit + indexTexture);
+
+  glUniform1f(_lightCountID, (float)_textureHeight[lightTexture]);
+  glUniform1f(_indexRowsID, (float)_indexRows);
+  glUniform3f(_clusterSizeID, (float)_tilesX, (float)_tilesY, (float)_slices);
+  glUniform4f(_viewportID, (float)_viewport[0], (float)_viewport[1],
+              (float)_viewport[2], (float)_viewport[3]);
+  glUniform2f(_depthID, _near, _depthScale);
+  glUniform3fv(_ambientID, 1, &_ambient.x);
+}
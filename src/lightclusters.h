@@ -0,0 +1,160 @@
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include <stddef.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "vecTypes.h"
+#include "shader.h"
+
+// Lighting for scenes with many lights, where looping over every
+// light at every fragment, as the plankton shaders do, costs too much,
+// and where recompiling the shaders whenever a light is added (see the
+// 'XX' in mvShader) won't do.
+//
+// The view frustum is cut into a grid of clusters: tiles across the
+// screen, and slices of depth that get thicker with distance.  Each
+// view, update() works out, on the CPU, which lights reach which
+// clusters, and hands the result to the shader in three textures: the
+// lights themselves, a list of light numbers for each cluster, one
+// list after another, and for each cluster where its list starts and
+// how long it is.  The fragment shader (see
+// ClusteredShading.fragmentshader) finds its cluster from where it is
+// on the screen and how far away it is, and loops over just the
+// lights on that cluster's list.  The number of lights is a uniform,
+// so lights can come and go without touching the shaders.
+//
+// The lights come from an mvLights, and fall off as they do in the
+// plankton shaders, except that each is cut off where it gets dimmer
+// than a threshold, so that it has a radius to bin by.  The ambient
+// part of the plankton lighting doesn't fall off at all, so it's
+// added up over all the lights, once, and doesn't need the clusters.
+//
+// The textures are stand-ins for the storage buffers a newer version
+// of GLSL would use; the shaders here are GLSL 1.20.  The projection
+// is taken to be a perspective one.
+//
+// Like mvLights, load() gets the uniforms of a program.  Nothing
+// changes from one shape to the next within a view, so unlike
+// mvLights, the textures are bound and the uniforms set once a view,
+// by update(), rather than as each shape is drawn.  update() needs the
+// OpenGL context.
+class mvLightClusters {
+ private:
+  mvLights* _lights;
+
+  // How many tiles across and down, and how many slices deep.
+  int _tilesX, _tilesY, _slices;
+
+  // Light dimmer than this, as a fraction of its color, is cut off.
+  float _cutoff;
+
+  // What the cluster boxes below were made for.
+  MMat4 _boxProjection;
+  bool _boxesMade;
+
+  // The depths of the near and far planes, and the box around each
+  // cluster, in camera coordinates.  Cluster numbers go across the
+  // tiles, then down, then back through the slices.  A depth's slice
+  // is log(depth / _near) * _depthScale.
+  float _near, _far;
+  float _depthScale;
+  std::vector<MVec3> _boxMin;
+  std::vector<MVec3> _boxMax;
+
+  // The viewport the tiles are cut from.
+  GLint _viewport[4];
+
+  // Four floats a texel.  Two texels per light: its position in
+  // camera coordinates and its radius, then its color and how much
+  // the falloff is lowered to reach zero at the radius.
+  std::vector<float> _lightData;
+  // Two floats a cluster: where its list starts, and its length.
+  std::vector<float> _clusterData;
+  // The lists, in rows of INDEX_WIDTH.
+  std::vector<float> _indexData;
+  int _indexRows;
+
+  MVec3 _ambient;
+
+  // Scratch space for the binning: the clusters and lights that
+  // touch, a pair at a time, and where each cluster's list is filled
+  // up to.
+  std::vector<int> _hitClusters;
+  std::vector<int> _hitLights;
+  std::vector<int> _fill;
+
+  // The textures, their sizes, and what they take, as counted by
+  // mvGPUMemory.
+  GLuint _textureIDs[3];
+  int _textureWidth[3];
+  int _textureHeight[3];
+  size_t _gpuBytes[3];
+
+  // Where the shader's uniforms are.  See load() for their names.
+  GLint _lightSamplerID;
+  GLint _gridSamplerID;
+  GLint _indexSamplerID;
+  GLint _lightCountID;
+  GLint _indexRowsID;
+  GLint _clusterSizeID;
+  GLint _viewportID;
+  GLint _depthID;
+  GLint _ambientID;
+  GLuint _programID;
+
+  // The cluster a depth, in front of the camera, is in.
+  int sliceOf(float depth);
+
+  void makeBoxes(const MMat4& projection);
+  void bin(const MMat4& viewMatrix);
+
+  // Binds the textures and sets the uniforms of the program.
+  void bind();
+
+  // Sends one of the textures, making it over if its size changed.
+  void upload(int texture, GLint internalFormat, GLenum format,
+              int width, int height, const float* data);
+
+  // No copying; the object owns OpenGL textures.
+  mvLightClusters(const mvLightClusters&);
+  mvLightClusters& operator=(const mvLightClusters&);
+
+ public:
+  // The width of the rows the light lists are kept in.  The shader
+  // has its own copy.
+  static const int INDEX_WIDTH = 1024;
+
+  // The lights stay with the caller.  16 x 9 tiles by 24 slices suits
+  // a wide screen.
+  mvLightClusters(mvLights* lights, int tilesX = 16, int tilesY = 9,
+                  int slices = 24);
+  ~mvLightClusters();
+
+  void setCutoff(float cutoff) { _cutoff = cutoff; };
+  float getCutoff() { return _cutoff; };
+
+  // How far a light of this color reaches before it's cut off.
+  float getRadius(const MVec3& color);
+
+  mvLights* getLights() { return _lights; };
+
+  // Gets the uniforms of this program, which is the one update()
+  // sets them in.
+  void load(GLuint programID);
+
+  // Bins the lights for a view, sends the results to the GPU, and
+  // binds them for drawing.  Call this once for each view, before
+  // drawing anything lit by them.
+  void update(const MMat4& viewMatrix, const MMat4& projectionMatrix);
+
+  // How many lights the clusters hold between them, counting each
+  // light once for each cluster it reaches.  Each fragment loops over
+  // about this many divided by the number of clusters.
+  int getListLength() { return _hitLights.size(); };
+  int getNumClusters() { return _tilesX * _tilesY * _slices; };
+};
+
+#endif
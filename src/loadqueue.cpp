@@ -0,0 +1,206 @@
+#include <chrono>
+#include <stdexcept>
+
+#include "loadqueue.h"
+
+// How long it's been since start, in milliseconds.
+static double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+}
+
+mvLoadQueue::mvLoadQueue(int nWorkers) : _stopping(false) {
+
+  if (nWorkers <= 0) {
+    nWorkers = std::thread::hardware_concurrency() - 1;
+    if (nWorkers < 1) nWorkers = 1;
+  }
+
+  for (int i = 0; i < nWorkers; i++)
+    _workers.push_back(std::thread(&mvLoadQueue::workerLoop, this));
+}
+
+mvLoadQueue::~mvLoadQueue() {
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stopping = true;
+  }
+  _wakeup.notify_all();
+
+  for (size_t i = 0; i < _workers.size(); i++) _workers[i].join();
+
+  // Whatever didn't get loaded.
+  for (size_t i = 0; i < _toPrepare.size(); i++) delete _toPrepare[i].first;
+  for (ownerShapes::iterator it = _toLoad.begin(); it != _toLoad.end(); it++)
+    for (size_t i = 0; i < it->second.size(); i++) delete it->second[i];
+  for (ownerShapes::iterator it = _failed.begin(); it != _failed.end(); it++)
+    for (size_t i = 0; i < it->second.size(); i++) delete it->second[i];
+  for (size_t i = 0; i < _cancelled.size(); i++) delete _cancelled[i];
+}
+
+void mvLoadQueue::add(mvShape* shape, const void* owner) {
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _toPrepare.push_back(std::make_pair(shape, owner));
+  }
+  _wakeup.notify_one();
+}
+
+void mvLoadQueue::workerLoop() {
+
+  while (true) {
+
+    mvShape* shape;
+    const void* owner;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (!_stopping && _toPrepare.empty()) _wakeup.wait(lock);
+      if (_stopping) return;
+
+      shape = _toPrepare.front().first;
+      owner = _toPrepare.front().second;
+      _toPrepare.pop_front();
+      _preparing[shape] = owner;
+    }
+
+    bool ok = true;
+    try {
+      shape->prepare();
+    } catch (const std::exception& e) {
+      std::cerr << "Can't load shape: " << e.what() << std::endl;
+      ok = false;
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _preparing.erase(shape);
+    if (_cancelWhenPrepared.erase(shape)) {
+      _cancelled.push_back(shape);
+    } else if (ok) {
+      _toLoad[owner].push_back(shape);
+    } else {
+      _failed[owner].push_back(shape);
+    }
+  }
+}
+
+int mvLoadQueue::step(double budgetMs, std::vector<mvShape*>& loaded,
+                      std::vector<mvShape*>* failed, const void* owner) {
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int count = 0;
+
+  while (true) {
+
+    mvShape* shape = NULL;
+    std::deque<mvShape*> prepareFailed;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      ownerShapes::iterator it = _failed.find(owner);
+      if (it != _failed.end()) {
+        prepareFailed.swap(it->second);
+        _failed.erase(it);
+      }
+      it = _toLoad.find(owner);
+      if (it != _toLoad.end()) {
+        shape = it->second.front();
+        it->second.pop_front();
+        if (it->second.empty()) _toLoad.erase(it);
+      }
+    }
+
+    for (size_t i = 0; i < prepareFailed.size(); i++) {
+      if (failed) {
+        failed->push_back(prepareFailed[i]);
+      } else {
+        delete prepareFailed[i];
+      }
+    }
+    if (shape == NULL) break;
+
+    try {
+      shape->load();
+      loaded.push_back(shape);
+      count++;
+    } catch (const std::exception& e) {
+      std::cerr << "Can't load shape: " << e.what() << std::endl;
+      if (failed) {
+        failed->push_back(shape);
+      } else {
+        delete shape;
+      }
+    }
+
+    if (msSince(start) >= budgetMs) break;
+  }
+
+  return count;
+}
+
+void mvLoadQueue::cancelFrom(ownerShapes& from, const void* owner) {
+
+  ownerShapes::iterator it = from.find(owner);
+  if (it == from.end()) return;
+  _cancelled.insert(_cancelled.end(), it->second.begin(), it->second.end());
+  from.erase(it);
+}
+
+void mvLoadQueue::cancel(const void* owner) {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  size_t kept = 0;
+  for (size_t i = 0; i < _toPrepare.size(); i++) {
+    if (_toPrepare[i].second == owner) {
+      _cancelled.push_back(_toPrepare[i].first);
+    } else {
+      _toPrepare[kept++] = _toPrepare[i];
+    }
+  }
+  _toPrepare.resize(kept);
+
+  // A worker may be in the middle of reading one of these.  It's left
+  // to finish, and the shape is put with the others when it's done.
+  for (std::map<mvShape*, const void*>::iterator it = _preparing.begin();
+       it != _preparing.end(); it++) {
+    if (it->second == owner) _cancelWhenPrepared.insert(it->first);
+  }
+
+  cancelFrom(_toLoad, owner);
+  cancelFrom(_failed, owner);
+}
+
+bool mvLoadQueue::deleteCancelled(double budgetMs) {
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  std::vector<mvShape*> toDelete;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    toDelete.swap(_cancelled);
+  }
+
+  // Deleting a shape doesn't take long, so the clock is only looked
+  // at every so often.
+  size_t i = 0;
+  while (i < toDelete.size()) {
+    delete toDelete[i++];
+    if ((i % 64) == 0 && msSince(start) >= budgetMs) break;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _cancelled.insert(_cancelled.end(), toDelete.begin() + i, toDelete.end());
+  return _cancelled.empty() && _cancelWhenPrepared.empty();
+}
+
+int mvLoadQueue::getPendingCount() {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  int count = _toPrepare.size() + _preparing.size() - _cancelWhenPrepared.size();
+  for (ownerShapes::iterator it = _toLoad.begin(); it != _toLoad.end(); it++)
+    count += it->second.size();
+  for (ownerShapes::iterator it = _failed.begin(); it != _failed.end(); it++)
+    count += it->second.size();
+  return count;
+}
@@ -0,0 +1,108 @@
+#ifndef LOADQUEUE_H
+#define LOADQUEUE_H
+
+#include <deque>
+#include <vector>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "mvShape.h"
+
+// Loads shapes a few at a time, so the program can go on drawing
+// while a big scene comes in, instead of showing nothing until it's
+// all there.
+//
+// Shapes go through two stages (see mvShape::prepare() and load()).
+// The first, reading and decoding files, is done by worker threads as
+// soon as a shape is added.  The second, creating the OpenGL buffers
+// and textures, has to be done on the rendering thread, so step() is
+// called once a frame to do as much of it as fits in a time budget.
+// Finished shapes are handed back from step(), ready to draw.
+//
+// One queue, and one set of workers, is meant to serve the whole
+// program.  Each shape is added for an owner, which is only a tag,
+// never looked at: step() hands back just that owner's shapes, and
+// cancel() takes back all of them, so that several scenes can load
+// through the same queue without sharing out the cores between them.
+//
+// The queue owns the shapes between add() and step().  A shape that
+// fails to load is reported and deleted, or handed back to the caller
+// of step() if it asks for them.  Cancelled shapes, including any a
+// worker is busy with, are deleted by deleteCancelled(), a few at a
+// time, on the rendering thread; nothing waits for a worker to finish.
+class mvLoadQueue {
+ private:
+
+  typedef std::map<const void*, std::deque<mvShape*> > ownerShapes;
+
+  // Shapes waiting for a worker thread, and their owners.
+  std::deque<std::pair<mvShape*, const void*> > _toPrepare;
+
+  // Shapes the workers are busy with, and their owners.
+  std::map<mvShape*, const void*> _preparing;
+
+  // Shapes that have been prepared, waiting for step(), by owner.
+  ownerShapes _toLoad;
+
+  // Shapes that failed in prepare(), by owner.  They are deleted in
+  // step(), since deleting a shape involves OpenGL calls.
+  ownerShapes _failed;
+
+  // Shapes that were being prepared when they were cancelled, which
+  // go to _cancelled when the worker is done with them, and the
+  // shapes waiting for deleteCancelled().
+  std::set<mvShape*> _cancelWhenPrepared;
+  std::vector<mvShape*> _cancelled;
+
+  std::mutex _mutex;
+  std::condition_variable _wakeup;
+  std::vector<std::thread> _workers;
+  bool _stopping;
+
+  void workerLoop();
+
+  // Moves the owner's shapes in 'from' to _cancelled.
+  void cancelFrom(ownerShapes& from, const void* owner);
+
+  // No copying; the object owns threads.
+  mvLoadQueue(const mvLoadQueue&);
+  mvLoadQueue& operator=(const mvLoadQueue&);
+
+ public:
+  // With nWorkers = 0, use one fewer than the number of cores, so the
+  // rendering thread has one to itself.
+  mvLoadQueue(int nWorkers = 0);
+  ~mvLoadQueue();
+
+  void add(mvShape* shape, const void* owner = NULL);
+
+  // Call this once a frame, from the thread with the OpenGL context.
+  // It loads the owner's prepared shapes until budgetMs milliseconds
+  // have gone by, and appends them to the loaded vector.  At least
+  // one shape is loaded if one is ready, so a shape that takes longer
+  // than the budget can still get through.  Returns the number of
+  // shapes loaded.  If failed isn't NULL, the owner's shapes that
+  // couldn't be loaded are appended to it, for the caller to delete,
+  // instead of being deleted here.
+  int step(double budgetMs, std::vector<mvShape*>& loaded,
+           std::vector<mvShape*>* failed = NULL, const void* owner = NULL);
+
+  // Gives up on all of the owner's shapes that haven't been handed
+  // back by step().  This doesn't wait for the workers; the shapes
+  // are deleted later, by deleteCancelled().
+  void cancel(const void* owner);
+
+  // Deletes cancelled shapes until budgetMs milliseconds have gone
+  // by.  Call this once a frame, from the thread with the OpenGL
+  // context.  Returns true if there are none left.
+  bool deleteCancelled(double budgetMs);
+
+  // The number of shapes added and not yet handed back or cancelled.
+  int getPendingCount();
+  bool isEmpty() { return getPendingCount() == 0; };
+};
+
+#endif
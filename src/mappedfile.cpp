@@ -0,0 +1,92 @@
+#include "mappedfile.h"
+
+#include <stdio.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// An empty file still counts as open, so it needs something non-NULL
+// to point at.
+static const char emptyFile[1] = { 0 };
+
+mvMappedFile::mvMappedFile(const std::string fileName) :
+  _data(NULL), _size(0), _mapped(false) {
+  open(fileName);
+}
+
+bool mvMappedFile::open(const std::string fileName) {
+
+  close();
+
+#ifndef _WIN32
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  if (st.st_size == 0) {
+    ::close(fd);
+    _data = emptyFile;
+    return true;
+  }
+
+  void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds its own reference to the file.
+  ::close(fd);
+
+  if (addr != MAP_FAILED) {
+    // We are going to read all of it, and probably from several
+    // threads at once, so ask the kernel to start paging it in now.
+    madvise(addr, st.st_size, MADV_WILLNEED);
+
+    _data = (const char*)addr;
+    _size = st.st_size;
+    _mapped = true;
+    return true;
+  }
+#endif
+
+  // No mmap(), or it didn't work.  Read the whole thing instead.
+  FILE* fp = fopen(fileName.c_str(), "rb");
+  if (fp == NULL) return false;
+
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  if (size < 0) {
+    fclose(fp);
+    return false;
+  }
+
+  _buffer.resize(size + 1);
+  if (fread(&_buffer[0], 1, size, fp) != (size_t)size) {
+    fclose(fp);
+    _buffer.clear();
+    return false;
+  }
+  fclose(fp);
+
+  _data = &_buffer[0];
+  _size = size;
+  return true;
+}
+
+void mvMappedFile::close() {
+
+#ifndef _WIN32
+  if (_mapped) munmap((void*)_data, _size);
+#endif
+
+  _buffer.clear();
+  _data = NULL;
+  _size = 0;
+  _mapped = false;
+}
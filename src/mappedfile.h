@@ -0,0 +1,45 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+// A read-only view of an entire file.  Where the platform allows it,
+// the file is mmap()ed, so the bytes come straight out of the OS page
+// cache as they are touched instead of being copied through stdio.
+// Where it doesn't, the file is just read into a buffer we own, so
+// callers see the same interface either way.
+//
+// The view stays valid until close() is called or the object is
+// destroyed, so don't hang on to the getData() pointer past that.
+class mvMappedFile {
+ private:
+  const char* _data;
+  size_t _size;
+
+  // True if _data points at an mmap()ed region, false if it points
+  // into _buffer.
+  bool _mapped;
+  std::vector<char> _buffer;
+
+  // No copying.  The mapping belongs to exactly one object.
+  mvMappedFile(const mvMappedFile&);
+  mvMappedFile& operator=(const mvMappedFile&);
+
+ public:
+  mvMappedFile() : _data(NULL), _size(0), _mapped(false) {};
+  mvMappedFile(const std::string fileName);
+  ~mvMappedFile() { close(); };
+
+  // Returns false (and leaves the object closed) if the file can't be
+  // opened or read.
+  bool open(const std::string fileName);
+  void close();
+
+  bool isOpen() const { return _data != NULL; };
+  const char* getData() const { return _data; };
+  size_t getSize() const { return _size; };
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "meshcache.h"
+#include "hash.h"
+
+#include <stdio.h>
+#include <cstring>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Bump this whenever the layout of the file, or the way the mesh in it
+// is made, changes.  Old cache files are then ignored and rewritten.
+static const uint32_t meshCacheVersion = 5;
+static const char meshCacheMagic[8] = { 'M','V','M','E','S','H', 0, 0 };
+static const uint32_t meshCacheByteOrder = 0x01020304;
+
+std::string mvMeshCache::_cacheDirectory;
+
+// Size and modification time of a file, for a cheap check on whether
+// it has changed.
+static bool getFileStamp(const std::string fileName,
+                         uint64_t* size, int64_t* modTime) {
+  struct stat st;
+  if (stat(fileName.c_str(), &st) != 0) return false;
+  *size = st.st_size;
+  *modTime = st.st_mtime;
+  return true;
+}
+
+static inline uint64_t alignUp(uint64_t offset) {
+  return (offset + 15) & ~(uint64_t)15;
+}
+
+std::string mvMeshCache::cacheFileName(const std::string objFileName) {
+
+  if (_cacheDirectory.empty()) return objFileName + ".mvmesh";
+
+  // All the cache files are in one directory, so two OBJ files with
+  // the same name in different places need to be told apart.  Tack a
+  // hash of the full path onto the name.
+  std::string baseName = objFileName.substr(objFileName.find_last_of("/") + 1);
+  char pathHash[17];
+  sprintf(pathHash, "%016llx",
+          (unsigned long long)mvHash64(objFileName.data(), objFileName.size()));
+
+  return _cacheDirectory + "/" + baseName + "-" + pathHash + ".mvmesh";
+}
+
+bool mvMeshCache::open(const std::string objFileName) {
+
+  close();
+
+#ifdef DEBUG
+  // Cache files are shared between machines, which all have to agree
+  // on the hash of an OBJ file.
+  static bool hashChecked = false;
+  if (!hashChecked) {
+    hashChecked = true;
+    if (!mvHash64Check())
+      std::cerr << "mvHash64 doesn't match XXH64; mesh caches written "
+                << "here won't be recognized elsewhere." << std::endl;
+  }
+#endif
+
+  std::string cacheName = cacheFileName(objFileName);
+  if (!_file.open(cacheName)) return false;
+
+  if (_file.getSize() < sizeof(mvMeshCacheHeader)) {
+    close();
+    return false;
+  }
+
+  _header = (const mvMeshCacheHeader*)_file.getData();
+
+  if ((memcmp(_header->magic, meshCacheMagic, sizeof(meshCacheMagic)) != 0) ||
+      (_header->byteOrder != meshCacheByteOrder) ||
+      (_header->version != meshCacheVersion)) {
+    close();
+    return false;
+  }
+
+  // Make sure the sections are all really there.
+  uint64_t nV = _header->vertexCount;
+  uint64_t fileSize = _file.getSize();
+  if ((_header->positionOffset + nV * sizeof(MVec3) > fileSize) ||
+      (_header->uvOffset + nV * sizeof(MVec2) > fileSize) ||
+      (_header->normalOffset + nV * sizeof(MVec3) > fileSize) ||
+      (_header->indexOffset +
+       (uint64_t)_header->indexCount * _header->indexSize > fileSize) ||
+      (_header->lodOffset +
+       (uint64_t)_header->lodCount * sizeof(mvMeshLOD) > fileSize)) {
+    std::cerr << cacheName << ": truncated mesh cache, ignoring it." << std::endl;
+    close();
+    return false;
+  }
+
+  // Now see if the OBJ file has changed.  If it's not there at all,
+  // the cache is all we have, so use it.
+  uint64_t sourceSize;
+  int64_t sourceModTime;
+  if (!getFileStamp(objFileName, &sourceSize, &sourceModTime)) return true;
+
+  if ((sourceSize == _header->sourceSize) &&
+      (sourceModTime == _header->sourceModTime)) return true;
+
+  // The size or time is different.  The file might just have been
+  // touched or copied, so check the contents before giving up.
+  uint64_t sourceHash;
+  if ((sourceSize == _header->sourceSize) &&
+      mvHashFile(objFileName, &sourceHash) &&
+      (sourceHash == _header->sourceHash)) return true;
+
+  close();
+  return false;
+}
+
+bool mvMeshCache::write(const std::string objFileName,
+                        const std::vector<MVec3>& vertices,
+                        const std::vector<MVec2>& uvs,
+                        const std::vector<MVec3>& normals,
+                        const std::vector<uint32_t>& indices,
+                        const std::vector<mvMeshLOD>& lods) {
+
+  if ((uvs.size() != vertices.size()) || (normals.size() != vertices.size()))
+    return false;
+
+  mvMeshCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, meshCacheMagic, sizeof(meshCacheMagic));
+  header.byteOrder = meshCacheByteOrder;
+  header.version = meshCacheVersion;
+
+  if (!getFileStamp(objFileName, &header.sourceSize, &header.sourceModTime) ||
+      !mvHashFile(objFileName, &header.sourceHash)) return false;
+
+  header.vertexCount = vertices.size();
+  header.indexCount = indices.size();
+  header.lodCount = lods.size();
+
+  // Use 16-bit indices when they will do.
+  uint32_t maxIndex = 0;
+  for (size_t i = 0; i < indices.size(); i++)
+    if (indices[i] > maxIndex) maxIndex = indices[i];
+  header.indexSize = indices.empty() ? 0 : ((maxIndex < 65536) ? 2 : 4);
+
+  MVec3 lo(0.0f), hi(0.0f);
+  if (!vertices.empty()) {
+    lo = hi = vertices[0];
+    for (size_t i = 1; i < vertices.size(); i++) {
+      lo = glm::min(lo, vertices[i]);
+      hi = glm::max(hi, vertices[i]);
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    header.boundsMin[i] = lo[i];
+    header.boundsMax[i] = hi[i];
+  }
+
+  uint64_t nV = vertices.size();
+  header.positionOffset = alignUp(sizeof(header));
+  header.uvOffset = alignUp(header.positionOffset + nV * sizeof(MVec3));
+  header.normalOffset = alignUp(header.uvOffset + nV * sizeof(MVec2));
+  header.indexOffset = alignUp(header.normalOffset + nV * sizeof(MVec3));
+  header.lodOffset = alignUp(header.indexOffset +
+                             (uint64_t)indices.size() * header.indexSize);
+
+  std::vector<uint16_t> shortIndices;
+  if (header.indexSize == 2) {
+    shortIndices.resize(indices.size());
+    for (size_t i = 0; i < indices.size(); i++) shortIndices[i] = indices[i];
+  }
+
+  // Write to a temporary file and then rename it, so that nobody
+  // (e.g. another node of the cluster looking at the same directory)
+  // ever sees a half-written cache.
+  std::string cacheName = cacheFileName(objFileName);
+  // The pid alone isn't enough, since the nodes of a cluster each
+  // have their own, so the host name goes in too.
+  char suffix[128];
+#ifndef _WIN32
+  char host[64] = "";
+  gethostname(host, sizeof(host) - 1);
+  host[sizeof(host) - 1] = 0;
+  snprintf(suffix, sizeof(suffix), ".%s.%d.tmp", host, (int)getpid());
+#else
+  sprintf(suffix, ".tmp");
+#endif
+  std::string tmpName = cacheName + suffix;
+
+  FILE* fp = fopen(tmpName.c_str(), "wb");
+  if (fp == NULL) {
+    std::cerr << "Can't write mesh cache " << cacheName << std::endl;
+    return false;
+  }
+
+  static const char padding[16] = { 0 };
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1);
+
+  struct { uint64_t offset; const void* data; uint64_t size; } sections[] = {
+    { header.positionOffset, nV ? &vertices[0] : NULL, nV * sizeof(MVec3) },
+    { header.uvOffset,       nV ? &uvs[0] : NULL,      nV * sizeof(MVec2) },
+    { header.normalOffset,   nV ? &normals[0] : NULL,  nV * sizeof(MVec3) },
+    { header.indexOffset,
+      indices.empty() ? NULL :
+      ((header.indexSize == 2) ? (const void*)&shortIndices[0] :
+       (const void*)&indices[0]),
+      (uint64_t)indices.size() * header.indexSize },
+    { header.lodOffset,      lods.empty() ? NULL : &lods[0],
+      (uint64_t)lods.size() * sizeof(mvMeshLOD) }
+  };
+
+  uint64_t position = sizeof(header);
+  for (int i = 0; ok && i < 5; i++) {
+    if (sections[i].offset > position)
+      ok = (fwrite(padding, sections[i].offset - position, 1, fp) == 1);
+    if (ok && sections[i].size)
+      ok = (fwrite(sections[i].data, sections[i].size, 1, fp) == 1);
+    position = sections[i].offset + sections[i].size;
+  }
+
+  if (fclose(fp) != 0) ok = false;
+
+  if (!ok || (rename(tmpName.c_str(), cacheName.c_str()) != 0)) {
+    std::cerr << "Can't write mesh cache " << cacheName << std::endl;
+    remove(tmpName.c_str());
+    return false;
+  }
+
+  std::cout << "Wrote mesh cache " << cacheName << std::endl;
+  return true;
+}
@@ -0,0 +1,140 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "vecTypes.h"
+#include "mappedfile.h"
+#include "meshsimplify.h"
+
+// A binary mesh file, written the first time an OBJ file is read and
+// used instead of the OBJ file after that.  The file holds the vertex
+// streams exactly as they go to OpenGL, so loading one is a matter of
+// mapping it into memory and pointing glBufferData() at it.
+//
+// The file looks like this, all in the native byte order of the
+// machine that wrote it (the header has a check for that):
+//
+//   mvMeshCacheHeader
+//   positions   vertexCount * 3 floats
+//   uvs         vertexCount * 2 floats
+//   normals     vertexCount * 3 floats
+//   indices     indexCount * indexSize bytes (may be absent)
+//   lods        lodCount mvMeshLOD structs (may be absent)
+//
+// Each section starts on a 16-byte boundary.  The header also holds
+// the bounding box of the positions, and the size, modification time
+// and hash of the OBJ file the cache was made from.  If the OBJ file
+// changes, the cache is ignored and rewritten.
+//
+// Cache files go next to the OBJ file, with ".mvmesh" added to the
+// name, unless a cache directory is set with setCacheDirectory().
+//
+struct mvMeshCacheHeader {
+  char magic[8];
+  uint32_t byteOrder;
+  uint32_t version;
+
+  uint64_t sourceSize;
+  int64_t sourceModTime;
+  uint64_t sourceHash;
+
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t indexSize;
+  uint32_t lodCount;
+
+  float boundsMin[3];
+  float boundsMax[3];
+
+  uint64_t positionOffset;
+  uint64_t uvOffset;
+  uint64_t normalOffset;
+  uint64_t indexOffset;
+  uint64_t lodOffset;
+};
+
+class mvMeshCache {
+ private:
+  mvMappedFile _file;
+  const mvMeshCacheHeader* _header;
+
+  static std::string _cacheDirectory;
+
+  // No copying; the object owns a file mapping.
+  mvMeshCache(const mvMeshCache&);
+  mvMeshCache& operator=(const mvMeshCache&);
+
+ public:
+  mvMeshCache() : _header(NULL) {};
+
+  // Open the cache file for the given OBJ file.  Returns false if
+  // there isn't one, or it's damaged, or the OBJ file has changed
+  // since it was written.
+  bool open(const std::string objFileName);
+  void close() { _file.close(); _header = NULL; };
+  bool isOpen() const { return _header != NULL; };
+
+  // Write a cache file for the given OBJ file.  The index array may
+  // be empty, for meshes that are drawn without indices.  If there
+  // are levels of detail, the index array holds all of them, and the
+  // lods say where (see buildMeshLODs()).  Returns
+  // false if the file can't be written, which is not fatal; the OBJ
+  // will just be parsed again next time.
+  static bool write(const std::string objFileName,
+                    const std::vector<MVec3>& vertices,
+                    const std::vector<MVec2>& uvs,
+                    const std::vector<MVec3>& normals,
+                    const std::vector<uint32_t>& indices,
+                    const std::vector<mvMeshLOD>& lods =
+                    std::vector<mvMeshLOD>());
+
+  // Where to put cache files.  Empty (the default) means next to the
+  // OBJ files.
+  static void setCacheDirectory(const std::string dir) {
+    _cacheDirectory = dir;
+  };
+  static std::string getCacheDirectory() { return _cacheDirectory; };
+
+  // The cache file name that goes with an OBJ file.
+  static std::string cacheFileName(const std::string objFileName);
+
+  // Accessors for an open cache.  The pointers point into the file
+  // mapping, so they are only good until close().
+  int getVertexCount() const { return _header->vertexCount; };
+  int getIndexCount() const { return _header->indexCount; };
+  int getIndexSize() const { return _header->indexSize; };
+  int getLODCount() const { return _header->lodCount; };
+
+  const MVec3* getPositions() const {
+    return (const MVec3*)(_file.getData() + _header->positionOffset);
+  };
+  const MVec2* getUVs() const {
+    return (const MVec2*)(_file.getData() + _header->uvOffset);
+  };
+  const MVec3* getNormals() const {
+    return (const MVec3*)(_file.getData() + _header->normalOffset);
+  };
+  const void* getIndices() const {
+    return _header->indexCount ?
+      (const void*)(_file.getData() + _header->indexOffset) : NULL;
+  };
+
+  const mvMeshLOD* getLODs() const {
+    return _header->lodCount ?
+      (const mvMeshLOD*)(_file.getData() + _header->lodOffset) : NULL;
+  };
+
+  MVec3 getBoundsMin() const {
+    return MVec3(_header->boundsMin[0], _header->boundsMin[1],
+                 _header->boundsMin[2]);
+  };
+  MVec3 getBoundsMax() const {
+    return MVec3(_header->boundsMax[0], _header->boundsMax[1],
+                 _header->boundsMax[2]);
+  };
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include <cstring>
+
+#include "meshindexer.h"
+#include "hash.h"
+
+// The key we hash and compare: position, uv, and normal packed
+// together.  Negative zeros are turned into positive ones first, so
+// that e.g. the -0.0 produced by flipping a v coordinate of 0 welds
+// with a 0.0 from elsewhere.
+struct indexerKey {
+  float v[8];
+
+  indexerKey(const MVec3& p, const MVec2& uv, const MVec3& n) {
+    v[0] = p.x + 0.0f;  v[1] = p.y + 0.0f;  v[2] = p.z + 0.0f;
+    v[3] = uv.x + 0.0f; v[4] = uv.y + 0.0f;
+    v[5] = n.x + 0.0f;  v[6] = n.y + 0.0f;  v[7] = n.z + 0.0f;
+  };
+
+  bool operator==(const indexerKey& other) const {
+    return memcmp(v, other.v, sizeof(v)) == 0;
+  };
+};
+
+static const uint32_t emptySlot = 0xFFFFFFFF;
+
+void indexMesh(const std::vector<MVec3>& in_vertices,
+               const std::vector<MVec2>& in_uvs,
+               const std::vector<MVec3>& in_normals,
+
+               std::vector<uint32_t>& out_indices,
+               std::vector<MVec3>& out_vertices,
+               std::vector<MVec2>& out_uvs,
+               std::vector<MVec3>& out_normals) {
+
+  size_t n = in_vertices.size();
+
+  out_indices.resize(n);
+  out_vertices.clear();
+  out_uvs.clear();
+  out_normals.clear();
+
+  // Each output vertex keeps a copy of its key, so a probe can be
+  // checked without going back to the three separate arrays.
+  std::vector<indexerKey> keys;
+  keys.reserve(n / 2);
+
+  // The table holds indices into 'keys'.  Size it to a power of two
+  // at least twice the worst-case vertex count, so that probe
+  // sequences stay short.
+  size_t tableSize = 16;
+  while (tableSize < 2 * n) tableSize <<= 1;
+  size_t mask = tableSize - 1;
+  std::vector<uint32_t> table(tableSize, emptySlot);
+
+  for (size_t i = 0; i < n; i++) {
+
+    indexerKey key(in_vertices[i], in_uvs[i], in_normals[i]);
+    size_t slot = mvHash64(key.v, sizeof(key.v)) & mask;
+
+    // Linear probing.
+    while (true) {
+      uint32_t entry = table[slot];
+
+      if (entry == emptySlot) {
+        // A new vertex.
+        entry = keys.size();
+        table[slot] = entry;
+        keys.push_back(key);
+        out_vertices.push_back(in_vertices[i]);
+        out_uvs.push_back(in_uvs[i]);
+        out_normals.push_back(in_normals[i]);
+        out_indices[i] = entry;
+        break;
+      }
+
+      if (keys[entry] == key) {
+        // Seen it already.
+        out_indices[i] = entry;
+        break;
+      }
+
+      slot = (slot + 1) & mask;
+    }
+  }
+}
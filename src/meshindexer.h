@@ -0,0 +1,34 @@
+#ifndef MESHINDEXER_H
+#define MESHINDEXER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "vecTypes.h"
+
+// Weld a triangle soup (like the one loadOBJ() produces, where every
+// triangle has its own three vertices) into a list of unique vertices
+// and an index array.  Two vertices are merged only if their
+// position, uv, and normal are all exactly the same, so the result
+// draws identically to the input.
+//
+// The lookup is done with an open-addressing hash table, so this runs
+// in time proportional to the number of vertices, and the output
+// indices are 32 bits wide, so there is no limit on the mesh size.
+// Use needsWideIndices() to find out whether they'd fit in 16.
+//
+// The output vectors are overwritten.
+void indexMesh(const std::vector<MVec3>& in_vertices,
+               const std::vector<MVec2>& in_uvs,
+               const std::vector<MVec3>& in_normals,
+
+               std::vector<uint32_t>& out_indices,
+               std::vector<MVec3>& out_vertices,
+               std::vector<MVec2>& out_uvs,
+               std::vector<MVec3>& out_normals);
+
+// True if the vertex count is too large for 16-bit (GL_UNSIGNED_SHORT)
+// indices.
+inline bool needsWideIndices(size_t nVertices) { return nVertices > 65536; };
+
+#endif
@@ -0,0 +1,232 @@
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+
+#include "meshopt.h"
+
+// Parameters of Forsyth's scoring function.  These are the values from
+// his article, which have held up well on all sorts of meshes.
+static const int forsythCacheSize = 32;
+static const float forsythDecayPower = 1.5f;
+static const float forsythLastTriScore = 0.75f;
+static const float forsythValenceScale = 2.0f;
+static const float forsythValencePower = 0.5f;
+
+// Valences above this all score the same.
+static const int forsythMaxValence = 32;
+
+float computeACMR(const std::vector<uint32_t>& indices, size_t nVertices,
+                  int cacheSize) {
+
+  if (indices.size() < 3) return 0.0f;
+
+  // A FIFO cache: a vertex is in the cache if it was added within the
+  // last cacheSize misses.
+  std::vector<unsigned int> addedAt(nVertices, 0);
+  unsigned int misses = 0;
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    uint32_t v = indices[i];
+    if ((addedAt[v] == 0) || (misses - (addedAt[v] - 1) >= (unsigned)cacheSize)) {
+      addedAt[v] = misses + 1;
+      misses++;
+    }
+  }
+
+  return (float)misses / (float)(indices.size() / 3);
+}
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t nVertices) {
+
+  size_t nTriangles = indices.size() / 3;
+  if (nTriangles == 0) return;
+
+  // Score tables, so we don't call pow() in the inner loop.
+  float cacheScore[forsythCacheSize];
+  for (int i = 0; i < forsythCacheSize; i++) {
+    if (i < 3) {
+      // The triangle we just added.  Its vertices get a fixed score,
+      // so that we don't just keep making strips.
+      cacheScore[i] = forsythLastTriScore;
+    } else {
+      float x = 1.0f - (float)(i - 3) / (float)(forsythCacheSize - 3);
+      cacheScore[i] = powf(x, forsythDecayPower);
+    }
+  }
+
+  float valenceScore[forsythMaxValence + 1];
+  valenceScore[0] = 0.0f;
+  for (int i = 1; i <= forsythMaxValence; i++) {
+    // Vertices with few triangles left get a boost, so that we finish
+    // them off and don't leave lonely triangles behind.
+    valenceScore[i] = forsythValenceScale * powf((float)i, -forsythValencePower);
+  }
+
+  // Which triangles use each vertex, as one big array with an offset
+  // per vertex.  The live triangles of vertex v are always the first
+  // liveCount[v] entries of its slice.
+  std::vector<uint32_t> liveCount(nVertices, 0);
+  for (size_t i = 0; i < indices.size(); i++) liveCount[indices[i]]++;
+
+  std::vector<uint32_t> offset(nVertices + 1, 0);
+  for (size_t v = 0; v < nVertices; v++) offset[v + 1] = offset[v] + liveCount[v];
+
+  std::vector<uint32_t> adjacency(indices.size());
+  std::vector<uint32_t> fill(offset.begin(), offset.end() - 1);
+  for (size_t t = 0; t < nTriangles; t++) {
+    for (int k = 0; k < 3; k++) adjacency[fill[indices[3 * t + k]]++] = t;
+  }
+
+  // Scores.
+  std::vector<int> cachePosition(nVertices, -1);
+  std::vector<float> vertexScore(nVertices);
+  for (size_t v = 0; v < nVertices; v++) {
+    int valence = std::min((int)liveCount[v], forsythMaxValence);
+    vertexScore[v] = valenceScore[valence];
+  }
+
+  std::vector<float> triangleScore(nTriangles);
+  for (size_t t = 0; t < nTriangles; t++) {
+    triangleScore[t] = vertexScore[indices[3 * t]] +
+      vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+  }
+
+  std::vector<char> emitted(nTriangles, 0);
+  std::vector<uint32_t> output;
+  output.reserve(indices.size());
+
+  // The simulated cache.  There is room for three more than the cache
+  // size, since a new triangle pushes up to three vertices in before
+  // the oldest ones fall off the end.
+  uint32_t cache[forsythCacheSize + 3];
+  uint32_t newCache[forsythCacheSize + 3];
+  int cacheCount = 0;
+
+  int bestTriangle = -1;
+  size_t nextUnemitted = 0;
+
+  for (size_t n = 0; n < nTriangles; n++) {
+
+    if (bestTriangle < 0) {
+      // Nothing in the cache is any use.  Start again from the first
+      // triangle we haven't done yet.
+      while (emitted[nextUnemitted]) nextUnemitted++;
+      bestTriangle = nextUnemitted;
+    }
+
+    uint32_t* tri = &indices[3 * bestTriangle];
+    output.push_back(tri[0]);
+    output.push_back(tri[1]);
+    output.push_back(tri[2]);
+    emitted[bestTriangle] = 1;
+
+    // Take the triangle out of its vertices' live lists.
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = tri[k];
+      uint32_t* list = &adjacency[offset[v]];
+      uint32_t last = liveCount[v] - 1;
+      for (uint32_t j = 0; j <= last; j++) {
+        if (list[j] == (uint32_t)bestTriangle) {
+          list[j] = list[last];
+          list[last] = bestTriangle;
+          break;
+        }
+      }
+      liveCount[v]--;
+    }
+
+    // Push the triangle's vertices onto the front of the cache.
+    int newCount = 0;
+    for (int k = 0; k < 3; k++) newCache[newCount++] = tri[k];
+    for (int i = 0; i < cacheCount; i++) {
+      uint32_t v = cache[i];
+      if ((v != tri[0]) && (v != tri[1]) && (v != tri[2]))
+        newCache[newCount++] = v;
+    }
+
+    // Rescore everything that moved, including anything that fell off
+    // the end, and the triangles that use them.
+    for (int i = 0; i < newCount; i++) {
+      uint32_t v = newCache[i];
+      cachePosition[v] = (i < forsythCacheSize) ? i : -1;
+
+      float score = 0.0f;
+      if (liveCount[v] > 0) {
+        if (cachePosition[v] >= 0) score = cacheScore[cachePosition[v]];
+        score += valenceScore[std::min((int)liveCount[v], forsythMaxValence)];
+      }
+
+      float delta = score - vertexScore[v];
+      vertexScore[v] = score;
+
+      const uint32_t* list = &adjacency[offset[v]];
+      for (uint32_t j = 0; j < liveCount[v]; j++) triangleScore[list[j]] += delta;
+    }
+
+    // The next triangle is the best-scoring one that uses something in
+    // the cache.
+    bestTriangle = -1;
+    float bestScore = -1.0f;
+    cacheCount = std::min(newCount, forsythCacheSize);
+    for (int i = 0; i < cacheCount; i++) {
+      uint32_t v = newCache[i];
+      cache[i] = v;
+
+      const uint32_t* list = &adjacency[offset[v]];
+      for (uint32_t j = 0; j < liveCount[v]; j++) {
+        if (triangleScore[list[j]] > bestScore) {
+          bestScore = triangleScore[list[j]];
+          bestTriangle = list[j];
+        }
+      }
+    }
+  }
+
+  indices.swap(output);
+}
+
+void optimizeVertexFetch(std::vector<uint32_t>& indices,
+                         std::vector<MVec3>& vertices,
+                         std::vector<MVec2>& uvs,
+                         std::vector<MVec3>& normals) {
+
+  const uint32_t unused = 0xFFFFFFFF;
+  std::vector<uint32_t> remap(vertices.size(), unused);
+  uint32_t next = 0;
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    uint32_t& r = remap[indices[i]];
+    if (r == unused) r = next++;
+    indices[i] = r;
+  }
+
+  // Vertices no triangle uses are dropped.
+  std::vector<MVec3> newVertices(next), newNormals(next);
+  std::vector<MVec2> newUVs(next);
+  for (size_t v = 0; v < remap.size(); v++) {
+    if (remap[v] == unused) continue;
+    newVertices[remap[v]] = vertices[v];
+    newUVs[remap[v]] = uvs[v];
+    newNormals[remap[v]] = normals[v];
+  }
+
+  vertices.swap(newVertices);
+  uvs.swap(newUVs);
+  normals.swap(newNormals);
+}
+
+void optimizeMesh(std::vector<uint32_t>& indices,
+                  std::vector<MVec3>& vertices,
+                  std::vector<MVec2>& uvs,
+                  std::vector<MVec3>& normals,
+                  const std::string name) {
+
+  float before = computeACMR(indices, vertices.size());
+
+  optimizeVertexCache(indices, vertices.size());
+  optimizeVertexFetch(indices, vertices, uvs, normals);
+  float after = computeACMR(indices, vertices.size());
+
+  std::cout << name << ": ACMR " << before << " -> " << after << ", "
+            << indices.size() / 3 << " triangles" << std::endl;
+}
@@ -0,0 +1,56 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "vecTypes.h"
+
+// Reordering of indexed triangle meshes so they draw faster.  Nothing
+// here changes the triangles or vertices, only the order in which they
+// are handed to the GPU.  With the depth test on, that doesn't change
+// what is drawn.  With it off and blending on, as tgm draws, triangles
+// that overlap on the screen are blended in the new order instead of
+// the file's, which was no better chosen.  There are two passes, meant
+// to be run in this order:
+//
+// optimizeVertexCache() -- reorders the triangles so that ones
+//     sharing vertices come close together, and the GPU can reuse the
+//     vertex shader output it has just computed instead of running it
+//     again.  This is Tom Forsyth's "linear-speed vertex cache
+//     optimisation" algorithm.
+//
+// optimizeVertexFetch() -- renumbers the vertices in the order the
+//     triangles first use them, so the vertex data is read from memory
+//     more or less sequentially.
+//
+// There is no pass to sort the triangles against overdraw.  That only
+// pays with the depth test on, which tgm, where meshes are drawn among
+// the ROIs, doesn't use, and it costs some cache efficiency.
+//
+// optimizeMesh() runs both and prints the cache efficiency before
+// and after.  Cache efficiency is reported as ACMR, the average number
+// of vertex shader runs per triangle.  3.0 is the worst possible,
+// and a well-ordered regular grid gets down to around 0.6.
+
+// The ACMR of an index buffer, for a FIFO post-transform cache of the
+// given size.  16 is a reasonable stand-in for real hardware.
+float computeACMR(const std::vector<uint32_t>& indices, size_t nVertices,
+                  int cacheSize = 16);
+
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t nVertices);
+
+void optimizeVertexFetch(std::vector<uint32_t>& indices,
+                         std::vector<MVec3>& vertices,
+                         std::vector<MVec2>& uvs,
+                         std::vector<MVec3>& normals);
+
+// Both of the above.  The name is just for the printout.
+void optimizeMesh(std::vector<uint32_t>& indices,
+                  std::vector<MVec3>& vertices,
+                  std::vector<MVec2>& uvs,
+                  std::vector<MVec3>& normals,
+                  const std::string name);
+
+#endif
@@ -0,0 +1,487 @@
+#include <cmath>
+#include <algorithm>
+
+#include "meshsimplify.h"
+#include "meshopt.h"
+#include "hash.h"
+
+// Levels of detail stop when they get this small, since there is
+// nothing more to gain.
+static const size_t minLODTriangles = 256;
+
+// A level that doesn't lose at least this fraction of the triangles of
+// the one before it isn't worth having.
+static const float minLODReduction = 0.2f;
+
+// The quadric error metric.  This is a symmetric 4x4 matrix Q such
+// that v^T Q v (with v = (x, y, z, 1)) is the sum of the squared
+// distances from v to a set of planes, weighted by the area of the
+// triangles they came from.  The total weight is kept too, so the
+// error can be turned back into a distance.
+struct simplifyQuadric {
+  double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+  double weight;
+
+  simplifyQuadric() :
+    a00(0), a01(0), a02(0), a03(0), a11(0), a12(0), a13(0),
+    a22(0), a23(0), a33(0), weight(0) {};
+
+  // The plane through p with unit normal n, with the given weight.
+  void addPlane(const MVec3& n, const MVec3& p, double w) {
+    double a = n.x, b = n.y, c = n.z;
+    double d = -(a * p.x + b * p.y + c * p.z);
+    a00 += w * a * a;  a01 += w * a * b;  a02 += w * a * c;  a03 += w * a * d;
+    a11 += w * b * b;  a12 += w * b * c;  a13 += w * b * d;
+    a22 += w * c * c;  a23 += w * c * d;
+    a33 += w * d * d;
+    weight += w;
+  };
+
+  simplifyQuadric& operator+=(const simplifyQuadric& q) {
+    a00 += q.a00;  a01 += q.a01;  a02 += q.a02;  a03 += q.a03;
+    a11 += q.a11;  a12 += q.a12;  a13 += q.a13;
+    a22 += q.a22;  a23 += q.a23;
+    a33 += q.a33;
+    weight += q.weight;
+    return *this;
+  };
+
+  double error(const MVec3& p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z +
+      2.0 * a03 * x + a11 * y * y + 2.0 * a12 * y * z + 2.0 * a13 * y +
+      a22 * z * z + 2.0 * a23 * z + a33;
+    return (e > 0.0) ? e : 0.0;
+  };
+};
+
+// The squared distance the surface moves if we move vertex v onto
+// vertex u.
+static double collapseError(const simplifyQuadric& qv,
+                            const simplifyQuadric& qu, const MVec3& pu) {
+  double weight = qv.weight + qu.weight;
+  if (weight <= 0.0) return 0.0;
+  return (qv.error(pu) + qu.error(pu)) / weight;
+}
+
+// Find the vertices that share a position with some other vertex
+// that the indices use.  Any vertex that gets a different uv or normal
+// on different faces turns up several times in the vertex buffer (see
+// indexMesh()).  Fills in group[v] with the first vertex at the same
+// position, and returns in seam whether there is more than one.
+static void groupPositions(const std::vector<uint32_t>& indices,
+                           const std::vector<MVec3>& vertices,
+                           std::vector<uint32_t>& group,
+                           std::vector<char>& seam) {
+
+  size_t n = vertices.size();
+  group.resize(n);
+  seam.assign(n, 0);
+
+  std::vector<char> used(n, 0);
+  for (size_t i = 0; i < indices.size(); i++) used[indices[i]] = 1;
+
+  const uint32_t emptySlot = 0xFFFFFFFF;
+  size_t tableSize = 16;
+  while (tableSize < 2 * n) tableSize <<= 1;
+  size_t mask = tableSize - 1;
+  std::vector<uint32_t> table(tableSize, emptySlot);
+
+  for (size_t i = 0; i < n; i++) {
+    group[i] = i;
+    if (!used[i]) continue;
+
+    // Fold -0 into +0 so they hash the same.
+    float key[3] = { vertices[i].x + 0.0f, vertices[i].y + 0.0f,
+                     vertices[i].z + 0.0f };
+    size_t slot = mvHash64(key, sizeof(key)) & mask;
+
+    while (true) {
+      uint32_t entry = table[slot];
+      if (entry == emptySlot) {
+        table[slot] = i;
+        break;
+      }
+      if (vertices[entry] == vertices[i]) {
+        group[i] = entry;
+        seam[i] = seam[entry] = 1;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  // The first vertex of a group doesn't know it's in one until the
+  // second one shows up, so pass the flag back to everyone.
+  for (size_t i = 0; i < n; i++) if (seam[group[i]]) seam[i] = 1;
+}
+
+// The unit normal of a triangle, or zero if it has no area.
+static MVec3 faceNormal(const MVec3& a, const MVec3& b, const MVec3& c) {
+  MVec3 normal = glm::cross(b - a, c - a);
+  float length = glm::length(normal);
+  return (length > 0.0f) ? normal / length : MVec3(0.0f);
+}
+
+// Whether every triangle's normals are just its own face normal, as
+// loadOBJ() makes them for a file without any.  Then every vertex is
+// split, once for each face around it, and the normals say nothing the
+// positions don't.
+static bool hasFaceNormals(const std::vector<uint32_t>& indices,
+                           const std::vector<MVec3>& vertices,
+                           const std::vector<MVec3>& normals) {
+
+  if (normals.size() != vertices.size()) return false;
+
+  for (size_t t = 0; t < indices.size() / 3; t++) {
+    const uint32_t* tri = &indices[3 * t];
+    MVec3 normal = faceNormal(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+    if (normal == MVec3(0.0f)) continue;
+    for (int k = 0; k < 3; k++)
+      if (glm::dot(normal, normals[tri[k]]) < 0.9999f) return false;
+  }
+  return true;
+}
+
+// Merges the vertices that differ only in their normal.  weld[v] is
+// the first vertex with the same position and uv as v, and the members
+// of the group of weld v, v included, are members[offset[v]] up to
+// members[offset[v + 1]].
+static void weldNormals(const std::vector<MVec3>& vertices,
+                        const std::vector<MVec2>& uvs,
+                        std::vector<uint32_t>& weld,
+                        std::vector<uint32_t>& offset,
+                        std::vector<uint32_t>& members) {
+
+  size_t n = vertices.size();
+  weld.resize(n);
+
+  const uint32_t emptySlot = 0xFFFFFFFF;
+  size_t tableSize = 16;
+  while (tableSize < 2 * n) tableSize <<= 1;
+  size_t mask = tableSize - 1;
+  std::vector<uint32_t> table(tableSize, emptySlot);
+
+  for (size_t i = 0; i < n; i++) {
+    MVec2 uv = (i < uvs.size()) ? uvs[i] : MVec2(0.0f);
+    float key[5] = { vertices[i].x + 0.0f, vertices[i].y + 0.0f,
+                     vertices[i].z + 0.0f, uv.x + 0.0f, uv.y + 0.0f };
+    size_t slot = mvHash64(key, sizeof(key)) & mask;
+
+    while (true) {
+      uint32_t entry = table[slot];
+      if (entry == emptySlot) {
+        table[slot] = i;
+        weld[i] = i;
+        break;
+      }
+      if ((vertices[entry] == vertices[i]) &&
+          ((i >= uvs.size()) || (uvs[entry] == uv))) {
+        weld[i] = entry;
+        break;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  offset.assign(n + 1, 0);
+  for (size_t i = 0; i < n; i++) offset[weld[i] + 1]++;
+  for (size_t i = 0; i < n; i++) offset[i + 1] += offset[i];
+  members.resize(n);
+  std::vector<uint32_t> fill(offset.begin(), offset.end() - 1);
+  for (size_t i = 0; i < n; i++) members[fill[weld[i]]++] = i;
+}
+
+// A corner whose nearest normal is further than this, as a cosine,
+// from its triangle's gets a vertex of its own with the right one.
+static const float maxNormalCosine = 0.99f;
+
+// The other way: points each corner of the welded triangles back at
+// the member of its group whose normal is nearest the triangle's, or
+// at a new vertex if none is near enough.  A triangle that wasn't
+// changed gets its own vertices back.
+static void unweldNormals(std::vector<uint32_t>& indices,
+                          std::vector<MVec3>& vertices,
+                          std::vector<MVec2>& uvs,
+                          std::vector<MVec3>& normals,
+                          const std::vector<uint32_t>& offset,
+                          const std::vector<uint32_t>& members) {
+
+  for (size_t t = 0; t < indices.size() / 3; t++) {
+    uint32_t* tri = &indices[3 * t];
+    MVec3 normal = faceNormal(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+
+    for (int k = 0; k < 3; k++) {
+      uint32_t best = tri[k];
+      float bestDot = -2.0f;
+      for (uint32_t j = offset[tri[k]]; j < offset[tri[k] + 1]; j++) {
+        float d = glm::dot(normal, normals[members[j]]);
+        if (d > bestDot) {
+          bestDot = d;
+          best = members[j];
+        }
+      }
+
+      if ((bestDot < maxNormalCosine) && (normal != MVec3(0.0f))) {
+        best = vertices.size();
+        vertices.push_back(vertices[tri[k]]);
+        if (uvs.size() > tri[k]) uvs.push_back(uvs[tri[k]]);
+        normals.push_back(normal);
+      }
+      tri[k] = best;
+    }
+  }
+}
+
+// Sorts vertices by the error of their best collapse.
+struct byError {
+  const std::vector<double>& error;
+  byError(const std::vector<double>& e) : error(e) {};
+  bool operator()(uint32_t a, uint32_t b) const { return error[a] < error[b]; };
+};
+
+static inline uint64_t edgeKey(uint32_t a, uint32_t b) {
+  return ((uint64_t)a << 32) | b;
+}
+
+void simplifyMesh(const std::vector<uint32_t>& indices,
+                  const std::vector<MVec3>& vertices,
+                  size_t targetIndexCount,
+                  std::vector<uint32_t>& out_indices,
+                  float* out_error) {
+
+  size_t n = vertices.size();
+  out_indices = indices;
+  double maxError = 0.0;
+
+  std::vector<uint32_t> group;
+  std::vector<char> seam;
+  groupPositions(indices, vertices, group, seam);
+
+  // Every vertex starts with the planes of the triangles around it.
+  std::vector<simplifyQuadric> quadrics(n);
+  for (size_t t = 0; t < indices.size() / 3; t++) {
+    const MVec3& a = vertices[indices[3 * t]];
+    const MVec3& b = vertices[indices[3 * t + 1]];
+    const MVec3& c = vertices[indices[3 * t + 2]];
+
+    MVec3 normal = glm::cross(b - a, c - a);
+    float length = glm::length(normal);
+    if (length == 0.0f) continue;
+
+    normal /= length;
+    for (int k = 0; k < 3; k++)
+      quadrics[indices[3 * t + k]].addPlane(normal, a, 0.5 * length);
+  }
+
+  std::vector<char> locked(n);
+  std::vector<char> touched(n);
+  std::vector<uint32_t> collapseTo(n);
+  std::vector<uint32_t> bestTarget(n);
+  std::vector<double> bestError(n);
+  std::vector<uint64_t> edges;
+  std::vector<uint32_t> adjacencyOffset(n + 1);
+  std::vector<uint32_t> adjacency;
+  std::vector<uint32_t> candidates;
+
+  // Collapse edges in passes.  Each pass picks the cheapest collapse
+  // for each vertex, and then does as many of those as it can, in
+  // order, without two of them touching the same triangle.
+  while (out_indices.size() > targetIndexCount) {
+
+    std::vector<uint32_t>& current = out_indices;
+    size_t nTriangles = current.size() / 3;
+
+    // Lock the seams, and the vertices on any edge that doesn't have
+    // exactly one triangle on each side.  The edges are compared by
+    // position group, so that seams don't look like borders.
+    locked = seam;
+    edges.resize(current.size());
+    for (size_t t = 0; t < nTriangles; t++) {
+      for (int k = 0; k < 3; k++) {
+        edges[3 * t + k] = edgeKey(group[current[3 * t + k]],
+                                   group[current[3 * t + (k + 1) % 3]]);
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t t = 0; t < nTriangles; t++) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t a = current[3 * t + k];
+        uint32_t b = current[3 * t + (k + 1) % 3];
+
+        std::pair<std::vector<uint64_t>::iterator,
+                  std::vector<uint64_t>::iterator> same =
+          std::equal_range(edges.begin(), edges.end(),
+                           edgeKey(group[a], group[b]));
+        std::pair<std::vector<uint64_t>::iterator,
+                  std::vector<uint64_t>::iterator> opposite =
+          std::equal_range(edges.begin(), edges.end(),
+                           edgeKey(group[b], group[a]));
+
+        if ((same.second - same.first != 1) ||
+            (opposite.second - opposite.first != 1)) {
+          locked[a] = locked[b] = 1;
+        }
+      }
+    }
+
+    // Which triangles use each vertex.
+    std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+    for (size_t i = 0; i < current.size(); i++) adjacencyOffset[current[i] + 1]++;
+    for (size_t v = 0; v < n; v++) adjacencyOffset[v + 1] += adjacencyOffset[v];
+    adjacency.resize(current.size());
+    std::vector<uint32_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t t = 0; t < nTriangles; t++)
+      for (int k = 0; k < 3; k++) adjacency[fill[current[3 * t + k]]++] = t;
+
+    // The cheapest collapse for each vertex that can move.
+    std::fill(bestError.begin(), bestError.end(), -1.0);
+    for (size_t t = 0; t < nTriangles; t++) {
+      for (int k = 0; k < 3; k++) {
+        uint32_t v = current[3 * t + k];
+        if (locked[v]) continue;
+
+        for (int j = 1; j < 3; j++) {
+          uint32_t u = current[3 * t + (k + j) % 3];
+          double error = collapseError(quadrics[v], quadrics[u], vertices[u]);
+          if ((bestError[v] < 0.0) || (error < bestError[v])) {
+            bestError[v] = error;
+            bestTarget[v] = u;
+          }
+        }
+      }
+    }
+
+    candidates.clear();
+    for (size_t v = 0; v < n; v++)
+      if (bestError[v] >= 0.0) candidates.push_back(v);
+    if (candidates.empty()) break;
+
+    std::sort(candidates.begin(), candidates.end(), byError(bestError));
+
+    // Each collapse of an interior vertex removes two triangles.
+    size_t wanted = (current.size() - targetIndexCount) / 6 + 1;
+    size_t done = 0;
+
+    for (size_t v = 0; v < n; v++) collapseTo[v] = v;
+    std::fill(touched.begin(), touched.end(), 0);
+
+    for (size_t i = 0; (i < candidates.size()) && (done < wanted); i++) {
+      uint32_t v = candidates[i];
+      uint32_t u = bestTarget[v];
+      if (touched[v] || touched[u]) continue;
+
+      // Don't let any of the triangles around v flip over.
+      bool flips = false;
+      for (uint32_t j = adjacencyOffset[v]; j < adjacencyOffset[v + 1]; j++) {
+        const uint32_t* tri = &current[3 * adjacency[j]];
+        if ((tri[0] == u) || (tri[1] == u) || (tri[2] == u)) continue;
+
+        MVec3 p[3], q[3];
+        for (int k = 0; k < 3; k++) {
+          p[k] = vertices[tri[k]];
+          q[k] = (tri[k] == v) ? vertices[u] : p[k];
+        }
+        MVec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        MVec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <= 0.0f) {
+          flips = true;
+          break;
+        }
+      }
+      if (flips) continue;
+
+      collapseTo[v] = u;
+      quadrics[u] += quadrics[v];
+      maxError = std::max(maxError, bestError[v]);
+      done++;
+
+      // Nothing else that shares a triangle with v gets to move in
+      // this pass, so the flip test above stays valid.
+      for (uint32_t j = adjacencyOffset[v]; j < adjacencyOffset[v + 1]; j++) {
+        const uint32_t* tri = &current[3 * adjacency[j]];
+        touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+      }
+    }
+
+    if (done == 0) break;
+
+    // Apply the collapses and drop the triangles that have become
+    // degenerate.
+    size_t kept = 0;
+    for (size_t t = 0; t < nTriangles; t++) {
+      uint32_t a = collapseTo[current[3 * t]];
+      uint32_t b = collapseTo[current[3 * t + 1]];
+      uint32_t c = collapseTo[current[3 * t + 2]];
+      if ((a == b) || (b == c) || (c == a)) continue;
+      current[kept++] = a;
+      current[kept++] = b;
+      current[kept++] = c;
+    }
+    current.resize(kept);
+  }
+
+  *out_error = (float)sqrt(maxError);
+}
+
+void buildMeshLODs(std::vector<uint32_t>& indices,
+                   std::vector<MVec3>& vertices,
+                   std::vector<MVec2>& uvs,
+                   std::vector<MVec3>& normals,
+                   std::vector<mvMeshLOD>& lods,
+                   int maxLevels) {
+
+  lods.clear();
+
+  mvMeshLOD full;
+  full.indexOffset = 0;
+  full.indexCount = indices.size();
+  full.error = 0.0f;
+  lods.push_back(full);
+
+  std::vector<uint32_t> all(indices);
+  std::vector<uint32_t> previous(indices);
+  std::vector<uint32_t> next, lodIndices;
+  float error = 0.0f;
+
+  // Normals that are only face normals would make every vertex a seam,
+  // and nothing could move.  The simplifying is done without them, and
+  // each level's triangles pick the nearest of the normals at their
+  // corners afterwards, or get new vertices where none is close.
+  std::vector<uint32_t> weld, weldOffset, weldMembers;
+  bool welded = hasFaceNormals(indices, vertices, normals);
+  if (welded) {
+    weldNormals(vertices, uvs, weld, weldOffset, weldMembers);
+    for (size_t i = 0; i < previous.size(); i++) previous[i] = weld[previous[i]];
+  }
+
+  for (int level = 1; level < maxLevels; level++) {
+    if (previous.size() / 3 < 2 * minLODTriangles) break;
+
+    float levelError;
+    simplifyMesh(previous, vertices, (previous.size() / 6) * 3,
+                 next, &levelError);
+    if (next.size() > (1.0f - minLODReduction) * previous.size()) break;
+
+    // Each level is simplified from the one before, so the errors
+    // add up.
+    error += levelError;
+
+    lodIndices = next;
+    if (welded)
+      unweldNormals(lodIndices, vertices, uvs, normals, weldOffset, weldMembers);
+    optimizeVertexCache(lodIndices, vertices.size());
+
+    mvMeshLOD lod;
+    lod.indexOffset = all.size();
+    lod.indexCount = lodIndices.size();
+    lod.error = error;
+    lods.push_back(lod);
+
+    all.insert(all.end(), lodIndices.begin(), lodIndices.end());
+    previous.swap(next);
+  }
+
+  indices.swap(all);
+}
@@ -0,0 +1,64 @@
+#ifndef MESHSIMPLIFY_H
+#define MESHSIMPLIFY_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "vecTypes.h"
+
+// Mesh simplification, for making lower levels of detail of a mesh to
+// draw when it is far away and its triangles would be smaller than a
+// pixel anyway.
+//
+// The simplification is done by collapsing edges, moving one end onto
+// the other, in order of the quadric error metric of Garland and
+// Heckbert -- roughly, the squared distance the surface moves.  Only
+// the index buffer changes; the vertices that remain are a subset of
+// the original ones (with one exception, below), so every level of
+// detail can share the one vertex buffer.
+//
+// Vertices along the edge of an open mesh, and vertices that are
+// split because their uv or normal differs between faces (texture
+// seams, hard edges), are never moved, so the outline and the texture
+// mapping of the mesh stay intact.  A mesh that is nothing but seams
+// won't simplify much.  The exception is a mesh whose normals are
+// all face normals, as loadOBJ() gives a file without any: there,
+// buildMeshLODs() ignores the normals while simplifying, and the few
+// corners of the simpler levels that no existing normal suits get new
+// vertices, at the end of the vertex buffer.
+
+// One level of detail.  The indices of each level are a range of one
+// shared index buffer.
+struct mvMeshLOD {
+  uint32_t indexOffset;
+  uint32_t indexCount;
+
+  // About how far the surface of this level is from the original
+  // mesh, in model units.  This is an estimate from the quadrics, not
+  // a strict bound.
+  float error;
+};
+
+// Simplify the mesh down to targetIndexCount indices or as near as it
+// will go.  The error is the distance the surface was moved by the
+// worst collapse, as estimated by the quadrics.
+void simplifyMesh(const std::vector<uint32_t>& indices,
+                  const std::vector<MVec3>& vertices,
+                  size_t targetIndexCount,
+                  std::vector<uint32_t>& out_indices,
+                  float* out_error);
+
+// Make a chain of up to maxLevels levels of detail, each about half the
+// triangles of the one before.  On input the index vector holds the
+// full mesh; on output it holds all the levels one after another,
+// starting with the full mesh, and lods says where each one is.  The
+// chain stops early when a mesh won't simplify any further.  Vertices
+// may be added (see above), but the ones there are left alone.
+void buildMeshLODs(std::vector<uint32_t>& indices,
+                   std::vector<MVec3>& vertices,
+                   std::vector<MVec2>& uvs,
+                   std::vector<MVec3>& normals,
+                   std::vector<mvMeshLOD>& lods,
+                   int maxLevels = 5);
+
+#endif
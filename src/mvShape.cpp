@@ -11,8 +11,20 @@ void mvShape::printMat(std::string name, MMat4 mat) {
   }
 }
 
+GLint mvShape::_viewport[4] = { 0, 0, 0, 0 };
+MVec3 mvShape::_viewEye(0.0f, 0.0f, 0.0f);
+uint64_t mvShape::_boundsCount = 0;
+
+void mvShape::beginView(const MMat4& viewMatrix) {
+
+  glGetIntegerv(GL_VIEWPORT, _viewport);
+  _viewEye = MVec3(glm::inverse(viewMatrix)[3]);
+}
+
 mvShape::mvShape(mvShapeType type, mvShaderSet* shaders, mvTexture* texture) :
-  _type(type), _shaderContext(shaders, texture) {
+  _type(type), _id(-1), _shaderContext(shaders, texture),
+  _node(NULL), _nodeIndex(0), _worldMatrixNeedsReset(true),
+  _boundsVersion(++_boundsCount) {
 
   // Set all the translations and rotations to zero.
   _scale = MVec3(1.0f, 1.0f, 1.0f);
@@ -25,7 +37,10 @@ mvShape::mvShape(mvShapeType type, mvShaderSet* shaders, mvTexture* texture) :
   _modelMatrix = getModelMatrix();
 }
 
-mvShape::~mvShape() {}
+mvShape::~mvShape() {
+
+  if (_node) _node->removeShape(this);
+}
 
 MMat4 mvShape::getModelMatrix() {
 
@@ -46,23 +61,58 @@ MMat4 mvShape::getModelMatrix() {
   return _modelMatrix;
 }
 
+MMat4 mvShape::getWorldMatrix() {
+
+  if (_node == NULL) return getModelMatrix();
+
+  // The node usually does this, in mvTransformNode::update().
+  if (_worldMatrixNeedsReset) {
+    _worldMatrix = _node->getWorldMatrix() * getModelMatrix();
+    _worldMatrixNeedsReset = false;
+  }
+  return _worldMatrix;
+}
+
+MVec4 mvShape::getWorldBoundingSphere() {
+
+  MMat4 worldMatrix = getWorldMatrix();
+  MVec3 center(worldMatrix * MVec4(getBoundingCenter(), 1.0f));
+
+  // A non-uniform scale turns the sphere into an ellipsoid.  Take the
+  // longest axis.
+  float scale = glm::max(glm::length(MVec3(worldMatrix[0])),
+                         glm::max(glm::length(MVec3(worldMatrix[1])),
+                                  glm::length(MVec3(worldMatrix[2]))));
+
+  return MVec4(center, scale * getBoundingRadius());
+}
+
 void mvShapeRect::initVertices() {
   
+  // Only the crop window of the texture is drawn (see
+  // mvTexture::setTrim()).  With u across and v down the rectangle,
+  // these are its edges, and the texture coordinates below cover the
+  // cropped texture from 0 to 1.
+  float left = (_cropWindow.x - 0.5f) * _width;
+  float right = (_cropWindow.z - 0.5f) * _width;
+  float top = (0.5f - _cropWindow.y) * _height;
+  float bottom = (0.5f - _cropWindow.w) * _height;
+
   // Front side of rectangle.
-  _vertices.push_back(MVec3(-_width/2.0f, -_height/2.0f, 0.0f));
-  _vertices.push_back(MVec3( _width/2.0f,  _height/2.0f, 0.0f));
-  _vertices.push_back(MVec3(-_width/2.0f,  _height/2.0f, 0.0f));
-  _vertices.push_back(MVec3(-_width/2.0f, -_height/2.0f, 0.0f));
-  _vertices.push_back(MVec3( _width/2.0f, -_height/2.0f, 0.0f));
-  _vertices.push_back(MVec3( _width/2.0f,  _height/2.0f, 0.0f));
+  _vertices.push_back(MVec3( left, bottom, 0.0f));
+  _vertices.push_back(MVec3(right,    top, 0.0f));
+  _vertices.push_back(MVec3( left,    top, 0.0f));
+  _vertices.push_back(MVec3( left, bottom, 0.0f));
+  _vertices.push_back(MVec3(right, bottom, 0.0f));
+  _vertices.push_back(MVec3(right,    top, 0.0f));
 
   // Back side.
-  _vertices.push_back(MVec3(-_width/2.0f, -_height/2.0f, 0.0f));
-  _vertices.push_back(MVec3(-_width/2.0f,  _height/2.0f, 0.0f));
-  _vertices.push_back(MVec3( _width/2.0f,  _height/2.0f, 0.0f));
-  _vertices.push_back(MVec3(-_width/2.0f, -_height/2.0f, 0.0f));
-  _vertices.push_back(MVec3( _width/2.0f,  _height/2.0f, 0.0f));
-  _vertices.push_back(MVec3( _width/2.0f, -_height/2.0f, 0.0f));
+  _vertices.push_back(MVec3( left, bottom, 0.0f));
+  _vertices.push_back(MVec3( left,    top, 0.0f));
+  _vertices.push_back(MVec3(right,    top, 0.0f));
+  _vertices.push_back(MVec3( left, bottom, 0.0f));
+  _vertices.push_back(MVec3(right,    top, 0.0f));
+  _vertices.push_back(MVec3(right, bottom, 0.0f));
 
   // Front side texture coordinates.
   _uvs.push_back(MVec2(0.0f, 1.0f));
@@ -98,33 +148,214 @@ void mvShapeRect::initVertices() {
 
 void mvShapeRect::load() {
 
+  // The texture has to be decoded to know how much of it to draw.
+  prepare();
+  mvTexture* texture = _shaderContext.getTexture();
+  if (texture) _cropWindow = texture->getCropWindow();
+  boundsChanged();
+
   // Set up the vertex and other arrays.
   initVertices();
   _shaderContext.load(_vertices, _uvs, _normals, _colors);
 }
 
+void mvShapeRect::drawFlatLighting() {
+
+  // The middle of the rectangle, and which way it faces, in the
+  // world.  The rectangle is in the model's x-y plane, so its normal
+  // is along the cross product of the world matrix's first two
+  // columns, which is what the inverse transpose would give, without
+  // the inverse.  The viewer is where beginView() put it.
+  MMat4 world = getWorldMatrix();
+  MVec3 center = MVec3(world * MVec4(getBoundingCenter(), 1.0f));
+  MVec3 normal = glm::normalize(glm::cross(MVec3(world[0]), MVec3(world[1])));
+
+  MVec3 light, specular;
+  _shaderContext.getShaderSet()->getLights()->shadeFlat(center, normal, _viewEye,
+                                                        light, specular);
+  _shaderContext.setShapeLighting(light, specular);
+}
+
 void mvShapeRect::draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix) {
 
   // printMat("model", getModelMatrix());
   // printMat("view", ViewMatrix);
   // printMat("proj", ProjectionMatrix);
-    
-  _shaderContext.draw(getModelMatrix(), ViewMatrix, ProjectionMatrix);
+
+  if (_shaderContext.getShaderSet()->getFlatLighting()) drawFlatLighting();
+  _shaderContext.draw(getWorldMatrix(), ViewMatrix, ProjectionMatrix);
   
 }
 
 
-void mvShapeObj::load() {
+bool mvShapeVirtualRect::setTileFile(const std::string& fileName, int atlasSize) {
+
+  delete _virtualTexture;
+  _virtualTexture = new mvVirtualTexture(fileName, atlasSize);
+  return _virtualTexture->open();
+}
+
+void mvShapeVirtualRect::prepare() {
+
+  mvShapeRect::prepare();
+  if (_virtualTexture == NULL || !_virtualTexture->open())
+    throw std::runtime_error("A virtual rectangle needs a tile file.");
+}
+
+void mvShapeVirtualRect::load() {
+
+  mvShapeRect::load();
+  _virtualTexture->load(_shaderContext.getShaderSet()->getProgramID());
+}
+
+void mvShapeVirtualRect::draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix) {
+
+  // Takes the texture coordinates, with v down the image, to the
+  // rectangle's model coordinates.  See initVertices().
+  MMat4 uvToModel(1.0f);
+  uvToModel[0][0] = _width;
+  uvToModel[1][1] = -_height;
+  uvToModel[3][0] = -0.5f * _width;
+  uvToModel[3][1] = 0.5f * _height;
+
+  // The tiles asked for are loaded by update(), next frame, along
+  // with those for the other views.  Until then the page table shows
+  // what's there.
+  _virtualTexture->requestTiles(ProjectionMatrix * ViewMatrix *
+                                getWorldMatrix() * uvToModel,
+                                _viewport[2], _viewport[3]);
+
+  // The shader context uses the program again, which does no harm.
+  GLuint programID = _shaderContext.getShaderSet()->getProgramID();
+  glUseProgram(programID);
+  _virtualTexture->draw(programID);
+  _shaderContext.draw(getWorldMatrix(), ViewMatrix, ProjectionMatrix);
+}
+
+void mvShapeObj::prepare() {
+
+  if (_prepared) return;
+  mvShape::prepare();
+
+  // If this mesh has been loaded before, there is a binary copy of it
+  // that can go straight from the file mapping into the GPU buffers.
+  if (_cache.open(_objFileName)) {
+    _boundsMin = _cache.getBoundsMin();
+    _boundsMax = _cache.getBoundsMax();
+    _lods.assign(_cache.getLODs(), _cache.getLODs() + _cache.getLODCount());
+    _prepared = true;
+    return;
+  }
 
   //std::cout << "loading mvShapeObj" << std::endl;
   // Read our .obj file
-  bool res = loadOBJ(_objFileName.c_str(), _vertices, _uvs, _normals);
-  _shaderContext.load(_vertices, _uvs, _normals, _colors);
+  std::vector<MVec3> soupVertices, soupNormals;
+  std::vector<MVec2> soupUVs;
+  if (!loadOBJ(_objFileName.c_str(), soupVertices, soupUVs, soupNormals))
+    throw std::runtime_error("Cannot load OBJ file: " + _objFileName);
+
+  // The loader gives every triangle its own three vertices.  Merge
+  // the ones that are shared, so each is stored and transformed once.
+  indexMesh(soupVertices, soupUVs, soupNormals,
+            _indices, _vertices, _uvs, _normals);
+  std::cout << _objFileName << ": " << soupVertices.size()
+            << " vertices welded to " << _vertices.size() << std::endl;
+
+  // Put the triangles and vertices in the order the GPU likes best.
+  // This is slow-ish, but the result goes into the cache with the rest.
+  optimizeMesh(_indices, _vertices, _uvs, _normals, _objFileName);
+
+  // Simplified versions for when the mesh is far away.
+  buildMeshLODs(_indices, _vertices, _uvs, _normals, _lods);
+  if (_lods.size() == 1) {
+    std::cout << _objFileName << ": no simpler levels of detail; it will "
+              << "always be drawn in full" << std::endl;
+  }
+  for (size_t i = 1; i < _lods.size(); i++) {
+    std::cout << _objFileName << ": LOD " << i << " has "
+              << _lods[i].indexCount / 3 << " triangles, error "
+              << _lods[i].error << std::endl;
+  }
+
+  if (!_vertices.empty()) {
+    _boundsMin = _boundsMax = _vertices[0];
+    for (size_t i = 1; i < _vertices.size(); i++) {
+      _boundsMin = glm::min(_boundsMin, _vertices[i]);
+      _boundsMax = glm::max(_boundsMax, _vertices[i]);
+    }
+  }
+
+  mvMeshCache::write(_objFileName, _vertices, _uvs, _normals, _indices, _lods);
+  _prepared = true;
+}
+
+void mvShapeObj::load() {
+
+  // prepare() may have been on another thread; the bounds it found
+  // are noticed here.
+  prepare();
+  boundsChanged();
+
+  if (_cache.isOpen()) {
+    _shaderContext.load(_cache.getPositions(), _cache.getUVs(),
+                        _cache.getNormals(), _cache.getVertexCount(),
+                        _cache.getIndices(), _cache.getIndexCount(),
+                        (_cache.getIndexSize() == 2) ?
+                        GL_UNSIGNED_SHORT : GL_UNSIGNED_INT);
+
+    // OpenGL has its own copy now.
+    _cache.close();
+    return;
+  }
+
+  _shaderContext.load(_vertices, _uvs, _normals, _colors, _indices);
+}
+
+float mvShapeObj::_maxPixelError = 1.0f;
+
+int mvShapeObj::selectLOD(const MMat4& modelViewMatrix,
+                          const MMat4& projectionMatrix, int viewportHeight) {
+
+  // Without a viewport, from beginView(), draw the full mesh.
+  if (_lods.size() < 2 || viewportHeight <= 0) return 0;
+
+  // The bounding sphere of the mesh, in eye coordinates.  The scale
+  // comes from the largest axis of the model matrix.
+  float scale = glm::max(glm::length(MVec3(modelViewMatrix[0])),
+                         glm::max(glm::length(MVec3(modelViewMatrix[1])),
+                                  glm::length(MVec3(modelViewMatrix[2]))));
+  MVec3 center(modelViewMatrix * MVec4(0.5f * (_boundsMin + _boundsMax), 1.0f));
+  float radius = 0.5f * glm::length(_boundsMax - _boundsMin) * scale;
+
+  // The distance to the nearest part of the mesh.  If the viewer is
+  // inside the sphere, use the full mesh.
+  float distance = glm::length(center) - radius;
+  if (distance <= 0.0f) return 0;
+
+  // Pixels per unit length at unit distance.  For a perspective
+  // projection, P[1][1] is the cotangent of half the vertical field of
+  // view, and the viewport is the size of the display node's window.
+  float pixelsPerUnit = projectionMatrix[1][1] * 0.5f * viewportHeight;
+
+  for (int i = _lods.size() - 1; i > 0; i--) {
+    float pixels = _lods[i].error * scale * pixelsPerUnit / distance;
+    if (pixels <= _maxPixelError) return i;
+  }
+  return 0;
 }
 
 void mvShapeObj::draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix) {
 
-  _shaderContext.draw(getModelMatrix(), ViewMatrix, ProjectionMatrix);
+  // This is called once per display node, with that node's matrices,
+  // so each node gets the level of detail that suits it.
+  if (!_lods.empty()) {
+    int level = selectLOD(ViewMatrix * getWorldMatrix(), ProjectionMatrix,
+                          _viewport[3]);
+    _shaderContext.setDrawRange(_lods[level].indexOffset,
+                                _lods[level].indexCount);
+  }
+
+  _shaderContext.draw(getWorldMatrix(), ViewMatrix, ProjectionMatrix);
 
 }
 
@@ -190,7 +421,7 @@ void mvShapeAxes::load() {
 void mvShapeAxes::draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix) {
 
   // No texture for this, so skip it.  _texture->draw(_shaderContext.getProgramID());
-  _shaderContext.draw(getModelMatrix(), ViewMatrix, ProjectionMatrix);
+  _shaderContext.draw(getWorldMatrix(), ViewMatrix, ProjectionMatrix);
 
 }
   
@@ -237,7 +468,12 @@ mvShape* mvShapeFactory::createShape(mvShapeType type,
     msg << "unknown shape: " << (int)(type);
     throw std::runtime_error(msg.str());
   } else {
-    return (it->second)(shaders, texture);
+    mvShape* shape = (it->second)(shaders, texture);
+
+    layoutMap::const_iterator lt = _layouts.find(type);
+    if (lt != _layouts.end()) shape->setVertexLayout(lt->second);
+
+    return shape;
   }
 }
 
@@ -264,6 +500,7 @@ std::string mvShape::print() const {
   out << "_uvs:         N = " << _uvs.size() << std::endl;
   out << "_normals:     N = " << _normals.size() << std::endl;
   out << "_colors:      N = " << _colors.size() << std::endl;
+  out << "_indices:     N = " << _indices.size() << std::endl;
 
   out << "pos:   " << _position.x << "," << _position.y << "," << _position.z << std::endl;
   out << "scale: " << _scale.x << "," << _scale.y << "," << _scale.z << std::endl;
@@ -284,6 +521,18 @@ std::string mvShapeRect::print() const {
   return out.str();
 }
 
+std::string mvShapeVirtualRect::print() const {
+  std::stringstream out;
+
+  out << mvShapeRect::print();
+  if (_virtualTexture) {
+    out << "tile file: " << _virtualTexture->getFileName() << ", "
+        << _virtualTexture->getResidentCount() << " tiles loaded" << std::endl;
+  }
+
+  return out.str();
+}
+
 std::string mvShapeObj::print() const {
   std::stringstream out;
 
@@ -291,6 +540,13 @@ std::string mvShapeObj::print() const {
   out << std::endl << "lightPositionID: " << _lightPositionID << std::endl;
   out << std::endl << "lightColorID: " << _lightColorID << std::endl;
   out << "OBJ file: " << _objFileName << std::endl;
+  out << "bounds: " << _boundsMin.x << "," << _boundsMin.y << "," << _boundsMin.z
+      << " to " << _boundsMax.x << "," << _boundsMax.y << "," << _boundsMax.z
+      << std::endl;
+  for (size_t i = 0; i < _lods.size(); i++) {
+    out << "LOD " << i << ": " << _lods[i].indexCount / 3
+        << " triangles, error " << _lods[i].error << std::endl;
+  }
   
   return out.str();
 }
@@ -309,9 +565,28 @@ std::string mvShapeAxes::print() const {
   return out.str();
 }
 
+// The pools for each type of shape.  They go with the program, and
+// outlive any shapes.
+static mvShapePool rectPool("rectangles", sizeof(mvShapeRect));
+static mvShapePool objPool("meshes", sizeof(mvShapeObj));
+static mvShapePool axesPool("axes", sizeof(mvShapeAxes));
+
+void* mvShapeRect::operator new(size_t size) { return rectPool.allocate(size); }
+void mvShapeRect::operator delete(void* p, size_t size) { rectPool.release(p, size); }
+
+void* mvShapeObj::operator new(size_t size) { return objPool.allocate(size); }
+void mvShapeObj::operator delete(void* p, size_t size) { objPool.release(p, size); }
+
+void* mvShapeAxes::operator new(size_t size) { return axesPool.allocate(size); }
+void mvShapeAxes::operator delete(void* p, size_t size) { axesPool.release(p, size); }
+
 std::string mvShapeFactory::print() const {
   std::stringstream out;
 
+  out << rectPool.print() << std::endl;
+  out << objPool.print() << std::endl;
+  out << axesPool.print() << std::endl;
+
   for (callbackMap::const_iterator it = _callbacks.begin();
        it != _callbacks.end(); it++) {
     out << "callback for: " << it->first << std::endl;
@@ -326,6 +601,9 @@ std::ostream & operator<<(std::ostream &os, const mvShape& iShape) {
 std::ostream & operator<<(std::ostream &os, const mvShapeRect& iShape) {
   return os << iShape.print();
 }
+std::ostream & operator<<(std::ostream &os, const mvShapeVirtualRect& iShape) {
+  return os << iShape.print();
+}
 std::ostream & operator<<(std::ostream &os, const mvShapeObj& iShape) {
   return os << iShape.print();
 }
@@ -1,3 +1,6 @@
+#ifndef MVSHAPE_H
+#define MVSHAPE_H
+
 #include <iostream>
 #include <string>
 #include <sstream>
@@ -17,11 +20,19 @@
 #include "shader.h"
 #include "texture.h"
 #include "objloader.h"
+#include "meshcache.h"
+#include "meshindexer.h"
+#include "meshopt.h"
+#include "meshsimplify.h"
+#include "shapepool.h"
+#include "scenegraph.h"
+#include "virtualtexture.h"
 
 typedef enum {
   shapeOBJ = 0,
   shapeAXES = 1,
-  shapeRECT = 2
+  shapeRECT = 2,
+  shapeVIRTUAL = 3
 } mvShapeType;
   
 // This is a generic class to hold a shape to be drawn.  The actual
@@ -54,6 +65,9 @@ protected:
 
   mvShapeType _type;
 
+  // See setID().
+  int _id;
+
   // This contains a pointer to the shader to be used and also keeps track of
   // all the OpenGL flibbertygib that corresponds to that shader.
   mvShaderContext _shaderContext;
@@ -66,6 +80,10 @@ protected:
 	std::vector<MVec3> _normals;
 	std::vector<MVec3> _colors;
 
+  // If this is not empty, the vectors above hold unique vertices and
+  // these index them, three per triangle.
+  std::vector<uint32_t> _indices;
+
   MVec3 _position;
   MVec3 _scale;
   MQuat _rotQuaternion;
@@ -75,6 +93,38 @@ protected:
   MMat4 _modelMatrix;
   bool _modelMatrixNeedsReset;
 
+  // The node the shape hangs from, if any, and where it is on the
+  // node's list.  The world matrix is the node's world matrix times
+  // the model matrix, and is usually kept up to date by the node.  See
+  // scenegraph.h.
+  mvTransformNode* _node;
+  size_t _nodeIndex;
+  MMat4 _worldMatrix;
+  bool _worldMatrixNeedsReset;
+  friend class mvTransformNode;
+
+  // Changed, to a number no shape has had before, whenever the world
+  // matrix or the bounding sphere might have, so that whoever keeps a
+  // copy of the sphere (see mvDepthSorter) knows to get it again.
+  uint64_t _boundsVersion;
+  static uint64_t _boundsCount;
+  void boundsChanged() { _boundsVersion = ++_boundsCount; };
+
+  // The viewport of the view being drawn, as x, y, width, height, and
+  // where the viewer is, in the world.  They're the same for every
+  // shape in the view, so they're worked out once, by beginView(),
+  // rather than by each shape.
+  static GLint _viewport[4];
+  static MVec3 _viewEye;
+
+  // The setters call this when the shape moves.
+  void moved() {
+    _modelMatrixNeedsReset = true;
+    _worldMatrixNeedsReset = true;
+    boundsChanged();
+    if (_node) _node->shapeMoved();
+  };
+
   virtual std::string print() const;
   friend std::ostream & operator<<(std::ostream &os, const mvShape& iShape);
 
@@ -86,12 +136,19 @@ public:
   mvShape(mvShapeType type, mvShaderSet* shaders, mvTexture* texture);
   virtual ~mvShape();
 
-  void setShaderContext(mvShaderContext shaderContext) {
-    _shaderContext = shaderContext;
-  };
-  
   static void printMat(std::string name, MMat4 mat);
 
+  // Call this at the start of each view, before any shape in it is
+  // drawn, with the view's viewport set.  It reads the viewport, and
+  // finds the viewer from the view matrix.
+  static void beginView(const MMat4& viewMatrix);
+
+  // Loading happens in two steps.  prepare() does the work that
+  // doesn't need OpenGL -- reading files, decoding images, and so on
+  // -- and may be called from any thread.  load() does the rest, and
+  // has to be called from the thread with the OpenGL context.  It
+  // calls prepare() itself if that hasn't been done.
+  virtual void prepare() { _shaderContext.prepare(); };
   virtual void load() = 0;
   virtual void draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix) = 0;
 
@@ -102,29 +159,43 @@ public:
   virtual void setDimensions(GLfloat a, GLfloat b) {};
   virtual void setDimensions(GLfloat a, GLfloat b, GLfloat c) {};
 
-  mvShaderContext getShaderContext() { return _shaderContext; };
+  mvShaderContext& getShaderContext() { return _shaderContext; };
+
+  // How the vertex data is stored on the GPU.  See shader.h.  Set this
+  // before load().
+  void setVertexLayout(mvVertexLayout layout) {
+    _shaderContext.setVertexLayout(layout);
+  };
+  mvVertexLayout getVertexLayout() {
+    return _shaderContext.getVertexLayout();
+  };
   
   mvShapeType getType() { return _type; };
 
+  // A number for the program to know the shape by.  tgm uses the row
+  // of the report the shape came from.  It starts at -1.
+  void setID(int id) { _id = id; };
+  int getID() { return _id; };
+
   // Position, rotation, scale control mutators.
   void setPosition(MVec3 position) {
     _position = position;
-    _modelMatrixNeedsReset = true;
+    moved();
   };
   void setPosition(GLfloat x, GLfloat y, GLfloat z) {
     setPosition(MVec3(x, y, z));
   };
   void setScale(MVec3 scale) {
     _scale = scale;
-    _modelMatrixNeedsReset = true;
+    moved();
   };
   void setRotation(MQuat rotQuaternion) {
     _rotQuaternion = rotQuaternion;
-    _modelMatrixNeedsReset = true;
+    moved();
   };
   void setRotation(MVec3 pitchYawRoll) {
     _rotQuaternion = MQuat(pitchYawRoll);      
-    _modelMatrixNeedsReset = true;
+    moved();
   };
   
   MVec3 getPosition() { return _position; };
@@ -132,19 +203,46 @@ public:
   MQuat getRotQuaternion() { return _rotQuaternion; };
   MVec3 getPitchYawRoll() { return glm::eulerAngles(_rotQuaternion); };
   
+  // The position, rotation and scale of the shape, relative to its
+  // node, if it has one.
   MMat4 getModelMatrix();
 
+  // Where the shape is in the world, which is where it's drawn.
+  MMat4 getWorldMatrix();
+
+  mvTransformNode* getNode() { return _node; };
+
+  // A sphere around the shape, in its own model coordinates.  The
+  // subclasses know how big they are, so they fill these in.  Used
+  // for culling and depth sorting.
+  virtual MVec3 getBoundingCenter() { return MVec3(0.0f, 0.0f, 0.0f); };
+  virtual float getBoundingRadius() { return 0.0f; };
+
+  // The same sphere in world coordinates, with the center in xyz and
+  // the radius in w.
+  MVec4 getWorldBoundingSphere();
+  uint64_t getBoundsVersion() { return _boundsVersion; };
+
 };
 
 class mvShapeRect : public mvShape {
 protected:
 
   GLfloat _width, _height;
+
+  // The part of the rectangle with anything in it, as (u0, v0, u1, v1)
+  // in texture coordinates, from the texture at load().
+  MVec4 _cropWindow;
   
   // Some of these should move into the parent class.  Also the destructor.
   GLuint _lightPositionID;
   GLuint _lightColorID;
 
+  // With shaders that want it, the rectangle is lit once, on the CPU,
+  // each time it's drawn, and the result goes to the shader context.
+  // See mvShaderSet::setFlatLighting().
+  void drawFlatLighting();
+
   void initVertices();
 
   std::string print() const;
@@ -153,21 +251,73 @@ protected:
   
 public:
  mvShapeRect(mvShaderSet* shaders, mvTexture* texture) :
-  mvShape(shapeRECT, shaders, texture) {
+  mvShape(shapeRECT, shaders, texture),
+    _cropWindow(0.0f, 0.0f, 1.0f, 1.0f) {
     // Set default rectangle dimensions.
     _width = 1.0f;  _height = 1.0f;
   };
 
-  void setWidth(GLfloat width) { _width = width; };
-  void setHeight(GLfloat height) { _height = height; };
+  void setWidth(GLfloat width) { _width = width; boundsChanged(); };
+  void setHeight(GLfloat height) { _height = height; boundsChanged(); };
   void setDimensions(GLfloat width, GLfloat height) {
-    _width = width; _height = height; };
+    _width = width; _height = height; boundsChanged(); };
 
   GLfloat getWidth() { return _width; };
   GLfloat getHeight() { return _height; };
+
+  MVec3 getBoundingCenter() {
+    return MVec3((0.5f * (_cropWindow.x + _cropWindow.z) - 0.5f) * _width,
+                 (0.5f - 0.5f * (_cropWindow.y + _cropWindow.w)) * _height,
+                 0.0f);
+  };
+  float getBoundingRadius() {
+    float w = (_cropWindow.z - _cropWindow.x) * _width;
+    float h = (_cropWindow.w - _cropWindow.y) * _height;
+    return 0.5f * sqrtf(w * w + h * h);
+  };
   
   void load();
   void draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix);
+
+  // Shapes of this type are kept together in memory.  See shapepool.h.
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
+};
+
+// A rectangle showing one image too big for an ordinary texture, from
+// a tile file (see tilefile.h), with a shader that reads a virtual
+// texture (see virtualtexture.h), like VirtualShading.fragmentshader.
+// It's made with no texture.  Each time it's drawn, it works out which
+// tiles the view needs and loads a few of them.
+class mvShapeVirtualRect : public mvShapeRect {
+ private:
+  mvVirtualTexture* _virtualTexture;
+
+  std::string print() const;
+  friend std::ostream & operator<<(std::ostream &os, const mvShapeVirtualRect& iShape);
+
+ public:
+  mvShapeVirtualRect(mvShaderSet* shaders, mvTexture* dummy) :
+    mvShapeRect(shaders, NULL), _virtualTexture(NULL) {
+    _type = shapeVIRTUAL;
+  };
+  ~mvShapeVirtualRect() { delete _virtualTexture; };
+
+  // The tile file to show, and the size of the atlas the tiles in view
+  // are kept in.  Returns false, with a message, if the file can't be
+  // read.  Set this before load().
+  bool setTileFile(const std::string& fileName, int atlasSize = 4096);
+
+  mvVirtualTexture* getVirtualTexture() { return _virtualTexture; };
+
+  // draw() only asks for the tiles each view needs.  This loads them,
+  // for all the views drawn since the last call together, so call it
+  // once a frame, before any view is drawn.
+  void update() { if (_virtualTexture) _virtualTexture->update(); };
+
+  void prepare();
+  void load();
+  void draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix);
 };
 
 class mvShapeObj : public mvShape {
@@ -178,19 +328,65 @@ private:
   GLuint _lightColorID;
 
   std::string _objFileName;
+
+  // The bounding box of the mesh, in model coordinates.
+  MVec3 _boundsMin, _boundsMax;
+
+  // The levels of detail.  _indices holds all of them, one after
+  // another, and draw() picks one.  Level 0 is the full mesh.
+  std::vector<mvMeshLOD> _lods;
+
+  // Between prepare() and load(), the mesh is either in the vectors,
+  // or in this cache file, if it was open()ed successfully.
+  mvMeshCache _cache;
+  bool _prepared;
+
+  // The most a simplified level may be off by on the screen, in
+  // pixels.  Shared by all the meshes.
+  static float _maxPixelError;
+
+  // Picks the coarsest level of detail whose error, projected onto the
+  // screen at the mesh's distance from the viewer, is within
+  // _maxPixelError, in a viewport viewportHeight pixels high.
+  int selectLOD(const MMat4& modelViewMatrix, const MMat4& projectionMatrix,
+                int viewportHeight);
   
   std::string print() const;
   friend std::ostream & operator<<(std::ostream &os, const mvShapeObj& iShape);
   
 public:
  mvShapeObj(mvShaderSet* shaders, mvTexture* texture) :
-  mvShape(shapeOBJ, shaders, texture) {};
+  mvShape(shapeOBJ, shaders, texture),
+    _boundsMin(0.0f, 0.0f, 0.0f), _boundsMax(0.0f, 0.0f, 0.0f),
+    _prepared(false) {};
 
+  // The first time an OBJ file is loaded, a binary copy of the mesh
+  // is written to a cache file (see meshcache.h), and later loads
+  // read that instead of parsing the OBJ file again.  The levels of
+  // detail (see meshsimplify.h) are made then, and cached with the
+  // rest.  All of that happens in prepare().
+
+  void prepare();
   void load();
   void draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix);
 
   std::string getObjFile() { return _objFileName; };
   void setObjFile(std::string objFileName) { _objFileName = objFileName; };
+
+  MVec3 getBoundsMin() { return _boundsMin; };
+  MVec3 getBoundsMax() { return _boundsMax; };
+
+  MVec3 getBoundingCenter() { return 0.5f * (_boundsMin + _boundsMax); };
+  float getBoundingRadius() { return 0.5f * glm::length(_boundsMax - _boundsMin); };
+
+  int getLODCount() { return _lods.size(); };
+
+  static void setMaxPixelError(float pixels) { _maxPixelError = pixels; };
+  static float getMaxPixelError() { return _maxPixelError; };
+
+  // Shapes of this type are kept together in memory.  See shapepool.h.
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
 };
 
 class mvShapeAxes : public mvShape {
@@ -219,6 +415,13 @@ class mvShapeAxes : public mvShape {
   void load();
   void draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix);
 
+  // The axes are four units long.
+  float getBoundingRadius() { return 4.0f; };
+
+  // Shapes of this type are kept together in memory.  See shapepool.h.
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
+
 };  
 
 class mvShapeFactory {
@@ -238,12 +441,20 @@ class mvShapeFactory {
 
   bool registerShape(mvShapeType type, createMvShapeCallback creator);
 
+  // Shapes of the given type are created with this vertex layout.
+  // Anything not set here gets the mvShaderContext default.  Big
+  // meshes benefit the most from the packed layouts.
+  void setVertexLayout(mvShapeType type, mvVertexLayout layout) {
+    _layouts[type] = layout;
+  };
+
   mvShapeFactory() {
 
     // Fill factory.
     registerShape(shapeOBJ, create<mvShapeObj>);
     registerShape(shapeAXES, create<mvShapeAxes>);
     registerShape(shapeRECT, create<mvShapeRect>);
+    registerShape(shapeVIRTUAL, create<mvShapeVirtualRect>);
     
   }
   
@@ -251,6 +462,9 @@ class mvShapeFactory {
   typedef std::map<mvShapeType, createMvShapeCallback> callbackMap;
   callbackMap _callbacks;
 
+  typedef std::map<mvShapeType, mvVertexLayout> layoutMap;
+  layoutMap _layouts;
+
   std::string print() const;
   friend std::ostream & operator<<(std::ostream &os, const mvShapeFactory& iShape);
 
@@ -260,3 +474,5 @@ class mvShapeFactory {
 /// detach* thing
 
 // Next, 
+
+#endif
@@ -2,111 +2,491 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <cmath>
+#include <climits>
+#include <thread>
 
 #include <glm/glm.hpp>
 
 #include "objloader.h"
+#include "mappedfile.h"
 
-// Very, VERY simple OBJ loader.
-// Here is a short list of features a real function would provide : 
-// - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
-// - Animations & bones (includes bones weights)
-// - Multiple UVs
-// - All attributes should be optional, not "forced"
-// - More stable. Change a line in the OBJ file and it crashes.
-// - More secure. Change another line and you can inject code.
-// - Loading from memory, stream, etc
-
-bool loadOBJ(
-	const char * path, 
-	std::vector<MVec3> & out_vertices, 
-	std::vector<MVec2> & out_uvs,
-	std::vector<MVec3> & out_normals
-){
-	printf("Loading OBJ file %s...\n", path);
-
-	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-	std::vector<MVec3> temp_vertices; 
-	std::vector<MVec2> temp_uvs;
-	std::vector<MVec3> temp_normals;
-
-
-	FILE * file = fopen(path, "r");
-	if( file == NULL ){
-		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-		getchar();
-		return false;
-	}
-
-	while( 1 ){
-
-		char lineHeader[128];
-		// read the first word of the line
-		int res = fscanf(file, "%s", lineHeader);
-		if (res == EOF)
-			break; // EOF = End Of File. Quit the loop.
-
-		// else : parse lineHeader
-		
-		if ( strcmp( lineHeader, "v" ) == 0 ){
-			MVec3 vertex;
-			fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-			temp_vertices.push_back(vertex);
-		}else if ( strcmp( lineHeader, "vt" ) == 0 ){
-			MVec2 uv;
-			fscanf(file, "%f %f\n", &uv.x, &uv.y );
-			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-			temp_uvs.push_back(uv);
-		}else if ( strcmp( lineHeader, "vn" ) == 0 ){
-			MVec3 normal;
-			fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-			temp_normals.push_back(normal);
-		}else if ( strcmp( lineHeader, "f" ) == 0 ){
-			std::string vertex1, vertex2, vertex3;
-			unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-			int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-			if (matches != 9){
-				printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-				fclose(file);
-				return false;
-			}
-			vertexIndices.push_back(vertexIndex[0]);
-			vertexIndices.push_back(vertexIndex[1]);
-			vertexIndices.push_back(vertexIndex[2]);
-			uvIndices    .push_back(uvIndex[0]);
-			uvIndices    .push_back(uvIndex[1]);
-			uvIndices    .push_back(uvIndex[2]);
-			normalIndices.push_back(normalIndex[0]);
-			normalIndices.push_back(normalIndex[1]);
-			normalIndices.push_back(normalIndex[2]);
-		}else{
-			// Probably a comment, eat up the rest of the line
-			char stupidBuffer[1000];
-			fgets(stupidBuffer, 1000, file);
-		}
-
-	}
-
-	// For each vertex of each triangle
-	for( unsigned int i=0; i<vertexIndices.size(); i++ ){
-
-		// Get the indices of its attributes
-		unsigned int vertexIndex = vertexIndices[i];
-		unsigned int uvIndex = uvIndices[i];
-		unsigned int normalIndex = normalIndices[i];
-		
-		// Get the attributes thanks to the index
-		MVec3 vertex = temp_vertices[ vertexIndex-1 ];
-		MVec2 uv = temp_uvs[ uvIndex-1 ];
-		MVec3 normal = temp_normals[ normalIndex-1 ];
-		
-		// Put the attributes in buffers
-		out_vertices.push_back(vertex);
-		out_uvs     .push_back(uv);
-		out_normals .push_back(normal);
-	
-	}
-	fclose(file);
-	return true;
+// OBJ loader.  The file is mapped into memory, cut into line-aligned
+// chunks, and the chunks are parsed in parallel, one thread each.
+// Each chunk collects its own positions, texture coordinates, normals
+// and face corners, and the chunks are stitched back together at the
+// end.  The parsing is done by hand, since scanf() and friends spend
+// most of their time on locale and format-string business that OBJ
+// files never need.
+//
+// Supported: v, vt, vn and f records.  Faces can have any number of
+// corners (they are fan-triangulated, so they should be convex),
+// indices can be negative (relative to the end of the list so far),
+// and the texture coordinate and normal can each be left out
+// ("f 1 2 3", "f 1//1 2//2 3//3", "f 1/1 2/1 3/1").  Missing texture
+// coordinates come out as (0,0) and missing normals are replaced with
+// the face normal.  A texture coordinate can be given as u alone,
+// with v taken as 0.  A '#' starts a comment, on a line of its own or
+// after a record.  Everything else (materials, groups, smoothing, and
+// so on) is skipped.
+
+// Files smaller than this are parsed in one piece; it isn't worth
+// starting threads for them.
+static const size_t minChunkSize = 1 << 20;
+
+// A face index that wasn't given, e.g. the texture coordinate in "1//3".
+static const int missingIndex = INT_MIN;
+
+// One corner of a triangle, pointing into the position, uv, and
+// normal lists.  Positive indices in the file are absolute, and are
+// stored here 0-based.  Negative indices are relative to the end of
+// the list, which for a chunk in the middle of the file isn't known
+// until all the chunks before it have been counted.  So those are
+// stored relative to the start of this chunk's own list (and may be
+// negative), with a bit set in 'relative' to say so.
+struct objCorner {
+  int index[3];
+  unsigned char relative;
+};
+
+struct objChunk {
+  const char* begin;
+  const char* end;
+
+  std::vector<MVec3> positions;
+  std::vector<MVec2> uvs;
+  std::vector<MVec3> normals;
+  std::vector<objCorner> corners;
+
+  // Line number where parsing failed, or 0 if everything was fine.
+  // This is counted from the start of the chunk.
+  int badLine;
+};
+
+static const double powersOfTen[] = {
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+  1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isBlank(char c) { return c == ' ' || c == '\t'; }
+static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+static inline const char* skipBlanks(const char* p, const char* end) {
+  while (p < end && isBlank(*p)) p++;
+  return p;
+}
+
+static inline const char* skipLine(const char* p, const char* end) {
+  while (p < end && *p != '\n') p++;
+  return p < end ? p + 1 : end;
+}
+
+// Parse a decimal float like "-1.25e-3".  This is not as careful as
+// strtod() about the last bit of rounding, but it is exact for the
+// short decimal strings that exporters write, and several times
+// faster.  Returns the position after the number, or NULL if there
+// is no number there.
+static const char* parseFloat(const char* p, const char* end, float& out) {
+
+  p = skipBlanks(p, end);
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  unsigned long long mantissa = 0;
+  int exponent = 0;
+  int nDigits = 0;
+
+  for (; p < end && isDigit(*p); p++, nDigits++) {
+    if (mantissa < 100000000000000000ULL) {
+      mantissa = mantissa * 10 + (*p - '0');
+    } else {
+      // Too many digits to hold; the rest only move the decimal point.
+      exponent++;
+    }
+  }
+
+  if (p < end && *p == '.') {
+    for (p++; p < end && isDigit(*p); p++, nDigits++) {
+      if (mantissa < 100000000000000000ULL) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+
+  if (nDigits == 0) return NULL;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negativeExp = false;
+    if (q < end && (*q == '-' || *q == '+')) {
+      negativeExp = (*q == '-');
+      q++;
+    }
+    if (q < end && isDigit(*q)) {
+      int e = 0;
+      for (; q < end && isDigit(*q); q++) {
+        if (e < 10000) e = e * 10 + (*q - '0');
+      }
+      exponent += negativeExp ? -e : e;
+      p = q;
+    }
+  }
+
+  double value = (double)mantissa;
+  if (exponent < 0) {
+    value = (exponent >= -22) ? value / powersOfTen[-exponent] :
+      value * pow(10.0, exponent);
+  } else if (exponent > 0) {
+    value = (exponent <= 22) ? value * powersOfTen[exponent] :
+      value * pow(10.0, exponent);
+  }
+
+  out = (float)(negative ? -value : value);
+  return p;
+}
+
+// Parse an integer, which may be negative.  Returns NULL if there
+// isn't one.
+static inline const char* parseInt(const char* p, const char* end, int& out) {
+
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  if (p >= end || !isDigit(*p)) return NULL;
+
+  int value = 0;
+  for (; p < end && isDigit(*p); p++) value = value * 10 + (*p - '0');
+
+  out = negative ? -value : value;
+  return p;
+}
+
+// Turn an index from the file into an objCorner entry.  'count' is
+// how many of this kind of item the chunk has seen so far.
+static inline bool resolveIndex(int fileIndex, int count, int attrib,
+                                objCorner& corner) {
+  if (fileIndex > 0) {
+    corner.index[attrib] = fileIndex - 1;
+  } else if (fileIndex < 0) {
+    corner.index[attrib] = count + fileIndex;
+    corner.relative |= (1 << attrib);
+  } else {
+    // There is no index 0 in an OBJ file.
+    return false;
+  }
+  return true;
+}
+
+// Read one face corner, e.g. "3", "3/4", "3//5", or "3/4/5".  Returns
+// the position after it, or NULL if it's garbled.
+static const char* parseCorner(const char* p, const char* end,
+                               const objChunk& chunk, objCorner& corner) {
+
+  corner.relative = 0;
+  corner.index[1] = missingIndex;
+  corner.index[2] = missingIndex;
+
+  int idx;
+  p = parseInt(p, end, idx);
+  if (p == NULL) return NULL;
+  if (!resolveIndex(idx, chunk.positions.size(), 0, corner)) return NULL;
+
+  if (p < end && *p == '/') {
+    p++;
+    if (p < end && *p != '/') {
+      p = parseInt(p, end, idx);
+      if (p == NULL) return NULL;
+      if (!resolveIndex(idx, chunk.uvs.size(), 1, corner)) return NULL;
+    }
+    if (p < end && *p == '/') {
+      p++;
+      p = parseInt(p, end, idx);
+      if (p == NULL) return NULL;
+      if (!resolveIndex(idx, chunk.normals.size(), 2, corner)) return NULL;
+    }
+  }
+
+  // The corner has to end in whitespace or a comment.
+  if (p < end && !isBlank(*p) && *p != '\r' && *p != '\n' && *p != '#')
+    return NULL;
+
+  return p;
+}
+
+static void parseChunk(objChunk* chunk) {
+
+  const char* p = chunk->begin;
+  const char* end = chunk->end;
+
+  // Corners of the current face, before triangulation.
+  std::vector<objCorner> face;
+
+  int lineNumber = 0;
+  chunk->badLine = 0;
+
+  while (p < end) {
+
+    lineNumber++;
+    p = skipBlanks(p, end);
+    if (p >= end) break;
+
+    if (p[0] == 'v' && p + 1 < end && isBlank(p[1])) {
+
+      MVec3 vertex;
+      p = parseFloat(p + 1, end, vertex.x);
+      if (p) p = parseFloat(p, end, vertex.y);
+      if (p) p = parseFloat(p, end, vertex.z);
+      if (p == NULL) { chunk->badLine = lineNumber; return; }
+      chunk->positions.push_back(vertex);
+
+    } else if (p[0] == 'v' && p + 2 < end && p[1] == 't' && isBlank(p[2])) {
+
+      // The v coordinate can be left out, and is then 0.
+      MVec2 uv(0.0f, 0.0f);
+      p = parseFloat(p + 2, end, uv.x);
+      if (p) {
+        const char* next = skipBlanks(p, end);
+        if (next < end && *next != '\n' && *next != '\r' && *next != '#')
+          p = parseFloat(next, end, uv.y);
+      }
+      if (p == NULL) { chunk->badLine = lineNumber; return; }
+      // Invert V coordinate since we will only use DDS texture, which
+      // are inverted. Remove if you want to use TGA or BMP loaders.
+      uv.y = -uv.y;
+      chunk->uvs.push_back(uv);
+
+    } else if (p[0] == 'v' && p + 2 < end && p[1] == 'n' && isBlank(p[2])) {
+
+      MVec3 normal;
+      p = parseFloat(p + 2, end, normal.x);
+      if (p) p = parseFloat(p, end, normal.y);
+      if (p) p = parseFloat(p, end, normal.z);
+      if (p == NULL) { chunk->badLine = lineNumber; return; }
+      chunk->normals.push_back(normal);
+
+    } else if (p[0] == 'f' && p + 1 < end && isBlank(p[1])) {
+
+      face.clear();
+      p = skipBlanks(p + 1, end);
+      while (p < end && *p != '\n' && *p != '\r' && *p != '#') {
+        objCorner corner;
+        p = parseCorner(p, end, *chunk, corner);
+        if (p == NULL) { chunk->badLine = lineNumber; return; }
+        face.push_back(corner);
+        p = skipBlanks(p, end);
+      }
+
+      if (face.size() < 3) { chunk->badLine = lineNumber; return; }
+
+      // Fan-triangulate.  A triangle just comes out as itself.
+      for (size_t i = 1; i + 1 < face.size(); i++) {
+        chunk->corners.push_back(face[0]);
+        chunk->corners.push_back(face[i]);
+        chunk->corners.push_back(face[i + 1]);
+      }
+    }
+
+    // Skip whatever is left: the end of a parsed line, a comment, or
+    // a record type we don't care about.
+    p = skipLine(p, end);
+  }
 }
 
+// Convert one chunk's triangles into expanded vertex data, written
+// into the output arrays starting at 'outStart'.  The 'xxxBase'
+// arguments are the number of items of each kind in all the chunks
+// before this one.  Returns false if an index is out of range.
+static bool expandChunk(const objChunk& chunk,
+                        const std::vector<MVec3>& positions,
+                        const std::vector<MVec2>& uvs,
+                        const std::vector<MVec3>& normals,
+                        int positionBase, int uvBase, int normalBase,
+                        MVec3* outVertices, MVec2* outUvs, MVec3* outNormals) {
+
+  const int base[3] = { positionBase, uvBase, normalBase };
+  const int limit[3] = { (int)positions.size(),
+                         (int)uvs.size(),
+                         (int)normals.size() };
+
+  for (size_t t = 0; t < chunk.corners.size(); t += 3) {
+
+    bool needFaceNormal = false;
+
+    for (int k = 0; k < 3; k++) {
+      const objCorner& corner = chunk.corners[t + k];
+
+      int index[3];
+      for (int a = 0; a < 3; a++) {
+        index[a] = corner.index[a];
+        if (index[a] == missingIndex) continue;
+        if (corner.relative & (1 << a)) index[a] += base[a];
+        if (index[a] < 0 || index[a] >= limit[a]) return false;
+      }
+
+      outVertices[t + k] = positions[index[0]];
+      outUvs[t + k] = (index[1] == missingIndex) ? MVec2(0.0f, 0.0f) :
+        uvs[index[1]];
+      if (index[2] == missingIndex) {
+        needFaceNormal = true;
+      } else {
+        outNormals[t + k] = normals[index[2]];
+      }
+    }
+
+    if (needFaceNormal) {
+      MVec3 n = glm::cross(outVertices[t + 1] - outVertices[t],
+                           outVertices[t + 2] - outVertices[t]);
+      float len = glm::length(n);
+      n = (len > 0.0f) ? n / len : MVec3(0.0f, 0.0f, 1.0f);
+
+      for (int k = 0; k < 3; k++) {
+        if (chunk.corners[t + k].index[2] == missingIndex)
+          outNormals[t + k] = n;
+      }
+    }
+  }
+
+  return true;
+}
+
+// A thread-friendly wrapper for the above.
+static void expandChunkThread(const objChunk* chunk,
+                              const std::vector<MVec3>* positions,
+                              const std::vector<MVec2>* uvs,
+                              const std::vector<MVec3>* normals,
+                              int positionBase, int uvBase, int normalBase,
+                              MVec3* outVertices, MVec2* outUvs,
+                              MVec3* outNormals, char* ok) {
+  *ok = expandChunk(*chunk, *positions, *uvs, *normals,
+                    positionBase, uvBase, normalBase,
+                    outVertices, outUvs, outNormals);
+}
+
+bool loadOBJ(const char* path,
+             std::vector<MVec3>& out_vertices,
+             std::vector<MVec2>& out_uvs,
+             std::vector<MVec3>& out_normals) {
+
+  printf("Loading OBJ file %s...\n", path);
+
+  mvMappedFile file;
+  if (!file.open(path)) {
+    printf("Impossible to open %s.  Are you in the right directory?\n", path);
+    return false;
+  }
+
+  const char* data = file.getData();
+  const char* dataEnd = data + file.getSize();
+
+  // Decide how many pieces to cut the file into.
+  unsigned int nThreads = std::thread::hardware_concurrency();
+  if (nThreads == 0) nThreads = 1;
+  size_t nChunks = file.getSize() / minChunkSize + 1;
+  if (nChunks > nThreads) nChunks = nThreads;
+
+  // Cut it, moving each cut forward to the next line boundary.
+  std::vector<objChunk> chunks(nChunks);
+  const char* p = data;
+  for (size_t i = 0; i < nChunks; i++) {
+    chunks[i].begin = p;
+    if (i == nChunks - 1) {
+      p = dataEnd;
+    } else {
+      p = data + (file.getSize() * (i + 1)) / nChunks;
+      if (p < chunks[i].begin) p = chunks[i].begin;
+      p = skipLine(p, dataEnd);
+    }
+    chunks[i].end = p;
+  }
+
+  // Parse.  The first chunk is done on this thread.
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < nChunks; i++)
+    threads.push_back(std::thread(parseChunk, &chunks[i]));
+  parseChunk(&chunks[0]);
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+  threads.clear();
+
+  for (size_t i = 0; i < nChunks; i++) {
+    if (chunks[i].badLine) {
+      // Count lines to report where the problem is in the whole file.
+      int line = chunks[i].badLine;
+      for (const char* q = data; q < chunks[i].begin; q++)
+        if (*q == '\n') line++;
+      printf("%s:%d: can't read this line.\n", path, line);
+      return false;
+    }
+  }
+
+  // Gather up the positions, uvs, and normals, and note where each
+  // chunk's lists start and its triangles go.
+  std::vector<MVec3> positions;
+  std::vector<MVec2> uvs;
+  std::vector<MVec3> normals;
+  std::vector<int> positionBase(nChunks), uvBase(nChunks), normalBase(nChunks);
+  std::vector<size_t> cornerBase(nChunks);
+  size_t nCorners = 0;
+
+  for (size_t i = 0; i < nChunks; i++) {
+    positionBase[i] = positions.size();
+    uvBase[i] = uvs.size();
+    normalBase[i] = normals.size();
+    cornerBase[i] = nCorners;
+
+    positions.insert(positions.end(),
+                     chunks[i].positions.begin(), chunks[i].positions.end());
+    uvs.insert(uvs.end(), chunks[i].uvs.begin(), chunks[i].uvs.end());
+    normals.insert(normals.end(),
+                   chunks[i].normals.begin(), chunks[i].normals.end());
+    nCorners += chunks[i].corners.size();
+
+    // Don't need these any more.
+    std::vector<MVec3>().swap(chunks[i].positions);
+    std::vector<MVec2>().swap(chunks[i].uvs);
+    std::vector<MVec3>().swap(chunks[i].normals);
+  }
+
+  // Expand the triangles into the output, again one thread per chunk.
+  size_t outStart = out_vertices.size();
+  out_vertices.resize(outStart + nCorners);
+  out_uvs.resize(outStart + nCorners);
+  out_normals.resize(outStart + nCorners);
+
+  if (nCorners == 0) return true;
+
+  // Can't use std::vector<bool> here, since the threads write to
+  // neighboring elements.
+  std::vector<char> ok(nChunks, 1);
+
+  for (size_t i = 0; i < nChunks; i++) {
+    if (chunks[i].corners.empty()) continue;
+    size_t o = outStart + cornerBase[i];
+    threads.push_back(std::thread(expandChunkThread, &chunks[i],
+                                  &positions, &uvs, &normals,
+                                  positionBase[i], uvBase[i], normalBase[i],
+                                  &out_vertices[o], &out_uvs[o],
+                                  &out_normals[o], &ok[i]));
+  }
+  for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+
+  for (size_t i = 0; i < nChunks; i++) {
+    if (!ok[i]) {
+      printf("%s: a face refers to a vertex, uv, or normal that isn't there.\n",
+             path);
+      out_vertices.resize(outStart);
+      out_uvs.resize(outStart);
+      out_normals.resize(outStart);
+      return false;
+    }
+  }
+
+  return true;
+}
@@ -1,6 +1,8 @@
 #ifndef OBJLOADER_H
 #define OBJLOADER_H
 
+#include <vector>
+
 #include "vecTypes.h"
 
 bool loadOBJ(
@@ -0,0 +1,233 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "pixelops.h"
+
+void narrow16to8(const unsigned char* in, unsigned char* out, size_t count) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // Read as little-endian words, the high byte of each sample is in
+  // the low half.  Mask off the rest, and the saturating pack then
+  // just drops the empty high halves.
+  const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+  for (; i + 16 <= count; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(in + 2 * i + 16));
+    a = _mm_and_si128(a, lowBytes);
+    b = _mm_and_si128(b, lowBytes);
+    _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(a, b));
+  }
+#endif
+
+  for (; i < count; i++) out[i] = in[2 * i];
+}
+
+void swap16(const unsigned char* in, unsigned char* out, size_t count) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), v);
+  }
+#endif
+
+  for (; i < count; i++) {
+    unsigned char high = in[2 * i];
+    out[2 * i] = in[2 * i + 1];
+    out[2 * i + 1] = high;
+  }
+}
+
+void halveRGBA8(const unsigned char* row0, const unsigned char* row1,
+                int width, unsigned char* out) {
+
+  int half = width / 2;
+  int x = 0;
+
+#ifdef __SSE2__
+  // Eight pixels in, four out.  The rows are added as 16-bit values,
+  // then the even pixels are lined up against the odd ones and added
+  // to those.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  for (; x + 4 <= half; x += 4) {
+    __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + 8 * x));
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + 8 * x + 16));
+    __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + 8 * x));
+    __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + 8 * x + 16));
+
+    __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+    __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+    __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+    __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+    __m128i c0 = _mm_add_epi16(_mm_unpacklo_epi64(s0, s1), _mm_unpackhi_epi64(s0, s1));
+    __m128i c1 = _mm_add_epi16(_mm_unpacklo_epi64(s2, s3), _mm_unpackhi_epi64(s2, s3));
+    c0 = _mm_srli_epi16(_mm_add_epi16(c0, two), 2);
+    c1 = _mm_srli_epi16(_mm_add_epi16(c1, two), 2);
+    _mm_storeu_si128((__m128i*)(out + 4 * x), _mm_packus_epi16(c0, c1));
+  }
+#endif
+
+  for (; x < half; x++) {
+    for (int c = 0; c < 4; c++) {
+      out[4 * x + c] = (row0[8 * x + c] + row0[8 * x + 4 + c] +
+                        row1[8 * x + c] + row1[8 * x + 4 + c] + 2) >> 2;
+    }
+  }
+
+  if (width & 1) {
+    for (int c = 0; c < 4; c++)
+      out[4 * half + c] = (row0[8 * half + c] + row1[8 * half + c] + 1) >> 1;
+  }
+}
+
+void keyRGBA8(const unsigned char* in, unsigned char* out, size_t count) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // Four pixels at a time.  Comparing the pixels with themselves
+  // shifted down a byte compares each red with its green, in the low
+  // byte; that's spread over the whole pixel to make a mask.
+  const __m128i redByte = _mm_set1_epi32(0x000000FF);
+  const __m128i colorBytes = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i alphaByte = _mm_set1_epi32((int)0xFF000000);
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i mask = _mm_and_si128(_mm_cmpeq_epi8(v, _mm_srli_epi32(v, 8)), redByte);
+    mask = _mm_or_si128(mask, _mm_slli_epi32(mask, 8));
+    mask = _mm_or_si128(mask, _mm_slli_epi32(mask, 16));
+    v = _mm_or_si128(_mm_and_si128(v, _mm_and_si128(mask, colorBytes)),
+                     _mm_and_si128(mask, alphaByte));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), v);
+  }
+#endif
+
+  for (; i < count; i++) {
+    const unsigned char* p = in + 4 * i;
+    unsigned char* o = out + 4 * i;
+    if (p[0] == p[1]) {
+      o[0] = p[0];
+      o[1] = p[1];
+      o[2] = p[2];
+      o[3] = 255;
+    } else {
+      o[0] = o[1] = o[2] = o[3] = 0;
+    }
+  }
+}
+
+void packRedAlpha8(const unsigned char* in, unsigned char* out, size_t count) {
+
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // Eight pixels at a time.  Each pixel's red and alpha are brought
+  // together in its low 16 bits, and then those are gathered up.
+  const __m128i redByte = _mm_set1_epi32(0x000000FF);
+  const __m128i alphaByte = _mm_set1_epi32(0x0000FF00);
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(in + 4 * i + 16));
+    a = _mm_or_si128(_mm_and_si128(a, redByte),
+                     _mm_and_si128(_mm_srli_epi32(a, 16), alphaByte));
+    b = _mm_or_si128(_mm_and_si128(b, redByte),
+                     _mm_and_si128(_mm_srli_epi32(b, 16), alphaByte));
+    a = _mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 1, 2, 0));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 1, 2, 0));
+    a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shufflelo_epi16(b, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shufflehi_epi16(b, _MM_SHUFFLE(3, 1, 2, 0));
+    b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi64(a, b));
+  }
+#endif
+
+  for (; i < count; i++) {
+    unsigned char red = in[4 * i], alpha = in[4 * i + 3];
+    out[2 * i] = red;
+    out[2 * i + 1] = alpha;
+  }
+}
+
+// Adds a row of samples, times weight, to sums.
+static void addWeightedRow(const unsigned char* row, int length,
+                           float weight, float* sums) {
+
+  int i = 0;
+
+#ifdef __SSE2__
+  // Sixteen samples at a time, widened to 32-bit floats four at a time.
+  const __m128i zero = _mm_setzero_si128();
+  const __m128 w = _mm_set1_ps(weight);
+  for (; i + 16 <= length; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(row + i));
+    __m128i lo = _mm_unpacklo_epi8(v, zero);
+    __m128i hi = _mm_unpackhi_epi8(v, zero);
+    __m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    __m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    __m128 f2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    __m128 f3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    _mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), _mm_mul_ps(f0, w)));
+    _mm_storeu_ps(sums + i + 4, _mm_add_ps(_mm_loadu_ps(sums + i + 4), _mm_mul_ps(f1, w)));
+    _mm_storeu_ps(sums + i + 8, _mm_add_ps(_mm_loadu_ps(sums + i + 8), _mm_mul_ps(f2, w)));
+    _mm_storeu_ps(sums + i + 12, _mm_add_ps(_mm_loadu_ps(sums + i + 12), _mm_mul_ps(f3, w)));
+  }
+#endif
+
+  for (; i < length; i++) sums[i] += weight * row[i];
+}
+
+void shrinkImage8(const unsigned char* in, int inRowBytes,
+                  int width, int height, int channels,
+                  unsigned char* out, int outRowBytes,
+                  int newWidth, int newHeight) {
+
+  // Distances are measured in units that make an old pixel newWidth
+  // (or newHeight) long and a new one width (or height) long, so that
+  // all the edges fall on whole numbers.
+  int rowLength = width * channels;
+  std::vector<float> sums(rowLength);
+
+  for (int y = 0; y < newHeight; y++) {
+
+    // The old rows under this new one, added up across the whole
+    // width.  That's most of the work, and it doesn't care where one
+    // pixel ends and the next starts.
+    int64_t top = (int64_t)y * height, bottom = top + height;
+    std::fill(sums.begin(), sums.end(), 0.0f);
+    for (int r = (int)(top / newHeight); r <= (int)((bottom - 1) / newHeight); r++) {
+      int64_t overlap = std::min(bottom, (int64_t)(r + 1) * newHeight) -
+        std::max(top, (int64_t)r * newHeight);
+      addWeightedRow(in + (size_t)r * inRowBytes, rowLength,
+                     (float)overlap / height, &sums[0]);
+    }
+
+    // Then the columns.
+    unsigned char* o = out + (size_t)y * outRowBytes;
+    for (int x = 0; x < newWidth; x++) {
+      int64_t left = (int64_t)x * width, right = left + width;
+      float pixel[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+      for (int i = (int)(left / newWidth); i <= (int)((right - 1) / newWidth); i++) {
+        int64_t overlap = std::min(right, (int64_t)(i + 1) * newWidth) -
+          std::max(left, (int64_t)i * newWidth);
+        float weight = (float)overlap / width;
+        for (int c = 0; c < channels; c++)
+          pixel[c] += weight * sums[i * channels + c];
+      }
+      for (int c = 0; c < channels; c++)
+        o[x * channels + c] = (unsigned char)std::min(pixel[c] + 0.5f, 255.0f);
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef PIXELOPS_H
+#define PIXELOPS_H
+
+#include <stddef.h>
+
+// Conversions of decoded pixel data, done a row or a whole image at a
+// time.  These run over every byte of every image we load, so they use
+// SSE2 where it's available, with plain loops for other machines.
+
+// Turns count 16-bit samples, stored big-endian as PNG has them, into
+// 8-bit ones by keeping the high byte.  That's what png_set_strip_16()
+// does, only faster.  in and out may be the same.
+void narrow16to8(const unsigned char* in, unsigned char* out, size_t count);
+
+// Turns count big-endian 16-bit samples into the little-endian order
+// OpenGL wants them in on the machines we run on.  in and out may be
+// the same.
+void swap16(const unsigned char* in, unsigned char* out, size_t count);
+
+// Makes one row of an RGBA image half the size of another, each pixel
+// the rounded average of a 2x2 block.  row0 and row1 are the two rows
+// of the bigger image, width pixels each, and out gets (width + 1) / 2
+// pixels.  If the width is odd, the last pixel averages the one column
+// left over; for an odd height, pass the last row as both rows.
+void halveRGBA8(const unsigned char* row0, const unsigned char* row1,
+                int width, unsigned char* out);
+
+// Keys out the background of count RGBA pixels, the way the plankton
+// images want it: a pixel whose red and green differ is background,
+// and becomes transparent black, and any other is made opaque.  The
+// result is premultiplied by its alpha, which for pixels that are
+// either opaque or not there at all is the same thing.  in and out may
+// be the same.
+void keyRGBA8(const unsigned char* in, unsigned char* out, size_t count);
+
+// Packs count RGBA pixels into two bytes each, red and alpha, for gray
+// images with an alpha.  out may be the same as in, or anywhere before
+// it.
+void packRedAlpha8(const unsigned char* in, unsigned char* out, size_t count);
+
+// Shrinks an image with 8-bit samples, channels of them a pixel (one to
+// four), from width x height to newWidth x newHeight, which can't be
+// bigger.  Each new pixel is the average of the part of the old image
+// it covers, counting the old pixels it only partly covers by how much
+// of them it does, so any ratio works, and nothing is skipped over.
+// Rows are inRowBytes and outRowBytes long.
+void shrinkImage8(const unsigned char* in, int inRowBytes,
+                  int width, int height, int channels,
+                  unsigned char* out, int outRowBytes,
+                  int newWidth, int newHeight);
+
+#endif
@@ -0,0 +1,321 @@
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+#include "roiscene.h"
+
+// How long it's been since start, in milliseconds.
+static double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+}
+
+// Whether a shape is in a set, for std::remove_if().
+struct inSet {
+  const std::set<mvShape*>& shapes;
+  inSet(const std::set<mvShape*>& s) : shapes(s) {};
+  bool operator()(mvShape* shape) const { return shapes.count(shape) > 0; };
+};
+
+mvROIScene::mvROIScene(mvShapeFactory* shapeFactory, mvLoadQueue* loadQueue,
+                       mvTextureCache* textureCache,
+                       mvShaderSet* shaders, const std::string& imageDir) :
+  _imageDir(imageDir), _created(0),
+  _shapeFactory(shapeFactory), _loadQueue(loadQueue),
+  _textureCache(textureCache), _shaders(shaders),
+  _pixelsPerRadian(0.0f), _minViewDistance(0.0f),
+  _filtering(false), _drawShapesChanged(false) {}
+
+mvROIScene::~mvROIScene() {
+
+  // The load queue deletes whatever it still has, a bit at a time.
+  _loadQueue->cancel(this);
+  for (std::vector<mvShape*>::iterator it = _shapes.begin();
+       it != _shapes.end(); it++) {
+    delete *it;
+  }
+}
+
+bool mvROIScene::findColumns(const mvROITable& rois, roiColumns& c) {
+
+  c.image = rois.findColumn("IMAGE");
+  c.x = rois.findColumn("X");
+  c.y = rois.findColumn("Y");
+  c.depth = rois.findColumn("DEPTH");
+  c.height = rois.findColumn("HEIGHT");
+  c.width = rois.findColumn("WIDTH");
+  if (c.image < 0 || c.x < 0 || c.y < 0 || c.depth < 0 ||
+      c.height < 0 || c.width < 0) {
+    std::cerr << "The ROIs need IMAGE, X, Y, DEPTH, HEIGHT and WIDTH."
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+MVec3 mvROIScene::roiPosition(size_t row) {
+  return MVec3(_rois.getFloat(_columns.x, row)/100.0,
+               _rois.getFloat(_columns.y, row)/100.0,
+               _rois.getFloat(_columns.depth, row)/(-5000.0));
+}
+
+MVec2 mvROIScene::roiSize(size_t row) {
+  return MVec2(_rois.getFloat(_columns.width, row)/100.0,
+               _rois.getFloat(_columns.height, row)/100.0);
+}
+
+int mvROIScene::maxPixels(float size) {
+
+  if (_pixelsPerRadian <= 0.0f || _minViewDistance <= 0.0f) return 0;
+
+  // The angle it takes up, seen straight on from as close as it gets.
+  // That's rounded up to a power of two, so that ROIs of a little
+  // different sizes that show the same file can share its texture.
+  float pixels = _pixelsPerRadian * 2.0f * atanf(0.5f * size / _minViewDistance);
+  int limit = 1;
+  while (limit < pixels && limit < (1 << 30)) limit *= 2;
+  return limit;
+}
+
+mvShape* mvROIScene::createShape(size_t row) {
+
+  // The image is read at no more than the size it can ever show at.
+  MVec2 size = roiSize(row);
+  mvDecodeOptions options = _textureCache->getDecodeOptions();
+  options.neededWidth = maxPixels(size.x);
+  options.neededHeight = maxPixels(size.y);
+
+  // Add the appropriate shader and texture to this object.  The
+  // image file is read later, by the load queue, with whichever
+  // decoder suits it.  An image already in use is not read again.
+  std::string fileName = _imageDir + "/" + _rois.getString(_columns.image, row);
+  mvTextureHandle tex = _textureCache->get(textureAuto, fileName, options);
+
+  // Create a rectangle with the new texture and our favorite shader.
+  mvShape* shape = _shapeFactory->createShape(shapeRECT, _shaders, tex.get());
+  shape->setID(row);
+
+  // Size the object and place it in the scene.
+  shape->setDimensions(size.x, size.y);
+  shape->setPosition(roiPosition(row));
+
+  _loadQueue->add(shape, this);
+  _pending.insert(shape);
+  return shape;
+}
+
+void mvROIScene::dropShape(mvShape* shape, std::set<mvShape*>& dropped) {
+
+  if (_pending.count(shape)) {
+    _cancelled.insert(shape);
+  } else {
+    dropped.insert(shape);
+  }
+}
+
+bool mvROIScene::update(const mvROITable& rois) {
+
+  std::vector<std::string> keys;
+  roiColumns columns;
+  if (!rois.getKeys(keys) || !findColumns(rois, columns)) return false;
+  bool first = _keys.empty();
+  _rois = rois;
+  _columns = columns;
+
+  std::map<std::string, mvShape*> shapesByKey;
+  std::vector<size_t> toCreate;
+  std::set<mvShape*> dropped;
+  int moved = 0, resized = 0;
+
+  for (size_t row = 0; row < _rois.getRowCount(); row++) {
+
+    mvShape* shape = NULL;
+    std::map<std::string, mvShape*>::iterator it = _shapesByKey.find(keys[row]);
+    if (it != _shapesByKey.end()) {
+      shape = it->second;
+      _shapesByKey.erase(it);
+    }
+
+    MVec2 size = roiSize(row);
+    if (shape && (((mvShapeRect*)shape)->getWidth() != size.x ||
+                  ((mvShapeRect*)shape)->getHeight() != size.y)) {
+      // A rectangle's vertices go to OpenGL when it's loaded, so a
+      // loaded one needs a new shape.
+      if (_pending.count(shape)) {
+        shape->setDimensions(size.x, size.y);
+      } else {
+        dropShape(shape, dropped);
+        shape = NULL;
+        resized++;
+      }
+    }
+
+    if (shape == NULL) {
+      toCreate.push_back(row);
+    } else {
+      MVec3 position = roiPosition(row);
+      if (shape->getPosition() != position) {
+        shape->setPosition(position);
+        moved++;
+      }
+      shape->setID(row);
+      shapesByKey[keys[row]] = shape;
+    }
+  }
+
+  // Whatever is left isn't in the report any more.
+  int removed = _shapesByKey.size();
+  for (std::map<std::string, mvShape*>::iterator it = _shapesByKey.begin();
+       it != _shapesByKey.end(); it++) {
+    dropShape(it->second, dropped);
+  }
+
+  _shapesByKey.swap(shapesByKey);
+  _keys.swap(keys);
+  _toCreate.swap(toCreate);
+  _created = 0;
+
+  if (!dropped.empty()) {
+    _shapes.erase(std::remove_if(_shapes.begin(), _shapes.end(), inSet(dropped)),
+                  _shapes.end());
+    for (std::set<mvShape*>::iterator it = dropped.begin();
+         it != dropped.end(); it++) {
+      delete *it;
+    }
+  }
+
+  // The filter's columns and rows are those of the old report.
+  evaluateFilter();
+
+  if (!first) {
+    std::cout << "Report changed: " << _toCreate.size() - resized << " added, "
+              << removed << " removed, " << moved << " moved, "
+              << resized << " resized." << std::endl;
+  }
+  return true;
+}
+
+double mvROIScene::step(double budgetMs) {
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // Make the shapes for new rows, a batch at a time.  Each one looks
+  // its image up in the texture cache, which goes to the file system,
+  // so a whole big report at once would be a long pause.
+  while (_created < _toCreate.size()) {
+    size_t last = std::min(_created + 64, _toCreate.size());
+    for (; _created < last; _created++) {
+      size_t row = _toCreate[_created];
+      _shapesByKey[_keys[row]] = createShape(row);
+    }
+    if (msSince(start) >= budgetMs) break;
+  }
+
+  // Bring in whatever shapes are ready, with the time that's left.
+  double remainingMs = budgetMs - msSince(start);
+  if (!_pending.empty() && remainingMs > 0.0) {
+    size_t first = _shapes.size();
+    std::vector<mvShape*> failed;
+    _loadQueue->step(remainingMs, _shapes, &failed, this);
+
+    // Shapes the report dropped while they were loading go now.
+    size_t kept = first;
+    for (size_t i = first; i < _shapes.size(); i++) {
+      mvShape* shape = _shapes[i];
+      _pending.erase(shape);
+      if (_cancelled.erase(shape)) {
+        delete shape;
+      } else {
+        _node.addShape(shape);
+        _shapes[kept++] = shape;
+      }
+    }
+    if (kept > first) _drawShapesChanged = true;
+    _shapes.resize(kept);
+
+    for (size_t i = 0; i < failed.size(); i++) {
+      mvShape* shape = failed[i];
+      _pending.erase(shape);
+      if (!_cancelled.erase(shape)) {
+        std::map<std::string, mvShape*>::iterator it =
+          _shapesByKey.find(_keys[shape->getID()]);
+        if (it != _shapesByKey.end() && it->second == shape)
+          _shapesByKey.erase(it);
+      }
+      delete shape;
+    }
+  }
+
+  if (_drawShapesChanged) selectDrawShapes();
+
+  return msSince(start);
+}
+
+bool mvROIScene::clear(double budgetMs) {
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  _drawShapes.clear();
+  _shapesByKey.clear();
+
+  // Nothing more is made or loaded.
+  _toCreate.clear();
+  _created = 0;
+  if (!_pending.empty()) {
+    _loadQueue->cancel(this);
+    _pending.clear();
+    _cancelled.clear();
+  }
+
+  while (!_shapes.empty()) {
+    delete _shapes.back();
+    _shapes.pop_back();
+    if ((_shapes.size() % 64) == 0 && msSince(start) >= budgetMs) break;
+  }
+
+  return _shapes.empty();
+}
+
+void mvROIScene::selectDrawShapes() {
+
+  bool filtering = _filtering && !_filter.isEmpty();
+  _drawShapes.clear();
+  for (size_t i = 0; i < _shapes.size(); i++) {
+    int row = _shapes[i]->getID();
+    if (!filtering || (row >= 0 && mvROIPassed(_passed, row)))
+      _drawShapes.push_back(_shapes[i]);
+  }
+  _drawShapesChanged = false;
+}
+
+const std::vector<mvShape*>& mvROIScene::getDrawShapes() {
+
+  if (_drawShapesChanged) selectDrawShapes();
+  return _drawShapes;
+}
+
+void mvROIScene::evaluateFilter() {
+
+  _filter.clear();
+  if (!_filterText.empty()) {
+    if (_filter.parse(_rois, _filterText) && !_filter.isEmpty()) {
+      _filter.evaluate(_rois, _passed);
+    } else {
+      _filter.clear();
+    }
+  }
+  _drawShapesChanged = true;
+}
+
+void mvROIScene::setFilter(const std::string& text, bool filtering) {
+
+  _filterText = text;
+  _filtering = filtering;
+  evaluateFilter();
+}
+
+void mvROIScene::setFiltering(bool filtering) {
+
+  _filtering = filtering;
+  _drawShapesChanged = true;
+}
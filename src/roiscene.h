@@ -0,0 +1,174 @@
+#ifndef ROISCENE_H
+#define ROISCENE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include "mvShape.h"
+#include "loadqueue.h"
+#include "scenegraph.h"
+#include "roitable.h"
+#include "texturecache.h"
+
+// The shapes for one report: an image for each ROI, hanging from a
+// node of their own.  There can be more than one of these at a time,
+// all loading through the one load queue.  While one is on display,
+// the next report in a sequence can be coming in behind it, and the
+// two swapped once it's all there (see tgm.cpp).
+//
+// update() gives the scene a report, the first time or any time after.
+// ROIs are matched up with the shapes already there by key (see
+// mvROITable::getKeys()).  New ones are loaded, ones that are gone
+// are deleted, and ones that have moved are moved.  A loaded ROI whose
+// size has changed gets a new shape.  Everything else is left alone,
+// OpenGL objects and all.
+//
+// Nothing much happens in update() itself.  Shapes are made, and
+// loaded, in step(), a few each frame, so that a big report doesn't
+// stop the display.  Textures come from a shared mvTextureCache, so an
+// image that another scene already shows isn't read again.
+//
+// Shapes have OpenGL objects, so a scene has to be deleted, and
+// stepped, on the thread with the OpenGL context.  Deleting one that's
+// still loading doesn't wait for the load queue: the shapes it still
+// has are left to mvLoadQueue::deleteCancelled().
+class mvROIScene {
+ private:
+
+  // The ROIs, with all their fields, and the directory their image
+  // files are in.
+  mvROITable _rois;
+  std::string _imageDir;
+
+  // The fields that place the images.
+  struct roiColumns {
+    int image, x, y, depth, height, width;
+  };
+  roiColumns _columns;
+  bool findColumns(const mvROITable& rois, roiColumns& c);
+
+  // Where an ROI goes, and how big it is, in scene units.
+  MVec3 roiPosition(size_t row);
+  MVec2 roiSize(size_t row);
+
+  // Every ROI shape made so far, loaded or still in the load queue, by
+  // its key.  _keys has the key of each row.
+  std::vector<std::string> _keys;
+  std::map<std::string, mvShape*> _shapesByKey;
+
+  // The rows that still need shapes, and how far step() has got
+  // through them.
+  std::vector<size_t> _toCreate;
+  size_t _created;
+
+  // The shapes in the load queue, and those of them that the report
+  // doesn't want any more.  Those are deleted when the queue is done
+  // with them.
+  std::set<mvShape*> _pending;
+  std::set<mvShape*> _cancelled;
+
+  // The shapes that are loaded, all of them hung from _node.
+  std::vector<mvShape*> _shapes;
+  mvTransformNode _node;
+
+  // Where the shapes come from, and how they're loaded.  These belong
+  // to the caller.
+  mvShapeFactory* _shapeFactory;
+  mvLoadQueue* _loadQueue;
+  mvTextureCache* _textureCache;
+  mvShaderSet* _shaders;
+
+  // The most pixels a radian of the view can cover on any display, and
+  // the closest anyone can get to an image.  Between them they say how
+  // big an ROI can ever look, and its image is shrunk to that when
+  // it's read.  Zero for either means full size.  See setTextureLimit().
+  float _pixelsPerRadian;
+  float _minViewDistance;
+
+  // The most pixels something size scene units long can ever cover.
+  // Zero if there's no limit.
+  int maxPixels(float size);
+
+  // Makes the shape for a row of _rois and starts it loading.
+  mvShape* createShape(size_t row);
+
+  // Takes a shape out of the scene, or, if it's still loading, marks
+  // it to be deleted when it's done.  Shapes that were in the scene
+  // are added to dropped, to be taken off _shapes and deleted all at
+  // once.
+  void dropShape(mvShape* shape, std::set<mvShape*>& dropped);
+
+  // Which ROIs to show.  Each shape's ID is its row in _rois, and
+  // _drawShapes holds the shapes whose rows passed, or all of them
+  // with the filter off.  It's rebuilt when the filter changes or
+  // shapes arrive; nothing is loaded again.
+  std::string _filterText;
+  mvROIFilter _filter;
+  bool _filtering;
+  std::vector<uint64_t> _passed;
+  std::vector<mvShape*> _drawShapes;
+  bool _drawShapesChanged;
+
+  void selectDrawShapes();
+
+  // Sets up _filter from _filterText for the current _rois, and works
+  // out which rows pass.  A filter that doesn't make sense does
+  // nothing.
+  void evaluateFilter();
+
+  // No copying; the scene owns its shapes.
+  mvROIScene(const mvROIScene&);
+  mvROIScene& operator=(const mvROIScene&);
+
+ public:
+  mvROIScene(mvShapeFactory* shapeFactory, mvLoadQueue* loadQueue,
+             mvTextureCache* textureCache, mvShaderSet* shaders,
+             const std::string& imageDir);
+  ~mvROIScene();
+
+  // Changes the scene to match the report.  Returns false, and leaves
+  // the scene as it was, if the report doesn't have the fields that
+  // place the images.
+  bool update(const mvROITable& rois);
+
+  // Limits the size of the images from here on to the most they can
+  // ever cover on the screen: pixelsPerRadian at the center of the
+  // sharpest display, with the viewer no nearer than minViewDistance
+  // scene units.  Zero for either turns the limit off.
+  void setTextureLimit(float pixelsPerRadian, float minViewDistance) {
+    _pixelsPerRadian = pixelsPerRadian;
+    _minViewDistance = minViewDistance;
+  };
+
+  // Call this once a frame.  It makes shapes and loads them until
+  // budgetMs milliseconds have gone by, and returns how long it took.
+  double step(double budgetMs);
+
+  // Whether every ROI's shape is loaded.
+  bool isLoaded() { return _created == _toCreate.size() && _pending.empty(); };
+
+  // Deletes loaded shapes until budgetMs milliseconds have gone by,
+  // so a big scene can be taken down over a few frames, and gives the
+  // ones still loading back to the load queue.  Returns true when
+  // they're all gone.  The scene draws nothing after this.
+  bool clear(double budgetMs);
+
+  // A filter like "ESD=100:400 CLASS=copepod,diatom" (see
+  // mvROIFilter::parse()), and whether to use it.
+  void setFilter(const std::string& text, bool filtering);
+  void setFiltering(bool filtering);
+  bool hasFilter() { return !_filter.isEmpty(); };
+
+  const mvROITable& getROIs() { return _rois; };
+  mvTransformNode* getNode() { return &_node; };
+
+  // The shapes that are loaded, and those of them to draw.
+  const std::vector<mvShape*>& getShapes() { return _shapes; };
+  const std::vector<mvShape*>& getDrawShapes();
+};
+
+#endif
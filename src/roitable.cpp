@@ -0,0 +1,326 @@
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <sstream>
+
+#include "roitable.h"
+#include "tinyxml2.h"
+
+// Whether the whole string reads as a number.
+static bool readFloat(const std::string& text, float& value) {
+
+  if (text.empty()) return false;
+  char* end;
+  value = strtof(text.c_str(), &end);
+  while (*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r') end++;
+  return *end == '\0';
+}
+
+bool mvROITable::load(const std::string& reportName) {
+
+  _columns.clear();
+  _rowCount = 0;
+
+  tinyxml2::XMLDocument doc;
+  if (doc.LoadFile(reportName.c_str()) != tinyxml2::XML_SUCCESS) {
+    std::cerr << reportName << ": " << doc.ErrorName() << std::endl;
+    return false;
+  }
+
+  tinyxml2::XMLElement* root = doc.FirstChildElement();
+  tinyxml2::XMLElement* data = root ? root->FirstChildElement("DATA") : NULL;
+  if (data == NULL) {
+    std::cerr << reportName << ": no DATA in the report." << std::endl;
+    return false;
+  }
+
+  // Gather the text of every field first, since we can't tell what
+  // type a column is until we've seen all of it.
+  std::map<std::string, int> columnNumbers;
+  std::vector<std::vector<std::string> > text;
+
+  for (tinyxml2::XMLElement* roi = data->FirstChildElement("ROI");
+       roi != NULL; roi = roi->NextSiblingElement("ROI")) {
+
+    for (tinyxml2::XMLElement* field = roi->FirstChildElement();
+         field != NULL; field = field->NextSiblingElement()) {
+
+      std::map<std::string, int>::iterator it = columnNumbers.find(field->Name());
+      int c;
+      if (it == columnNumbers.end()) {
+        c = text.size();
+        columnNumbers[field->Name()] = c;
+        text.push_back(std::vector<std::string>());
+        _columns.push_back(column());
+        _columns.back().name = field->Name();
+      } else {
+        c = it->second;
+      }
+
+      // A field we haven't seen in every ROI so far has gaps to fill.
+      text[c].resize(_rowCount);
+      text[c].push_back(field->GetText() ? field->GetText() : "");
+    }
+
+    _rowCount++;
+  }
+
+  for (size_t c = 0; c < _columns.size(); c++) {
+    column& col = _columns[c];
+    std::vector<std::string>& values = text[c];
+    values.resize(_rowCount);
+
+    col.type = roiFLOAT;
+    col.floats.resize(_rowCount);
+    bool any = false;
+    for (size_t row = 0; row < _rowCount; row++) {
+      if (values[row].empty()) {
+        col.floats[row] = std::numeric_limits<float>::quiet_NaN();
+      } else if (readFloat(values[row], col.floats[row])) {
+        any = true;
+      } else {
+        col.type = roiSTRING;
+        break;
+      }
+    }
+    // A column with no values at all might as well be strings.
+    if (!any) col.type = roiSTRING;
+
+    if (col.type == roiSTRING) {
+      std::vector<float>().swap(col.floats);
+      col.codes.resize(_rowCount);
+
+      std::map<std::string, uint32_t> codes;
+      for (size_t row = 0; row < _rowCount; row++) {
+        std::map<std::string, uint32_t>::iterator it = codes.find(values[row]);
+        if (it == codes.end()) {
+          it = codes.insert(std::make_pair(values[row],
+                                           (uint32_t)col.dictionary.size())).first;
+          col.dictionary.push_back(values[row]);
+        }
+        col.codes[row] = it->second;
+      }
+    }
+
+    std::vector<std::string>().swap(values);
+  }
+
+  return true;
+}
+
+int mvROITable::findColumn(const std::string& name) const {
+
+  for (size_t c = 0; c < _columns.size(); c++)
+    if (_columns[c].name == name) return c;
+  return -1;
+}
+
+const float* mvROITable::getFloats(int c) const {
+
+  if (_columns[c].type != roiFLOAT || _rowCount == 0) return NULL;
+  return &_columns[c].floats[0];
+}
+
+const uint32_t* mvROITable::getCodes(int c) const {
+
+  if (_columns[c].type != roiSTRING || _rowCount == 0) return NULL;
+  return &_columns[c].codes[0];
+}
+
+float mvROITable::getFloat(int c, size_t row) const {
+
+  const column& col = _columns[c];
+  if (col.type == roiFLOAT) return col.floats[row];
+  return strtof(col.dictionary[col.codes[row]].c_str(), NULL);
+}
+
+const std::string& mvROITable::getString(int c, size_t row) const {
+
+  static const std::string empty;
+  const column& col = _columns[c];
+  if (col.type == roiSTRING) return col.dictionary[col.codes[row]];
+  return empty;
+}
+
+int mvROITable::findCode(int c, const std::string& value) const {
+
+  const std::vector<std::string>& dictionary = _columns[c].dictionary;
+  for (size_t i = 0; i < dictionary.size(); i++)
+    if (dictionary[i] == value) return i;
+  return -1;
+}
+
+bool mvROITable::getKeys(std::vector<std::string>& keys) const {
+
+  keys.clear();
+  int image = findColumn("IMAGE");
+  if (image < 0) return false;
+
+  std::map<std::string, int> seen;
+  keys.reserve(_rowCount);
+  for (size_t row = 0; row < _rowCount; row++) {
+    const std::string& name = getString(image, row);
+    int n = ++seen[name];
+    if (n == 1) {
+      keys.push_back(name);
+    } else {
+      std::stringstream key;
+      key << name << "#" << n;
+      keys.push_back(key.str());
+    }
+  }
+  return true;
+}
+
+std::string mvROITable::print() const {
+
+  std::stringstream out;
+  out << _rowCount << " ROIs:";
+  for (size_t c = 0; c < _columns.size(); c++) {
+    out << " " << _columns[c].name;
+    if (_columns[c].type == roiSTRING)
+      out << "(" << _columns[c].dictionary.size() << " values)";
+  }
+  return out.str();
+}
+
+std::ostream & operator<<(std::ostream &os, const mvROITable& table) {
+  return os << table.print();
+}
+
+void mvROIFilter::addRange(int column, float low, float high) {
+
+  range r;
+  r.column = column;
+  r.low = low;
+  r.high = high;
+  _ranges.push_back(r);
+}
+
+void mvROIFilter::addMatch(const mvROITable& table, int column,
+                           const std::vector<std::string>& values) {
+
+  match m;
+  m.column = column;
+  m.allowed.assign(table.getDictionary(column).size(), 0);
+  for (size_t i = 0; i < values.size(); i++) {
+    int code = table.findCode(column, values[i]);
+    if (code >= 0) m.allowed[code] = 1;
+  }
+  _matches.push_back(m);
+}
+
+bool mvROIFilter::parse(const mvROITable& table, const std::string& text) {
+
+  std::stringstream in(text);
+  std::string test;
+  while (in >> test) {
+
+    size_t equals = test.find('=');
+    if (equals == std::string::npos) {
+      std::cerr << "Not a filter: " << test << std::endl;
+      return false;
+    }
+
+    std::string name = test.substr(0, equals);
+    std::string values = test.substr(equals + 1);
+    int c = table.findColumn(name);
+    if (c < 0) {
+      std::cerr << "No field called " << name << " to filter on." << std::endl;
+      return false;
+    }
+
+    if (table.getColumnType(c) == roiFLOAT) {
+      size_t colon = values.find(':');
+      if (colon == std::string::npos) {
+        std::cerr << name << " needs a range, like LOW:HIGH." << std::endl;
+        return false;
+      }
+
+      float low = -std::numeric_limits<float>::infinity();
+      float high = std::numeric_limits<float>::infinity();
+      std::string lowText = values.substr(0, colon);
+      std::string highText = values.substr(colon + 1);
+      if ((!lowText.empty() && !readFloat(lowText, low)) ||
+          (!highText.empty() && !readFloat(highText, high))) {
+        std::cerr << "Can't read the range for " << name << ": "
+                  << values << std::endl;
+        return false;
+      }
+      addRange(c, low, high);
+
+    } else {
+      std::vector<std::string> allowed;
+      std::stringstream list(values);
+      std::string value;
+      while (std::getline(list, value, ',')) allowed.push_back(value);
+      addMatch(table, c, allowed);
+    }
+  }
+
+  return true;
+}
+
+// Clears the bits of rows whose values aren't in [low, high].  The
+// comparisons are false for NaN, so those rows are cleared, too.
+static void andRange(const float* values, size_t count, float low, float high,
+                     uint64_t* bits) {
+
+  size_t row = 0;
+
+#ifdef __SSE2__
+  const __m128 lows = _mm_set1_ps(low);
+  const __m128 highs = _mm_set1_ps(high);
+  for (; row + 64 <= count; row += 64) {
+    uint64_t word = 0;
+    for (int i = 0; i < 64; i += 4) {
+      __m128 v = _mm_loadu_ps(values + row + i);
+      __m128 in = _mm_and_ps(_mm_cmpge_ps(v, lows), _mm_cmple_ps(v, highs));
+      word |= (uint64_t)_mm_movemask_ps(in) << i;
+    }
+    bits[row >> 6] &= word;
+  }
+#endif
+
+  for (; row < count; row++) {
+    if (!(values[row] >= low && values[row] <= high))
+      bits[row >> 6] &= ~((uint64_t)1 << (row & 63));
+  }
+}
+
+// Clears the bits of rows whose codes aren't allowed.
+static void andMatch(const uint32_t* codes, size_t count,
+                     const std::vector<char>& allowed, uint64_t* bits) {
+
+  for (size_t row = 0; row < count; row += 64) {
+    size_t last = (row + 64 < count) ? row + 64 : count;
+    uint64_t word = 0;
+    for (size_t i = row; i < last; i++)
+      word |= (uint64_t)allowed[codes[i]] << (i - row);
+    bits[row >> 6] &= word;
+  }
+}
+
+void mvROIFilter::evaluate(const mvROITable& table,
+                           std::vector<uint64_t>& bits) const {
+
+  size_t count = table.getRowCount();
+  bits.assign((count + 63) / 64, ~(uint64_t)0);
+  if (count == 0) return;
+
+  // Clear the bits past the last row, so the words can be counted.
+  if (count % 64) bits.back() = ((uint64_t)1 << (count % 64)) - 1;
+
+  for (size_t i = 0; i < _ranges.size(); i++)
+    andRange(table.getFloats(_ranges[i].column), count,
+             _ranges[i].low, _ranges[i].high, &bits[0]);
+
+  for (size_t i = 0; i < _matches.size(); i++)
+    andMatch(table.getCodes(_matches[i].column), count,
+             _matches[i].allowed, &bits[0]);
+}
@@ -0,0 +1,134 @@
+#ifndef ROITABLE_H
+#define ROITABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// What's in a column of an mvROITable.
+typedef enum {
+  roiFLOAT = 0,
+  roiSTRING = 1
+} mvROIColumnType;
+
+// Everything a report says about its ROIs, a column per field.  The
+// report has an <ROI> element for each image, with a child element
+// for each field: IMAGE, X, Y, DEPTH, HEIGHT and WIDTH, which place
+// the image, and any number of others, like sizes and classifier
+// results, that are there to be filtered on (see mvROIFilter).
+//
+// A field whose values all read as numbers is kept as an array of
+// floats, with NaN where an ROI doesn't have it.  Any other field is
+// kept as an array of codes into a dictionary of the different values
+// it has, so a field like a class name, with a few values repeated
+// many times, takes four bytes an ROI, and testing it is a matter of
+// comparing integers.  A missing value is the empty string.
+//
+// Row i is the i-th <ROI> in the report.
+class mvROITable {
+ private:
+  struct column {
+    std::string name;
+    mvROIColumnType type;
+    std::vector<float> floats;
+    std::vector<uint32_t> codes;
+    std::vector<std::string> dictionary;
+  };
+  std::vector<column> _columns;
+  size_t _rowCount;
+
+  std::string print() const;
+  friend std::ostream & operator<<(std::ostream &os, const mvROITable& table);
+
+ public:
+  mvROITable() : _rowCount(0) {};
+
+  // Reads the <ROI> elements of a report.  Returns false, with a
+  // message, if the report can't be read.
+  bool load(const std::string& reportName);
+
+  size_t getRowCount() const { return _rowCount; };
+  int getColumnCount() const { return _columns.size(); };
+
+  // Returns -1 if there's no such field.
+  int findColumn(const std::string& name) const;
+
+  const std::string& getColumnName(int c) const { return _columns[c].name; };
+  mvROIColumnType getColumnType(int c) const { return _columns[c].type; };
+
+  // The whole column, for a column of that type, or NULL.
+  const float* getFloats(int c) const;
+  const uint32_t* getCodes(int c) const;
+  const std::vector<std::string>& getDictionary(int c) const {
+    return _columns[c].dictionary;
+  };
+
+  // One value, of either type of column.  A float column gives the
+  // float, or NaN; a string column gives the string read as a number.
+  float getFloat(int c, size_t row) const;
+  // A float column gives the empty string.
+  const std::string& getString(int c, size_t row) const;
+
+  // The code for a value in a string column, or -1 if no ROI has it.
+  int findCode(int c, const std::string& value) const;
+
+  // A name for each row that stays the same when the report is
+  // rewritten: its IMAGE, with "#2", "#3" and so on added for the
+  // second and later ROIs with the same image.  Returns false if
+  // there's no IMAGE field.
+  bool getKeys(std::vector<std::string>& keys) const;
+};
+
+// Picks out ROIs by the values of their fields, so that the display
+// can show only some of them.  A filter is a list of tests, and an ROI
+// passes if it passes all of them.  A test is either a range of
+// values, for a float column, or a set of values, for a string column.
+//
+// evaluate() runs the tests over whole columns and gives the answer
+// as a bitset, one bit per row.  With SSE2, the range tests do four
+// rows at a time.
+class mvROIFilter {
+ private:
+  struct range {
+    int column;
+    float low, high;
+  };
+  std::vector<range> _ranges;
+
+  // For each string column tested, whether each code is allowed.
+  struct match {
+    int column;
+    std::vector<char> allowed;
+  };
+  std::vector<match> _matches;
+
+ public:
+  void clear() { _ranges.clear(); _matches.clear(); };
+  bool isEmpty() const { return _ranges.empty() && _matches.empty(); };
+
+  // Rows with low <= value <= high pass.  A NaN value doesn't.
+  void addRange(int column, float low, float high);
+
+  // Rows with any of the given values pass.
+  void addMatch(const mvROITable& table, int column,
+                const std::vector<std::string>& values);
+
+  // Adds tests from a string like "ESD=100:400 CLASS=copepod,diatom".
+  // Each test is FIELD=LOW:HIGH, for a float column, where either end
+  // may be left off, or FIELD=VALUE,VALUE,..., for a string column.
+  // Returns false, with a message, if a test can't be understood.
+  bool parse(const mvROITable& table, const std::string& text);
+
+  // Sets bit (row % 64) of bits[row / 64] for each row that passes,
+  // and clears the others.
+  void evaluate(const mvROITable& table, std::vector<uint64_t>& bits) const;
+};
+
+// Whether a row passed, in the bits from mvROIFilter::evaluate().
+inline bool mvROIPassed(const std::vector<uint64_t>& bits, size_t row) {
+  return (bits[row >> 6] >> (row & 63)) & 1;
+}
+
+#endif
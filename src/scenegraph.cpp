@@ -0,0 +1,129 @@
+#include <algorithm>
+
+#include "scenegraph.h"
+#include "mvShape.h"
+
+mvTransformNode::mvTransformNode() :
+  _parent(NULL), _parentIndex(0),
+  _position(0.0f, 0.0f, 0.0f), _scale(1.0f, 1.0f, 1.0f),
+  _worldMatrix(1.0f), _moved(false), _changedBelow(false) {}
+
+mvTransformNode::~mvTransformNode() {
+
+  if (_parent) _parent->removeChild(this);
+
+  for (size_t i = 0; i < _children.size(); i++) {
+    _children[i]->_parent = NULL;
+    _children[i]->moved();
+  }
+  for (size_t i = 0; i < _shapes.size(); i++) {
+    _shapes[i]->_node = NULL;
+    _shapes[i]->_worldMatrixNeedsReset = true;
+    _shapes[i]->boundsChanged();
+  }
+}
+
+void mvTransformNode::markChangedBelow() {
+
+  // Stop at the first node that already knows.
+  for (mvTransformNode* node = this; node && !node->_changedBelow;
+       node = node->_parent) {
+    node->_changedBelow = true;
+  }
+}
+
+void mvTransformNode::moved() {
+
+  _moved = true;
+  markChangedBelow();
+}
+
+void mvTransformNode::addChild(mvTransformNode* child) {
+
+  if (child->_parent) child->_parent->removeChild(child);
+
+  child->_parent = this;
+  child->_parentIndex = _children.size();
+  _children.push_back(child);
+  child->moved();
+}
+
+void mvTransformNode::removeChild(mvTransformNode* child) {
+
+  if (child->_parent != this) return;
+
+  // Swap the last one into its place, so this takes the same time
+  // however many children there are.
+  size_t i = child->_parentIndex;
+  _children[i] = _children.back();
+  _children[i]->_parentIndex = i;
+  _children.pop_back();
+
+  child->_parent = NULL;
+  child->moved();
+}
+
+void mvTransformNode::addShape(mvShape* shape) {
+
+  if (shape->_node) shape->_node->removeShape(shape);
+
+  shape->_node = this;
+  shape->_nodeIndex = _shapes.size();
+  _shapes.push_back(shape);
+  shape->_worldMatrixNeedsReset = true;
+  shape->boundsChanged();
+  markChangedBelow();
+}
+
+void mvTransformNode::removeShape(mvShape* shape) {
+
+  if (shape->_node != this) return;
+
+  size_t i = shape->_nodeIndex;
+  _shapes[i] = _shapes.back();
+  _shapes[i]->_nodeIndex = i;
+  _shapes.pop_back();
+
+  shape->_node = NULL;
+  shape->_worldMatrixNeedsReset = true;
+  shape->boundsChanged();
+}
+
+MMat4 mvTransformNode::getLocalMatrix() {
+
+  return glm::translate(MMat4(1.0f), _position) *
+    glm::mat4_cast(_rotQuaternion) * glm::scale(MMat4(1.0f), _scale);
+}
+
+void mvTransformNode::update() {
+
+  updateBranch(false);
+}
+
+void mvTransformNode::updateBranch(bool parentMoved) {
+
+  if (!parentMoved && !_moved && !_changedBelow) return;
+
+  bool moved = parentMoved || _moved;
+  if (moved) {
+    _worldMatrix = _parent ?
+      _parent->_worldMatrix * getLocalMatrix() : getLocalMatrix();
+  }
+
+  // If this node moved, every shape on it has to be redone.
+  // Otherwise, only the ones that moved themselves.
+  for (size_t i = 0; i < _shapes.size(); i++) {
+    mvShape* shape = _shapes[i];
+    if (moved || shape->_worldMatrixNeedsReset) {
+      shape->_worldMatrix = _worldMatrix * shape->getModelMatrix();
+      shape->_worldMatrixNeedsReset = false;
+      if (moved) shape->boundsChanged();
+    }
+  }
+
+  for (size_t i = 0; i < _children.size(); i++)
+    _children[i]->updateBranch(moved);
+
+  _moved = false;
+  _changedBelow = false;
+}
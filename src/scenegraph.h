@@ -0,0 +1,100 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "vecTypes.h"
+
+class mvShape;
+
+// A node in a tree of transforms, so that a group of shapes can be
+// moved, turned or scaled together by changing one node instead of
+// every shape in it.  A node has its own position, rotation and scale,
+// relative to its parent, and any number of child nodes and shapes
+// hanging from it.  A shape's world matrix is its node's world matrix
+// times the shape's own model matrix (see mvShape::getWorldMatrix()).
+//
+// Changing a node doesn't recompute anything right away.  It marks the
+// node as moved, and each node above it as having something moved
+// below.  Once a frame, before anything asks for a world matrix, call
+// update() on the root, which goes down only the marked branches and
+// recomputes the world matrices of the nodes that moved and of all the
+// shapes under them, in one pass.  A shape that moves by itself is
+// handled the same way, without touching the rest of its node.
+//
+// Nodes don't own their children or their shapes.  Deleting a node
+// takes it out of its parent, and leaves its children and shapes
+// without a parent; deleting a shape takes it out of its node.
+class mvTransformNode {
+ private:
+  mvTransformNode* _parent;
+  size_t _parentIndex;
+  std::vector<mvTransformNode*> _children;
+  std::vector<mvShape*> _shapes;
+
+  MVec3 _position;
+  MVec3 _scale;
+  MQuat _rotQuaternion;
+
+  MMat4 _worldMatrix;
+
+  // This node's transform has changed since the last update().
+  bool _moved;
+  // Something below this node, a child node or a shape, has changed.
+  bool _changedBelow;
+
+  void markChangedBelow();
+  void updateBranch(bool parentMoved);
+
+  // No copying; the nodes point to each other.
+  mvTransformNode(const mvTransformNode&);
+  mvTransformNode& operator=(const mvTransformNode&);
+
+  // Shapes tell their node when they move, or go away.
+  friend class mvShape;
+  void shapeMoved() { markChangedBelow(); };
+
+ public:
+  mvTransformNode();
+  ~mvTransformNode();
+
+  // Hanging a node or shape here takes it off wherever it was.
+  void addChild(mvTransformNode* child);
+  void removeChild(mvTransformNode* child);
+  void addShape(mvShape* shape);
+  void removeShape(mvShape* shape);
+
+  mvTransformNode* getParent() { return _parent; };
+  const std::vector<mvTransformNode*>& getChildren() { return _children; };
+  const std::vector<mvShape*>& getShapes() { return _shapes; };
+
+  void setPosition(MVec3 position) { _position = position; moved(); };
+  void setPosition(float x, float y, float z) {
+    setPosition(MVec3(x, y, z));
+  };
+  void setScale(MVec3 scale) { _scale = scale; moved(); };
+  void setRotation(MQuat rotQuaternion) {
+    _rotQuaternion = rotQuaternion;
+    moved();
+  };
+
+  MVec3 getPosition() { return _position; };
+  MVec3 getScale() { return _scale; };
+  MQuat getRotQuaternion() { return _rotQuaternion; };
+
+  // Marks the node as moved.  The setters do this.
+  void moved();
+
+  // The transform relative to the parent.
+  MMat4 getLocalMatrix();
+
+  // As of the last update().
+  const MMat4& getWorldMatrix() { return _worldMatrix; };
+
+  // Brings the world matrices of everything below up to date.  Call
+  // it on the root.
+  void update();
+};
+
+#endif
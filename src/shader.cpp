@@ -1,4 +1,9 @@
 #include "shader.h"
+#include "meshindexer.h"
+#include "lightclusters.h"
+
+#include <glm/gtc/packing.hpp>
+#include <math.h>
 
 void mvLights::load(GLuint programID) {
 
@@ -16,8 +21,35 @@ void mvLights::load(GLuint programID) {
 void mvLights::draw(GLuint programID) {
 
   glUseProgram(programID);
-  glUniform3fv(_lightPositionID, 2, &_positions[0].x);
-  glUniform3fv(_lightColorID, 2, &_colors[0].x);
+  if (_positions.empty()) return;
+  glUniform3fv(_lightPositionID, _positions.size(), &_positions[0].x);
+  glUniform3fv(_lightColorID, _colors.size(), &_colors[0].x);
+}
+
+void mvLights::shadeFlat(const MVec3& position, const MVec3& normal,
+                         const MVec3& eye, MVec3& light, MVec3& specular) {
+
+  // The constants are the ones in PlanktonShading.fragmentshader.
+  const float ambientCoefficient = 0.6f;
+
+  light = MVec3(0.0f, 0.0f, 0.0f);
+  specular = MVec3(0.0f, 0.0f, 0.0f);
+  MVec3 eyeDir = glm::normalize(eye - position);
+
+  for (size_t i = 0; i < _positions.size(); i++) {
+    MVec3 toLight = _positions[i] - position;
+    float distanceToLight = glm::length(toLight);
+    MVec3 lightDir = toLight / std::max(distanceToLight, 1e-6f);
+
+    float cosAngleFromNormal =
+      glm::clamp(glm::dot(normal, lightDir), 0.0f, 1.0f);
+    MVec3 reflectDir = glm::reflect(-lightDir, normal);
+    float cosAlpha = glm::clamp(glm::dot(eyeDir, reflectDir), 0.0f, 1.0f);
+    float attenuation = 1.0f / (1.0f + 0.01f * distanceToLight * distanceToLight);
+
+    light += _colors[i] * (ambientCoefficient + attenuation * cosAngleFromNormal);
+    specular += _colors[i] * (attenuation * powf(cosAlpha, 5.0f));
+  }
 }
 
 // Create a shader and compile it with the OpenGL tools.  This is the
@@ -114,12 +146,15 @@ mvShader::mvShader(mvShaderType type, const std::string fileName, int numLights)
     throw std::runtime_error("Cannot open: " + fileName);
   }
 
-  // Edit the shader source to reflect the input number of lights.  If
-  // there is no 'XX' in the shader code, this will cause an ugly
-  // error.
-  char numLightsAsString[5];
+  // Edit the shader source to reflect the input number of lights.  A
+  // shader that takes the number at run time, like ClusteredShading,
+  // has no 'XX', and is left alone.
+  char numLightsAsString[12];
   sprintf(numLightsAsString, "%d", numLights);
-  _shaderCode.replace(_shaderCode.find("XX"), 2, numLightsAsString);
+  size_t numLightsAt = _shaderCode.find("XX");
+  if (numLightsAt != std::string::npos) {
+    _shaderCode.replace(numLightsAt, 2, numLightsAsString);
+  }
 
   char const * sourcePtr = _shaderCode.c_str();
   _shaderID = init(_shaderType, &sourcePtr );
@@ -136,7 +171,9 @@ mvShader::~mvShader() {
   glDeleteShader(_shaderID);
 }
 
-mvShaderSet::mvShaderSet() : _lightsLoaded(false) {
+mvShaderSet::mvShaderSet() :
+  _lightClusters(NULL), _lightsLoaded(false), _flatLighting(false),
+  _unkeyedShaders(NULL) {
 
   // This is sort of hacky, but these two variables are here so that
   // the default constructor for this class provides a trivial shader,
@@ -184,7 +221,8 @@ mvShaderSet::mvShaderSet(const std::string vertShader,
                          const std::string geomShader,
                          const std::string fragShader,
                          mvLights* lights) :
-  _lights(lights), _lightsLoaded(false)  {
+  _lights(lights), _lightClusters(NULL), _lightsLoaded(false),
+  _flatLighting(false), _unkeyedShaders(NULL)  {
 
   // Clear OpenGL errors
   glGetError();
@@ -268,12 +306,14 @@ void mvShaderSet::attachAndLinkShaders() {
 void mvShaderSet::load() {
   if (!_lightsLoaded) {
     _lights->load(_programID);
+    if (_lightClusters) _lightClusters->load(_programID);
     _lightsLoaded = true;
   }
 }
 
 void mvShaderSet::draw() {
-  _lights->draw(_programID);
+  // Clustered lights are set up once a view, by their update().
+  if (!_lightClusters) _lights->draw(_programID);
 }
 
 void mvShaderContext::load(const std::vector<MVec3> &vertices,
@@ -281,11 +321,54 @@ void mvShaderContext::load(const std::vector<MVec3> &vertices,
                            const std::vector<MVec3> &normals,
                            const std::vector<MVec3> &colors) {
 
-  _vertexBufferSize = vertices.size();
+  load(vertices.empty() ? NULL : &vertices[0],
+       uvs.empty() ? NULL : &uvs[0],
+       normals.empty() ? NULL : &normals[0],
+       vertices.size());
+}
+
+void mvShaderContext::load(const std::vector<MVec3> &vertices,
+                           const std::vector<MVec2> &uvs,
+                           const std::vector<MVec3> &normals,
+                           const std::vector<MVec3> &colors,
+                           const std::vector<uint32_t> &indices) {
+
+  if (indices.empty()) {
+    load(vertices, uvs, normals, colors);
+
+  } else if (!needsWideIndices(vertices.size())) {
+    // Half the size, and that much less index traffic every frame.
+    std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+    load(&vertices[0], &uvs[0], &normals[0], vertices.size(),
+         &shortIndices[0], shortIndices.size(), GL_UNSIGNED_SHORT);
+
+  } else {
+    load(&vertices[0], &uvs[0], &normals[0], vertices.size(),
+         &indices[0], indices.size(), GL_UNSIGNED_INT);
+  }
+}
+
+void mvShaderContext::load(const MVec3* vertices,
+                           const MVec2* uvs,
+                           const MVec3* normals,
+                           int nVertices,
+                           const void* indices,
+                           int nIndices,
+                           GLenum indexType) {
+
+  _vertexBufferSize = nVertices;
+
+  // A texture that was meant to be keyed but couldn't be, like a DDS
+  // image, has to be drawn by a shader that finds its background
+  // itself.
+  if (_texture.get() && _shaderSet->getUnkeyedShaders()) {
+    _texture->decode();
+    if (!_texture->isKeyed()) _shaderSet = _shaderSet->getUnkeyedShaders();
+  }
 
   GLuint programID = _shaderSet->getProgramID();
 
-  _texture->load(programID);
+  if (_texture.get()) _texture->load(programID);
   _shaderSet->load();
   
     // Arrange the data for the shaders to work on.  "Uniforms" first.
@@ -294,26 +377,60 @@ void mvShaderContext::load(const std::vector<MVec3> &vertices,
   _modelMatrixID = glGetUniformLocation(programID, _modelMatrixName.c_str());
   _inverseModelMatrixID = glGetUniformLocation(programID,
                                                _inverseModelMatrixName.c_str());
+  if (_shaderSet->getFlatLighting()) {
+    _shapeLightID = glGetUniformLocation(programID, "mvShapeLight");
+    _shapeSpecularID = glGetUniformLocation(programID, "mvShapeSpecular");
+  }
 
   // Now the vertex data.
   glGenVertexArrays(1, &_arrayID);
   glBindVertexArray(_arrayID);
 
-  // Load it into a VBO
-  glGenBuffers(1, &_vertexBufferID);
-  glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferID);
-  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(MVec3),
-               &vertices[0], GL_STATIC_DRAW);
+  if (_vertexLayout == vertexSEPARATE) {
+
+    // Load it into a VBO
+    glGenBuffers(1, &_vertexBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferID);
+    mvGPUMemory::bufferData(gpuMESH, _gpuBytes,
+                            GL_ARRAY_BUFFER, nVertices * sizeof(MVec3),
+                            vertices, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &_uvBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _uvBufferID);
+    mvGPUMemory::bufferData(gpuMESH, _gpuBytes,
+                            GL_ARRAY_BUFFER, nVertices * sizeof(MVec2),
+                            uvs, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &_normalBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+    mvGPUMemory::bufferData(gpuMESH, _gpuBytes,
+                            GL_ARRAY_BUFFER, nVertices * sizeof(MVec3),
+                            normals, GL_STATIC_DRAW);
+
+  } else {
+
+    // Everything goes into one buffer.
+    std::vector<unsigned char> packed;
+    packVertices(vertices, uvs, normals, nVertices, packed);
 
-  glGenBuffers(1, &_uvBufferID);
-  glBindBuffer(GL_ARRAY_BUFFER, _uvBufferID);
-  glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(MVec2),
-               &uvs[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &_vertexBufferID);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferID);
+    mvGPUMemory::bufferData(gpuMESH, _gpuBytes,
+                            GL_ARRAY_BUFFER, packed.size(),
+                            packed.empty() ? NULL : &packed[0], GL_STATIC_DRAW);
+  }
 
-  glGenBuffers(1, &_normalBufferID);
-  glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
-  glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(MVec3),
-               &normals[0], GL_STATIC_DRAW);
+  _indexCount = (indices == NULL) ? 0 : nIndices;
+  if (_indexCount > 0) {
+    _indexType = indexType;
+    glGenBuffers(1, &_indexBufferID);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBufferID);
+    mvGPUMemory::bufferData(gpuMESH, _gpuBytes,
+                            GL_ELEMENT_ARRAY_BUFFER, _indexCount *
+                            ((_indexType == GL_UNSIGNED_SHORT) ?
+                             sizeof(GLushort) : sizeof(GLuint)),
+                            indices, GL_STATIC_DRAW);
+  }
 
   // Get handles for the various shader inputs.
   _vertexAttribID = glGetAttribLocation(programID, _vertexAttribName.c_str());
@@ -322,6 +439,98 @@ void mvShaderContext::load(const std::vector<MVec3> &vertices,
 
 };
 
+void mvShaderContext::setVertexLayout(mvVertexLayout layout) {
+
+  _vertexLayout = layout;
+  _positionTransform = MMat4(1.0f);
+
+  switch (layout) {
+  case vertexSEPARATE:
+    _positionFormat = mvAttribFormat(3, GL_FLOAT, GL_FALSE, 0, 0);
+    _uvFormat       = mvAttribFormat(2, GL_FLOAT, GL_FALSE, 0, 0);
+    _normalFormat   = mvAttribFormat(3, GL_FLOAT, GL_FALSE, 0, 0);
+    break;
+
+  case vertexINTERLEAVED:
+    _positionFormat = mvAttribFormat(3, GL_FLOAT, GL_FALSE, 32, 0);
+    _uvFormat       = mvAttribFormat(2, GL_FLOAT, GL_FALSE, 32, 12);
+    _normalFormat   = mvAttribFormat(3, GL_FLOAT, GL_FALSE, 32, 20);
+    break;
+
+  case vertexPACKED:
+    _positionFormat = mvAttribFormat(3, GL_FLOAT, GL_FALSE, 20, 0);
+    _uvFormat       = mvAttribFormat(2, GL_HALF_FLOAT, GL_FALSE, 20, 12);
+    _normalFormat   = mvAttribFormat(4, GL_INT_2_10_10_10_REV, GL_TRUE, 20, 16);
+    break;
+
+  case vertexQUANTIZED:
+    // The position is padded out to four shorts to keep the rest of
+    // the vertex 4-byte aligned.
+    _positionFormat = mvAttribFormat(3, GL_UNSIGNED_SHORT, GL_TRUE, 16, 0);
+    _uvFormat       = mvAttribFormat(2, GL_HALF_FLOAT, GL_FALSE, 16, 8);
+    _normalFormat   = mvAttribFormat(4, GL_INT_2_10_10_10_REV, GL_TRUE, 16, 12);
+    break;
+
+  default:
+    throw std::runtime_error("What vertex layout is this?");
+  }
+}
+
+void mvShaderContext::packVertices(const MVec3* vertices,
+                                   const MVec2* uvs,
+                                   const MVec3* normals,
+                                   int nVertices,
+                                   std::vector<unsigned char> &out) {
+
+  GLsizei stride = _positionFormat.stride;
+  out.assign((size_t)nVertices * stride, 0);
+
+  // For quantized positions, find the box they fit in and the matrix
+  // that undoes the quantization.
+  MVec3 lo(0.0f), extent(1.0f);
+  if ((_vertexLayout == vertexQUANTIZED) && (nVertices > 0)) {
+    MVec3 hi = lo = vertices[0];
+    for (int i = 1; i < nVertices; i++) {
+      lo = glm::min(lo, vertices[i]);
+      hi = glm::max(hi, vertices[i]);
+    }
+    extent = hi - lo;
+    // Don't divide by zero on a flat mesh.
+    for (int k = 0; k < 3; k++) if (extent[k] <= 0.0f) extent[k] = 1.0f;
+
+    _positionTransform = glm::scale(glm::translate(MMat4(1.0f), lo), extent);
+  }
+
+  for (int i = 0; i < nVertices; i++) {
+
+    unsigned char* v = &out[(size_t)i * stride];
+
+    if (_vertexLayout == vertexQUANTIZED) {
+      MVec3 q = (vertices[i] - lo) / extent;
+      GLushort p[4];
+      for (int k = 0; k < 3; k++)
+        p[k] = (GLushort)(glm::clamp(q[k], 0.0f, 1.0f) * 65535.0f + 0.5f);
+      p[3] = 0;
+      memcpy(v + _positionFormat.offset, p, sizeof(p));
+    } else {
+      memcpy(v + _positionFormat.offset, &vertices[i], sizeof(MVec3));
+    }
+
+    MVec2 uv = uvs ? uvs[i] : MVec2(0.0f, 0.0f);
+    MVec3 n = normals ? normals[i] : MVec3(0.0f, 0.0f, 1.0f);
+
+    if (_vertexLayout == vertexINTERLEAVED) {
+      memcpy(v + _uvFormat.offset, &uv, sizeof(MVec2));
+      memcpy(v + _normalFormat.offset, &n, sizeof(MVec3));
+    } else {
+      GLuint halfUV = glm::packHalf2x16(uv);
+      GLuint packedNormal = glm::packSnorm3x10_1x2(MVec4(n, 0.0f));
+      memcpy(v + _uvFormat.offset, &halfUV, sizeof(GLuint));
+      memcpy(v + _normalFormat.offset, &packedNormal, sizeof(GLuint));
+    }
+  }
+}
+
 void mvShaderContext::draw(const MMat4 &modelMatrix,
                            const MMat4 &viewMatrix,
                            const MMat4 &projectionMatrix) {
@@ -331,15 +540,26 @@ void mvShaderContext::draw(const MMat4 &modelMatrix,
   // Use our shader set.
   glUseProgram(programID);
 
-  _texture->draw(programID);
+  if (_texture.get()) _texture->draw(programID);
   _shaderSet->draw();
   
   // Send our transformation to the currently bound shader.
   glUniformMatrix4fv(_projMatrixID, 1, GL_FALSE, &projectionMatrix[0][0]);
   glUniformMatrix4fv(_viewMatrixID, 1, GL_FALSE, &viewMatrix[0][0]);
-  glUniformMatrix4fv(_modelMatrixID, 1, GL_FALSE, &modelMatrix[0][0]);
-  MMat4 invM = glm::transpose(glm::inverse(modelMatrix));
-  glUniformMatrix4fv(_inverseModelMatrixID, 1, GL_FALSE, &invM[0][0]);
+  // The stored positions may need unpacking on the way into model
+  // space.  The normals don't, so the inverse is of the plain matrix.
+  MMat4 positionMatrix = modelMatrix * _positionTransform;
+  glUniformMatrix4fv(_modelMatrixID, 1, GL_FALSE, &positionMatrix[0][0]);
+  // Shaders without normals, like FlatShading, don't want the inverse,
+  // and it's not cheap.
+  if (_inverseModelMatrixID != (GLuint)-1) {
+    MMat4 invM = glm::transpose(glm::inverse(modelMatrix));
+    glUniformMatrix4fv(_inverseModelMatrixID, 1, GL_FALSE, &invM[0][0]);
+  }
+  if (_shapeLightID >= 0) {
+    glUniform3fv(_shapeLightID, 1, &_shapeLight.x);
+    glUniform3fv(_shapeSpecularID, 1, &_shapeSpecular.x);
+  }
   
   // GLint countt;
   // glGetProgramiv(_shaders->getProgramID(), GL_ACTIVE_UNIFORMS, &countt);
@@ -349,43 +569,56 @@ void mvShaderContext::draw(const MMat4 &modelMatrix,
   glEnableVertexAttribArray(_vertexAttribID);
   glBindBuffer(GL_ARRAY_BUFFER, _vertexBufferID);
   glVertexAttribPointer(
-                        _vertexAttribID,    // attribute
-                        3,                  // size
-                        GL_FLOAT,           // type
-                        GL_FALSE,           // normalized?
-                        0,                  // stride
-                        (void*)0            // array buffer offset
+                        _vertexAttribID,              // attribute
+                        _positionFormat.size,         // size
+                        _positionFormat.type,         // type
+                        _positionFormat.normalized,   // normalized?
+                        _positionFormat.stride,       // stride
+                        (void*)_positionFormat.offset // array buffer offset
                         );
 
   // 2nd attribute buffer : UVs
   glEnableVertexAttribArray(_uvAttribID);
-  glBindBuffer(GL_ARRAY_BUFFER, _uvBufferID);
+  if (_vertexLayout == vertexSEPARATE)
+    glBindBuffer(GL_ARRAY_BUFFER, _uvBufferID);
   glVertexAttribPointer(
-                        _uvAttribID,        // attribute
-                        2,                  // size
-                        GL_FLOAT,           // type
-                        GL_FALSE,           // normalized?
-                        0,                  // stride
-                        (void*)0            // array buffer offset
+                        _uvAttribID,                  // attribute
+                        _uvFormat.size,               // size
+                        _uvFormat.type,               // type
+                        _uvFormat.normalized,         // normalized?
+                        _uvFormat.stride,             // stride
+                        (void*)_uvFormat.offset       // array buffer offset
                         );
 
-  // 3rd attribute buffer : normals
-  glEnableVertexAttribArray(_normalAttribID);
-  glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
-  glVertexAttribPointer(
-                        _normalAttribID,    // attribute
-                        3,                  // size
-                        GL_FLOAT,           // type
-                        GL_FALSE,           // normalized?
-                        0,                  // stride
-                        (void*)0            // array buffer offset
-                        );
+  // 3rd attribute buffer : normals, unless the shaders light the
+  // shape without them.
+  if (_normalAttribID != (GLuint)-1) {
+    glEnableVertexAttribArray(_normalAttribID);
+    if (_vertexLayout == vertexSEPARATE)
+      glBindBuffer(GL_ARRAY_BUFFER, _normalBufferID);
+    glVertexAttribPointer(
+                          _normalAttribID,              // attribute
+                          _normalFormat.size,           // size
+                          _normalFormat.type,           // type
+                          _normalFormat.normalized,     // normalized?
+                          _normalFormat.stride,         // stride
+                          (void*)_normalFormat.offset   // array buffer offset
+                          );
+  }
 
   // Draw the triangles !
-  glDrawArrays(_mode, 0, _vertexBufferSize );
+  if (_indexCount > 0) {
+    int count = (_drawCount < 0) ? (_indexCount - _drawFirst) : _drawCount;
+    size_t indexSize = (_indexType == GL_UNSIGNED_SHORT) ?
+      sizeof(GLushort) : sizeof(GLuint);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBufferID);
+    glDrawElements(_mode, count, _indexType, (void*)(_drawFirst * indexSize));
+  } else {
+    glDrawArrays(_mode, 0, _vertexBufferSize );
+  }
 
   glDisableVertexAttribArray(_vertexAttribID);
   glDisableVertexAttribArray(_uvAttribID);
-  glDisableVertexAttribArray(_normalAttribID);
+  if (_normalAttribID != (GLuint)-1) glDisableVertexAttribArray(_normalAttribID);
 
 };
@@ -3,8 +3,10 @@
 
 #include "vecTypes.h"
 #include "texture.h"
+#include "gpumemory.h"
 
 #include <stdio.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 #include <iostream>
@@ -16,6 +18,8 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
+class mvLightClusters;
+
 // HOW TO USE THESE SHADERS AND LIGHTS:
 //
 // This collection of classes is for managing a bunch of shaders and
@@ -42,6 +46,10 @@
 // edits.  See the setupDefaultNames() method if you want different
 // names.
 //
+// Shaders that take the number of lights at run time, so that it can
+// change without recompiling, get them from an mvLightClusters
+// instead, see lightclusters.h and mvShaderSet::setLightClusters().
+//
 //
 // A properly initialized mvShaderSet object, attached to some lights,
 // is ready to go, and can be given to the mvShape object for use.
@@ -119,7 +127,8 @@ class mvLights {
   // linked after the number of lights is set, this is pretty much a
   // one-way street.  Add lights, but don't subtract them.  If you
   // want to extinguish one, just move it far away, or dial its
-  // intensity way down.
+  // intensity way down.  Shaders that take their lights from an
+  // mvLightClusters don't mind how many there are.
   int addLight(MVec3 position, MVec3 color) {
     _positions.push_back(position);
     _colors.push_back(color);
@@ -133,6 +142,16 @@ class mvLights {
   // Draw these lights.  This is mostly just for updating the position
   // and color if they have changed since the last scene render.
   void draw(GLuint programID);  
+
+  // Works out, on the CPU, the lighting the plankton shaders work out
+  // for each fragment, but once, at one point of a flat shape: at
+  // position, facing normal, seen from eye, all in world coordinates.
+  // For a shape that's small next to its distance from the lights, one
+  // point is as good as another.  The texture's color is multiplied by
+  // light, for the ambient and diffuse light, and specular, times the
+  // alpha, is added for the highlight.  See FlatShading.fragmentshader.
+  void shadeFlat(const MVec3& position, const MVec3& normal, const MVec3& eye,
+                 MVec3& light, MVec3& specular);
 };
 
 typedef enum {
@@ -194,8 +213,13 @@ class mvShaderSet {
   std::string _linkLog;
 
   mvLights* _lights;
+  mvLightClusters* _lightClusters;
   bool _lightsLoaded;
 
+  // See setFlatLighting() and setUnkeyedShaders().
+  bool _flatLighting;
+  mvShaderSet* _unkeyedShaders;
+
   void attachAndLinkShaders();
   
  public:
@@ -209,6 +233,29 @@ class mvShaderSet {
   
   GLuint getProgramID() { return _programID; };
   std::string getLinkLog() { return _linkLog; };
+  mvLights* getLights() { return _lights; };
+
+  // Whether the program wants its lighting worked out by the shape,
+  // once, as with FlatShading.  Shapes that can (see mvShapeRect)
+  // then call mvLights::shadeFlat() as they draw, and pass the result
+  // in the uniforms mvShapeLight and mvShapeSpecular.
+  void setFlatLighting(bool flat) { _flatLighting = flat; };
+  bool getFlatLighting() { return _flatLighting; };
+
+  // For a program that takes the background to be keyed out of its
+  // textures already, like KeyedShading, the shader set to draw a
+  // texture with instead if it couldn't be keyed (see
+  // mvTexture::setKeyBackground()).  A shape switches over when it's
+  // loaded.  The other set stays with the caller.
+  void setUnkeyedShaders(mvShaderSet* shaders) { _unkeyedShaders = shaders; };
+  mvShaderSet* getUnkeyedShaders() { return _unkeyedShaders; };
+
+  // For a program that takes its lights from clusters, like
+  // ClusteredShading, instead of from arrays the size of the number
+  // of lights.  The clusters stay with the caller, who has to update()
+  // them for each view, after load().  Set this before load().
+  void setLightClusters(mvLightClusters* clusters) { _lightClusters = clusters; };
+  mvLightClusters* getLightClusters() { return _lightClusters; };
 
   // These are for making sure that anything that has changed in the
   // shader set will be properly accounted for at the next render.
@@ -219,6 +266,48 @@ class mvShaderSet {
 };
 
 
+// The ways mvShaderContext can arrange vertex data in GPU memory.
+//
+// vertexSEPARATE    -- positions, uvs, and normals each in their own
+//                      buffer, as floats.  12+8+12 bytes per vertex.
+//                      This is the default.
+// vertexINTERLEAVED -- the same floats, but all in one buffer, one
+//                      vertex after another.  32 bytes per vertex,
+//                      but each vertex is one fetch instead of three.
+// vertexPACKED      -- interleaved, with float positions, half-float
+//                      uvs, and normals in GL_INT_2_10_10_10_REV.
+//                      20 bytes per vertex.
+// vertexQUANTIZED   -- like vertexPACKED, but the positions are 16-bit
+//                      fixed point within the bounding box of the
+//                      mesh.  The matrix that maps them back to model
+//                      coordinates is folded into the model matrix at
+//                      draw time.  16 bytes per vertex.
+//
+// The half-float uvs are good to a texel on textures up to about 2048
+// pixels across.  The quantized positions are good to 1/65535 of the
+// size of the mesh.
+typedef enum {
+  vertexSEPARATE = 0,
+  vertexINTERLEAVED = 1,
+  vertexPACKED = 2,
+  vertexQUANTIZED = 3
+} mvVertexLayout;
+
+// How one vertex attribute sits in its buffer, in the terms that
+// glVertexAttribPointer() wants.
+struct mvAttribFormat {
+  GLint size;
+  GLenum type;
+  GLboolean normalized;
+  GLsizei stride;
+  size_t offset;
+
+  mvAttribFormat(GLint sz, GLenum t, GLboolean norm, GLsizei str, size_t off) :
+    size(sz), type(t), normalized(norm), stride(str), offset(off) {};
+  mvAttribFormat() :
+    size(3), type(GL_FLOAT), normalized(GL_FALSE), stride(0), offset(0) {};
+};
+
 // This class packages all the buffers and array objects that make a
 // shader work, and provides the object with a relatively simple and
 // well-labeled interface.  Basically the object just has to provide a
@@ -236,7 +325,7 @@ class mvShaderSet {
 class mvShaderContext {
 private:
   mvShaderSet* _shaderSet;
-  mvTexture* _texture;
+  mvTextureHandle _texture;
 
   // One of GL_POINTS, GL_LINES, GL_LINE_STRIP, GL_LINE_LOOP,
   // GL_TRIANGLES, GL_TRIANGLE_STRIP, GL_TRIANGLE_FAN, GL_QUADS,
@@ -260,12 +349,47 @@ private:
   // Is this the VAO?
   GLuint _arrayID;
   
+  // How the vertex data is laid out, and the resulting formats of the
+  // individual attributes.  In all but the vertexSEPARATE layout,
+  // everything lives in _vertexBufferID.
+  mvVertexLayout _vertexLayout;
+  mvAttribFormat _positionFormat;
+  mvAttribFormat _uvFormat;
+  mvAttribFormat _normalFormat;
+
+  // Maps the stored positions to model coordinates.  This is the
+  // identity except for quantized positions.
+  MMat4 _positionTransform;
+
+  // Packs the vertex data into one buffer according to _vertexLayout.
+  void packVertices(const MVec3* vertices,
+                    const MVec2* uvs,
+                    const MVec3* normals,
+                    int nVertices,
+                    std::vector<unsigned char> &out);
+
   // These IDs point to actual data.
   GLuint _vertexBufferID;
 	GLuint _uvBufferID;
 	GLuint _normalBufferID;
   GLuint _colorBufferID;
   int _vertexBufferSize;
+
+  // For indexed drawing.  If _indexCount is zero, the vertices are
+  // drawn in order with glDrawArrays().  Otherwise they are drawn with
+  // glDrawElements() using this index buffer, and _indexType says
+  // whether it holds GL_UNSIGNED_SHORT or GL_UNSIGNED_INT indices.
+  GLuint _indexBufferID;
+  int _indexCount;
+  GLenum _indexType;
+
+  // The part of the index buffer draw() uses.  A count of -1 means
+  // all of it.  See setDrawRange().
+  int _drawFirst;
+  int _drawCount;
+
+  // What the buffers take, as counted by mvGPUMemory.
+  size_t _gpuBytes;
   
   // These matrices may appear in the shaders.
   GLuint _projMatrixID;
@@ -280,6 +404,13 @@ private:
 	GLuint _inverseModelMatrixID;
   std::string  _inverseModelMatrixName;
 
+  // For shader sets with flat lighting, the lighting the shape worked
+  // out for this draw, and where it goes.  See setShapeLighting().
+  GLint _shapeLightID;
+  GLint _shapeSpecularID;
+  MVec3 _shapeLight;
+  MVec3 _shapeSpecular;
+
   // These are the default names of variables in the shaders.  Placed
   // here so they're all in one place, for easy comparison to the shader
   // you'll use.
@@ -294,39 +425,116 @@ private:
     _inverseModelMatrixName = std::string("invM");
   }
 
+  // No copying; the context owns its buffers, and deletes them, and
+  // their count in mvGPUMemory, when it goes.
+  mvShaderContext(const mvShaderContext&);
+  mvShaderContext& operator=(const mvShaderContext&);
+
 public:
   mvShaderContext(mvShaderSet* shaderSet) {
     _mode = GL_TRIANGLES; // this is the default
     _shaderSet = shaderSet;
-    _texture = NULL;
+    _arrayID = 0;
+    _vertexBufferID = _uvBufferID = _normalBufferID = _colorBufferID = 0;
+    _indexBufferID = 0;
+    _indexCount = 0;
+    _indexType = GL_UNSIGNED_INT;
+    _drawFirst = 0;
+    _drawCount = -1;
+    _gpuBytes = 0;
+    _shapeLightID = _shapeSpecularID = -1;
+    setVertexLayout(vertexSEPARATE);
     setupDefaultNames();
   }
   mvShaderContext(mvShaderSet* shaderSet, mvTexture* texture) {
     _mode = GL_TRIANGLES; // this is the default
     _shaderSet = shaderSet;
-    _texture = texture;
+    _texture = mvTextureHandle(texture);
+    _arrayID = 0;
+    _vertexBufferID = _uvBufferID = _normalBufferID = _colorBufferID = 0;
+    _indexBufferID = 0;
+    _indexCount = 0;
+    _indexType = GL_UNSIGNED_INT;
+    _drawFirst = 0;
+    _drawCount = -1;
+    _gpuBytes = 0;
+    _shapeLightID = _shapeSpecularID = -1;
+    setVertexLayout(vertexSEPARATE);
     setupDefaultNames();
   }    
   
-  // Should we delete the texture here?
+  // The texture goes with its last handle.
   ~mvShaderContext() {
-    if (_texture) delete _texture;
     // Cleanup VBO and shader
     if (glIsBuffer(_vertexBufferID)) glDeleteBuffers(1, &_vertexBufferID);
     if (glIsBuffer(_uvBufferID))     glDeleteBuffers(1, &_uvBufferID);
     if (glIsBuffer(_normalBufferID)) glDeleteBuffers(1, &_normalBufferID);
     if (glIsBuffer(_colorBufferID))  glDeleteBuffers(1, &_colorBufferID);
+    if (glIsBuffer(_indexBufferID))  glDeleteBuffers(1, &_indexBufferID);
     if (glIsVertexArray(_arrayID))   glDeleteVertexArrays(1, &_arrayID);
+    mvGPUMemory::release(gpuMESH, _gpuBytes);
   };
   
+  // Whatever can be done ahead of load() without OpenGL, which for
+  // now is reading the texture file.  Safe to call from a worker
+  // thread.
+  void prepare() { if (_texture.get()) _texture->decode(); };
+
+  mvTexture* getTexture() { return _texture.get(); };
+  mvShaderSet* getShaderSet() { return _shaderSet; };
+
   void load(const std::vector<MVec3> &vertices,
             const std::vector<MVec2> &uvs,
             const std::vector<MVec3> &normals,
             const std::vector<MVec3> &colors);
+
+  // Indexed version of the above, for meshes with shared vertices
+  // (see indexMesh()).  The indices are stored as 16-bit values if
+  // they fit, and 32-bit otherwise.
+  void load(const std::vector<MVec3> &vertices,
+            const std::vector<MVec2> &uvs,
+            const std::vector<MVec3> &normals,
+            const std::vector<MVec3> &colors,
+            const std::vector<uint32_t> &indices);
+
+  // The same thing, but for data that isn't in a std::vector, like
+  // a memory-mapped mesh file.  The arrays are handed straight to
+  // OpenGL, which makes its own copy, so they can go away as soon as
+  // this returns.  The indices are optional; indexType is
+  // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+  void load(const MVec3* vertices,
+            const MVec2* uvs,
+            const MVec3* normals,
+            int nVertices,
+            const void* indices = NULL,
+            int nIndices = 0,
+            GLenum indexType = GL_UNSIGNED_INT);
   void draw(const MMat4 &modelMatrix,
             const MMat4 &viewMatrix,
             const MMat4 &projectionMatrix);
 
+  // The lighting for the next draw(), from mvLights::shadeFlat(), for
+  // shader sets with flat lighting (see mvShaderSet::setFlatLighting()).
+  // draw() sends it in the uniforms mvShapeLight and mvShapeSpecular.
+  void setShapeLighting(const MVec3& light, const MVec3& specular) {
+    _shapeLight = light;
+    _shapeSpecular = specular;
+  };
+
+  // Draw only some of the indices, starting with the given one.  This
+  // is for index buffers that hold more than one version of the mesh,
+  // like the levels of detail of an mvShapeObj.  A count of -1 draws
+  // everything from first to the end.
+  void setDrawRange(int first, int count) {
+    _drawFirst = first;
+    _drawCount = count;
+  };
+
+  // Choose how the vertex data is stored.  This has to be done before
+  // load().
+  void setVertexLayout(mvVertexLayout layout);
+  mvVertexLayout getVertexLayout() { return _vertexLayout; };
+
   // A description of all the OpenGL drawing modes.
   //
   // GL_POINTS -- Treats each vertex as a single point. Vertex n
@@ -0,0 +1,80 @@
+#include <new>
+#include <sstream>
+
+#include "shapepool.h"
+
+// Slots are aligned for anything a shape might hold.
+static const size_t slotAlignment = 16;
+
+mvShapePool::mvShapePool(const std::string& name, size_t objectSize,
+                         size_t slotsPerChunk) :
+  _name(name), _objectSize(objectSize),
+  _slotsPerChunk(slotsPerChunk > 0 ? slotsPerChunk : 1),
+  _unused(0), _freeList(NULL), _liveCount(0) {
+
+  _slotSize = (objectSize + slotAlignment - 1) & ~(slotAlignment - 1);
+  if (_slotSize < sizeof(void*)) _slotSize = sizeof(void*);
+}
+
+mvShapePool::~mvShapePool() {
+
+  for (size_t i = 0; i < _chunks.size(); i++) ::operator delete(_chunks[i]);
+}
+
+void* mvShapePool::allocate(size_t size) {
+
+  if (size != _objectSize) return ::operator new(size);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _liveCount++;
+
+  if (_freeList) {
+    void* p = _freeList;
+    _freeList = *(void**)p;
+    return p;
+  }
+
+  if (_unused == 0) {
+    // ::operator new returns memory aligned for any type, so the slots
+    // in the chunk are, too.
+    _chunks.push_back((char*)::operator new(_slotSize * _slotsPerChunk));
+    _unused = _slotsPerChunk;
+  }
+
+  return _chunks.back() + _slotSize * (_slotsPerChunk - _unused--);
+}
+
+void mvShapePool::release(void* p, size_t size) {
+
+  if (p == NULL) return;
+  if (size != _objectSize) {
+    ::operator delete(p);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _liveCount--;
+  *(void**)p = _freeList;
+  _freeList = p;
+}
+
+size_t mvShapePool::getLiveCount() const {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _liveCount;
+}
+
+size_t mvShapePool::getChunkCount() const {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _chunks.size();
+}
+
+std::string mvShapePool::print() const {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  std::stringstream out;
+  out << _name << ": " << _liveCount << " shapes in " << _chunks.size()
+      << " chunks of " << _slotsPerChunk << " x " << _slotSize << " bytes";
+  return out.str();
+}
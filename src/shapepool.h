@@ -0,0 +1,64 @@
+#ifndef SHAPEPOOL_H
+#define SHAPEPOOL_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+// Memory for shapes of one type, handed out from big chunks instead of
+// one heap block per shape.  A scene can have a hundred thousand
+// shapes, and anything that goes through them every frame (culling,
+// sorting, drawing) goes faster when they sit next to each other in
+// memory, in the order they were made, than when they're scattered
+// among the textures and strings made along with them.
+//
+// Each shape class that wants this has its own operator new and
+// operator delete that use a pool of its own (see mvShape.cpp), so
+// shapes are still made with new, or by mvShapeFactory, and deleted
+// with delete.  A freed slot is reused by the next shape made.  A
+// request of any size but the one the pool was made for, as from a
+// subclass that didn't get a pool of its own, goes to the heap as
+// usual.
+class mvShapePool {
+ private:
+  std::string _name;
+
+  // The size of a slot, rounded up so that every slot is aligned.
+  size_t _objectSize;
+  size_t _slotSize;
+  size_t _slotsPerChunk;
+
+  std::vector<char*> _chunks;
+
+  // Slots in the last chunk that have never been used.
+  size_t _unused;
+
+  // Freed slots, linked through their first bytes.
+  void* _freeList;
+
+  size_t _liveCount;
+
+  // Shapes are made and deleted on different threads, and everything
+  // above, counts included, is read under this.
+  mutable std::mutex _mutex;
+
+  // No copying; the pool owns its chunks.
+  mvShapePool(const mvShapePool&);
+  mvShapePool& operator=(const mvShapePool&);
+
+ public:
+  mvShapePool(const std::string& name, size_t objectSize,
+              size_t slotsPerChunk = 256);
+  ~mvShapePool();
+
+  void* allocate(size_t size);
+  void release(void* p, size_t size);
+
+  size_t getLiveCount() const;
+  size_t getChunkCount() const;
+
+  std::string print() const;
+};
+
+#endif
@@ -1,369 +1,604 @@
-#include "texture.h"
+#include <math.h>
+#include <algorithm>
 
-mvTexture::mvTexture(const mvTextureType t, const std::string fileName) {
+#include "texture.h"
+#include "pixelops.h"
+#include "texturecache.h"
+#include "hash.h"
+#include "gpumemory.h"
+
+mvTexture::mvTexture(const mvTextureType t, const std::string fileName,
+                     bool deferred) :
+  _width(0), _height(0), _type(t), _fileName(fileName), _decoded(false),
+  _byteSize(0), _gpuBytes(0), _memoryCategory(gpuTEXTURE), _referenceCount(0),
+  _cache(NULL), _trim(false), _trimMargin(0),
+  _cropWindow(0.0f, 0.0f, 1.0f, 1.0f), _keyBackground(false), _keyed(false),
+  _textureBufferID(0) {
 
   switch(t) {
   case textureDDS:
-    _textureBufferID = loadDDS(fileName);
-    break;
-
   case textureBMP:
-    _textureBufferID = loadBMP(fileName);
-    break;
-
   case texturePNG:
-    _textureBufferID = loadPNG(fileName);
+  case textureJPG:
+  case textureAuto:
     break;
     
   default:
     throw std::runtime_error("What texture type is this?");
   }
+
+  if (!deferred) {
+    decode();
+    upload();
+  }
 }
 
-void mvTexture::load(GLuint programID) {
+void mvTexture::decode() {
 
-  // Get a handle for our "myTextureSampler" uniform
-  _textureAttribID  = glGetUniformLocation(programID, _textureAttribName.c_str());
+  std::lock_guard<std::mutex> lock(_decodeMutex);
+  if (_decoded) return;
+  _decoded = true;
 
-}
+  mvImageDecoderRegistry& decoders = mvImageDecoderRegistry::get();
+  mvImageDecoder* decoder = NULL;
+  switch(_type) {
+  case textureDDS:
+    decoder = decoders.findByExtension("dds");
+    break;
 
-void mvTexture::draw(GLuint programID) {
+  case textureBMP:
+    decoder = decoders.findByExtension("bmp");
+    break;
 
-  // Bind our texture in Texture Unit 0
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, _textureBufferID);
-  // Set our "myTextureSampler" sampler to user Texture Unit 0
-  glUniform1i(_textureAttribID, 0);
+  case texturePNG:
+    decoder = decoders.findByExtension("png");
+    break;
 
-}
+  case textureJPG:
+    decoder = decoders.findByExtension("jpg");
+    break;
 
-GLuint mvTexture::loadBMP(const std::string imagepath){
-
-	printf("Reading image %s\n", imagepath.c_str());
-
-	// Data read from the header of the BMP file
-	unsigned char header[54];
-	unsigned int dataPos;
-	unsigned int imageSize;
-	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
-
-	// Open the file
-	FILE * file = fopen(imagepath.c_str(),"rb");
-	if (!file) {printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath.c_str()); getchar(); return 0;}
-
-	// Read the header, i.e. the 54 first bytes
-
-	// If less than 54 bytes are read, problem
-	if ( fread(header, 1, 54, file)!=54 ){ 
-		printf("Not a correct BMP file\n");
-		fclose(file);
-		return 0;
-	}
-	// A BMP files always begins with "BM"
-	if ( header[0]!='B' || header[1]!='M' ){
-		printf("Not a correct BMP file\n");
-		fclose(file);
-		return 0;
-	}
-	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-
-	// Read the information about the image
-	dataPos    = *(int*)&(header[0x0A]);
-	imageSize  = *(int*)&(header[0x22]);
-	width      = *(int*)&(header[0x12]);
-	height     = *(int*)&(header[0x16]);
-
-	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
-	if (dataPos==0)      dataPos=54; // The BMP header is done that way
-
-	// Create a buffer
-	data = new unsigned char [imageSize];
-
-	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
-
-	// Everything is in memory now, the file wan be closed
-	fclose (file);
-
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-	
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
+  case textureAuto:
+    decoder = decoders.findForFile(_fileName);
+    if (decoder == NULL)
+      fprintf(stderr, "%s: not an image format we know.\n", _fileName.c_str());
+    break;
+  }
 
-	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
+  // Only a keyed image can be shrunk, since it's premultiplied and
+  // the background can't bleed into the edges.  Filtering an unkeyed
+  // one would spoil the gray test the shader does for its background.
+  mvDecodeOptions options = _options;
+  if (!_keyBackground) options.neededWidth = options.neededHeight = 0;
+  bool ok = decoder && decoder->decode(_fileName, _image, options);
 
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
-	fclose(file);
+  // A file we couldn't read leaves the texture ID at zero, as before.
+  if (!ok) _image = mvImageData();
 
-	// Poor filtering, or ...
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
+  if (_keyBackground) keyBackground();
+  if (_keyed) shrinkToNeededSize();
+  _width = _image.width;
+  _height = _image.height;
 
-	// ... nice trilinear filtering.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
-	glGenerateMipmap(GL_TEXTURE_2D);
+  if (!_keyed) packGray();
+  if (_trim) trimToContent();
 
-	// Return the ID of the texture we just created
-	return textureID;
-}
+  _byteSize = (_image.rowBytes > 0) ?
+    _image.rowBytes * _image.height : _image.pixels.size();
 
+  if (_cache && !_image.pixels.empty()) {
+    _original = _cache->findDuplicate(this, hashPixels());
+    if (_original.get()) _image = mvImageData();
+  }
+}
 
+mvTexture::~mvTexture() {
 
-#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
-#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
-#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+  // A copy's OpenGL texture belongs to the original.
+  if (_textureBufferID != 0 && _original.get() == NULL) {
+    glDeleteTextures(1, &_textureBufferID);
+    mvGPUMemory::release(_memoryCategory, _gpuBytes);
+  }
+}
 
-GLuint mvTexture::loadDDS(const std::string imagepath){
+void mvTexture::release() {
 
-	unsigned char header[124];
+  // The cache has to hear about it before anyone else can find this
+  // texture there, so it does the counting for its own textures.
+  if (_cache) {
+    _cache->release(this);
+  } else if (--_referenceCount == 0) {
+    delete this;
+  }
+}
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath.c_str(), "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath.c_str()); getchar(); 
-		return 0;
-	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
-	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
-	}
-
-	// Create one OpenGL texture
-	GLuint textureID;
-	glGenTextures(1, &textureID);
-
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
-
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
+// The number of bytes a pixel, or zero for compressed formats.
+static int channelCount(GLenum format) {
+  switch (format) {
+  case GL_RED: return 1;
+  case GL_RG: return 2;
+  case GL_RGB:
+  case GL_BGR: return 3;
+  case GL_RGBA: return 4;
+  default: return 0;
+  }
+}
 
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
+// One channel of a pixel, as the shaders would see it through the
+// given swizzle.
+static inline unsigned char swizzled(const unsigned char* pixel, GLint swizzle) {
+  switch (swizzle) {
+  case GL_RED: return pixel[0];
+  case GL_GREEN: return pixel[1];
+  case GL_BLUE: return pixel[2];
+  case GL_ALPHA: return pixel[3];
+  case GL_ONE: return 255;
+  default: return 0;
+  }
+}
 
-	} 
+// The plankton shader only draws pixels whose red and green are
+// equal, which is to say gray ones.  Anything else is background.  In
+// a keyed image, that's already been worked out, and the background is
+// transparent.
+static inline bool isBackground(const unsigned char* pixel,
+                                const mvImageData& image, bool keyed) {
+  if (keyed) return swizzled(pixel, image.swizzle[3]) == 0;
+  if (image.format == GL_BGR) return pixel[2] != pixel[1];
+  return swizzled(pixel, image.swizzle[0]) != swizzled(pixel, image.swizzle[1]);
+}
 
-	free(buffer); 
+uint64_t mvTexture::hashPixels() {
 
-	return textureID;
+  // Everything that decides what the texture looks like, then the
+  // pixels a row at a time, leaving out the padding.
+  GLint shape[8] = { _image.width, _image.height, (GLint)_image.format,
+                     (GLint)_image.type, _image.swizzle[0], _image.swizzle[1],
+                     _image.swizzle[2], _image.swizzle[3] };
+  uint64_t hash = mvHash64(shape, sizeof(shape));
 
+  if (_image.rowBytes == 0) {
+    return mvHash64(&_image.pixels[0], _image.pixels.size(), hash);
+  }
 
+  size_t rowLength = _image.width * channelCount(_image.format) *
+    ((_image.type == GL_UNSIGNED_SHORT) ? 2 : 1);
+  for (int y = 0; y < _image.height; y++)
+    hash = mvHash64(&_image.pixels[y * _image.rowBytes], rowLength, hash);
+  return hash;
 }
 
+void mvTexture::shrinkToNeededSize() {
+
+  int channels = channelCount(_image.format);
+  if (channels == 0 || _image.type != GL_UNSIGNED_BYTE ||
+      _image.pixels.empty()) return;
+
+  // Whichever way needs more of the image decides how much it shrinks.
+  float scale = 0.0f;
+  if (_options.neededWidth > 0)
+    scale = std::max(scale, (float)_options.neededWidth / _image.width);
+  if (_options.neededHeight > 0)
+    scale = std::max(scale, (float)_options.neededHeight / _image.height);
+  if (scale <= 0.0f || scale >= 1.0f) return;
+
+  int width = std::max(1, (int)ceilf(_image.width * scale));
+  int height = std::max(1, (int)ceilf(_image.height * scale));
+  if (width >= _image.width && height >= _image.height) return;
+  width = std::min(width, (int)_image.width);
+  height = std::min(height, (int)_image.height);
+
+  int rowBytes = (width * channels + 3) & ~3;
+  std::vector<unsigned char> shrunk((size_t)rowBytes * height);
+  shrinkImage8(&_image.pixels[0], _image.rowBytes, _image.width, _image.height,
+               channels, &shrunk[0], rowBytes, width, height);
+
+  _image.width = width;
+  _image.height = height;
+  _image.rowBytes = rowBytes;
+  _image.pixels.swap(shrunk);
+}
 
-GLuint mvTexture::loadPNG(const std::string imagePath) {
-  
-  // This function was originally written by David Grayson for
-  // https://github.com/DavidEGrayson/ahrs-visualizer
+void mvTexture::keyBackground() {
 
-  png_byte header[8];
+  int channels = channelCount(_image.format);
+  if (_image.pixels.empty()) return;
+  if (channels == 0 || _image.type != GL_UNSIGNED_BYTE) {
+    fprintf(stderr, "%s: can't key out the background of a compressed or "
+            "16-bit image.  It's left for the shader to find.\n",
+            _fileName.c_str());
+    return;
+  }
+  _keyed = true;
+  int width = _image.width, height = _image.height;
+
+  // Gray images, with or without an alpha, were always drawn opaque.
+  // Drop the alpha.
+  if (channels < 3) {
+    if (channels == 2) {
+      int rowBytes = (width + 3) & ~3;
+      std::vector<unsigned char> gray((size_t)rowBytes * height);
+      for (int y = 0; y < height; y++) {
+        const unsigned char* in = &_image.pixels[(size_t)y * _image.rowBytes];
+        unsigned char* out = &gray[(size_t)y * rowBytes];
+        for (int x = 0; x < width; x++) out[x] = in[2 * x];
+      }
+      _image.format = GL_RED;
+      _image.rowBytes = rowBytes;
+      _image.pixels.swap(gray);
+    }
+    _image.swizzle[3] = GL_ONE;
+    return;
+  }
 
-  FILE *fp = fopen(imagePath.c_str(), "rb");
-  if (fp == 0) {
-    perror(imagePath.c_str());
-    return 0;
+  // Everything else is keyed as RGBA, tightly packed.
+  std::vector<unsigned char> rgba((size_t)width * height * 4);
+  for (int y = 0; y < height; y++) {
+    const unsigned char* in = &_image.pixels[(size_t)y * _image.rowBytes];
+    unsigned char* out = &rgba[(size_t)y * width * 4];
+    if (_image.format == GL_RGBA) {
+      memcpy(out, in, width * 4);
+    } else {
+      int red = (_image.format == GL_BGR) ? 2 : 0;
+      for (int x = 0; x < width; x++, in += 3, out += 4) {
+        out[0] = in[red];
+        out[1] = in[1];
+        out[2] = in[2 - red];
+        out[3] = 255;
+      }
+    }
+  }
+  size_t count = (size_t)width * height;
+  keyRGBA8(&rgba[0], &rgba[0], count);
+
+  // Whether anything is background, and whether anything else isn't
+  // gray after all.
+  bool anyBackground = false, anyColor = false;
+  for (size_t i = 0; i < count && !(anyColor && anyBackground); i++) {
+    const unsigned char* pixel = &rgba[4 * i];
+    if (pixel[3] == 0) anyBackground = true;
+    else if (pixel[2] != pixel[0]) anyColor = true;
   }
 
-  // read the header
-  fread(header, 1, 8, fp);
+  _image.swizzle[0] = GL_RED;
+  if (anyColor) {
+    // With nothing to key out, the alpha needn't be kept.
+    if (!anyBackground) {
+      int rowBytes = (width * 3 + 3) & ~3;
+      for (int y = 0; y < height; y++) {
+        const unsigned char* in = &rgba[(size_t)y * width * 4];
+        unsigned char* out = &rgba[(size_t)y * rowBytes];
+        for (int x = 0; x < width; x++, in += 4, out += 3) {
+          out[0] = in[0];
+          out[1] = in[1];
+          out[2] = in[2];
+        }
+      }
+      rgba.resize((size_t)rowBytes * height);
+      _image.rowBytes = rowBytes;
+    } else {
+      _image.rowBytes = width * 4;
+    }
+    _image.format = anyBackground ? GL_RGBA : GL_RGB;
+    _image.pixels.swap(rgba);
+    _image.swizzle[1] = GL_GREEN;
+    _image.swizzle[2] = GL_BLUE;
+    _image.swizzle[3] = anyBackground ? GL_ALPHA : GL_ONE;
+    return;
+  }
 
-  if (png_sig_cmp(header, 0, 8)) {
-    fprintf(stderr, "error: %s is not a PNG.\n", imagePath.c_str());
-    fclose(fp);
-    return 0;
+  // Gray and alpha, or just gray, packed in place, a row at a time.
+  int packedChannels = anyBackground ? 2 : 1;
+  int rowBytes = (width * packedChannels + 3) & ~3;
+  for (int y = 0; y < height; y++) {
+    const unsigned char* in = &rgba[(size_t)y * width * 4];
+    unsigned char* out = &rgba[(size_t)y * rowBytes];
+    if (anyBackground) {
+      packRedAlpha8(in, out, width);
+    } else {
+      for (int x = 0; x < width; x++) out[x] = in[4 * x];
+    }
   }
+  rgba.resize((size_t)rowBytes * height);
+
+  _image.format = anyBackground ? GL_RG : GL_RED;
+  _image.rowBytes = rowBytes;
+  _image.pixels.swap(rgba);
+  _image.swizzle[1] = GL_RED;
+  _image.swizzle[2] = GL_RED;
+  _image.swizzle[3] = anyBackground ? GL_GREEN : GL_ONE;
+}
 
-  png_structp png_ptr =
-    png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (!png_ptr) {
-    fprintf(stderr, "error: png_create_read_struct returned 0.\n");
-    fclose(fp);
-    return 0;
+void mvTexture::packGray() {
+
+  int channels = channelCount(_image.format);
+  if (_image.format == GL_BGR || channels < 3 || _image.pixels.empty() ||
+      _image.type != GL_UNSIGNED_BYTE) return;
+
+  // Every pixel has to be either gray and opaque, or background, whose
+  // color doesn't matter as long as its red and green differ.
+  bool anyBackground = false;
+  for (int y = 0; y < _image.height; y++) {
+    const unsigned char* pixel = &_image.pixels[y * _image.rowBytes];
+    for (int x = 0; x < _image.width; x++, pixel += channels) {
+      if (pixel[0] != pixel[1]) {
+        anyBackground = true;
+      } else if (pixel[2] != pixel[0] || (channels == 4 && pixel[3] != 255)) {
+        return;
+      }
+    }
   }
 
-  // create png info struct
-  png_infop info_ptr = png_create_info_struct(png_ptr);
-  if (!info_ptr) {
-    fprintf(stderr, "error: png_create_info_struct returned 0.\n");
-    png_destroy_read_struct(&png_ptr, (png_infopp)NULL, (png_infopp)NULL);
-    fclose(fp);
-    return 0;
+  // With no background, the gray level is enough.  Otherwise keep red
+  // and green, so that they still differ where the shader looks.
+  int packedChannels = anyBackground ? 2 : 1;
+  int packedRowBytes = (_image.width * packedChannels + 3) & ~3;
+  std::vector<unsigned char> packed(packedRowBytes * _image.height);
+  for (int y = 0; y < _image.height; y++) {
+    const unsigned char* pixel = &_image.pixels[y * _image.rowBytes];
+    unsigned char* out = &packed[y * packedRowBytes];
+    for (int x = 0; x < _image.width; x++, pixel += channels) {
+      for (int c = 0; c < packedChannels; c++) *out++ = pixel[c];
+    }
   }
 
-  // create png info struct
-  png_infop end_info = png_create_info_struct(png_ptr);
-  if (!end_info) {
-    fprintf(stderr, "error: png_create_info_struct returned 0.\n");
-    png_destroy_read_struct(&png_ptr, &info_ptr, (png_infopp) NULL);
-    fclose(fp);
-    return 0;
+  _image.format = anyBackground ? GL_RG : GL_RED;
+  _image.swizzle[0] = GL_RED;
+  _image.swizzle[1] = anyBackground ? GL_GREEN : GL_RED;
+  _image.swizzle[2] = GL_RED;
+  _image.swizzle[3] = GL_ONE;
+  _image.rowBytes = packedRowBytes;
+  _image.pixels.swap(packed);
+}
+
+void mvTexture::expandChannels() {
+
+  int channels = channelCount(_image.format);
+  if (channels > 2 || _image.type != GL_UNSIGNED_BYTE) return;
+
+  int expandedChannels = (_image.swizzle[3] == GL_ONE) ? 3 : 4;
+  int expandedRowBytes = (_image.width * expandedChannels + 3) & ~3;
+  std::vector<unsigned char> expanded(expandedRowBytes * _image.height);
+  for (int y = 0; y < _image.height; y++) {
+    const unsigned char* pixel = &_image.pixels[y * _image.rowBytes];
+    unsigned char* out = &expanded[y * expandedRowBytes];
+    for (int x = 0; x < _image.width; x++, pixel += channels) {
+      for (int c = 0; c < expandedChannels; c++)
+        *out++ = swizzled(pixel, _image.swizzle[c]);
+    }
   }
 
-  // the code in this if statement gets called if libpng encounters an error
-  if (setjmp(png_jmpbuf(png_ptr))) {
-    fprintf(stderr, "error from libpng\n");
-    png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    fclose(fp);
-    return 0;
+  _image.format = (expandedChannels == 3) ? GL_RGB : GL_RGBA;
+  _image.swizzle[0] = GL_RED;
+  _image.swizzle[1] = GL_GREEN;
+  _image.swizzle[2] = GL_BLUE;
+  _image.swizzle[3] = GL_ALPHA;
+  _image.rowBytes = expandedRowBytes;
+  _image.pixels.swap(expanded);
+}
+
+void mvTexture::trimToContent() {
+
+  // Compressed images stay as they are, and 16-bit ones are all gray,
+  // so there's no background to trim.
+  int channels = channelCount(_image.format);
+  if (channels == 0 || _image.type != GL_UNSIGNED_BYTE) return;
+
+  int width = _image.width, height = _image.height;
+  if (_image.pixels.empty() || width == 0 || height == 0) return;
+
+  // Find the rows and columns that have anything but background.
+  int x0 = width, x1 = -1, y0 = height, y1 = -1;
+  for (int y = 0; y < height; y++) {
+    const unsigned char* row = &_image.pixels[y * _image.rowBytes];
+
+    int first = 0;
+    while (first < width && isBackground(row + first * channels, _image, _keyed))
+      first++;
+    if (first == width) continue;
+
+    int last = width - 1;
+    while (isBackground(row + last * channels, _image, _keyed)) last--;
+
+    if (first < x0) x0 = first;
+    if (last > x1) x1 = last;
+    if (y < y0) y0 = y;
+    y1 = y;
   }
 
-  // init png reading
-  png_init_io(png_ptr, fp);
+  // If it's all background, keep one pixel of it, so there is still
+  // a texture.
+  if (x1 < 0) {
+    x0 = x1 = y0 = y1 = 0;
+  }
 
-  // let libpng know you already read the first 8 bytes
-  png_set_sig_bytes(png_ptr, 8);
+  x0 = std::max(0, x0 - _trimMargin);
+  y0 = std::max(0, y0 - _trimMargin);
+  x1 = std::min(width - 1, x1 + _trimMargin);
+  y1 = std::min(height - 1, y1 + _trimMargin);
+
+  int cropWidth = x1 - x0 + 1;
+  int cropHeight = y1 - y0 + 1;
+  if (cropWidth == width && cropHeight == height) return;
+
+  int cropRowBytes = (cropWidth * channels + 3) & ~3;
+  std::vector<unsigned char> cropped(cropRowBytes * cropHeight);
+  for (int y = 0; y < cropHeight; y++) {
+    memcpy(&cropped[y * cropRowBytes],
+           &_image.pixels[(y0 + y) * _image.rowBytes + x0 * channels],
+           cropWidth * channels);
+  }
 
-  // read all the info up to the image data
-  png_read_info(png_ptr, info_ptr);
+  // Rows go up the image in memory, the same as v.
+  _cropWindow = MVec4((float)x0 / width, (float)y0 / height,
+                      (float)(x1 + 1) / width, (float)(y1 + 1) / height);
 
-  // variables to pass to get info
-  int bit_depth, color_type;
-  png_uint_32 temp_width, temp_height;
+  _image.width = cropWidth;
+  _image.height = cropHeight;
+  _image.rowBytes = cropRowBytes;
+  _image.pixels.swap(cropped);
+}
 
-  // get info about png
-  png_get_IHDR(png_ptr, info_ptr, &temp_width, &temp_height,
-               &bit_depth, &color_type,
-               NULL, NULL, NULL);
+void mvTexture::upload() {
 
-  _width = temp_width;
-  _height = temp_height;
-  
-  //printf("%s: %lux%lu %d\n", imagePath, temp_width, temp_height, color_type);
+  if (_textureBufferID != 0) return;
 
-  if (bit_depth != 8) {
-    fprintf(stderr, "%s: Unsupported bit depth %d.  Must be 8.\n", imagePath.c_str(), bit_depth);
-    return 0;
+  // A copy of another texture just uses that one.
+  if (_original.get()) {
+    _original->upload();
+    _textureBufferID = _original->_textureBufferID;
+    return;
   }
 
-  GLint format;
-  switch(color_type) {
-  case PNG_COLOR_TYPE_RGB:
-    format = GL_RGB;
+  if (_image.pixels.empty()) return;
+
+  GLuint textureID;
+  glGenTextures(1, &textureID);
+	
+  // "Bind" the newly created texture : all future texture functions
+  // will modify this texture
+  glBindTexture(GL_TEXTURE_2D, textureID);
+
+  // The decoders leave BMPs in GL_BGR, and DDS files compressed.
+  switch(_image.format) {
+  case GL_BGR:
+    // Give the image to OpenGL
+    mvGPUMemory::texImage2D(_memoryCategory, _gpuBytes,
+                            GL_TEXTURE_2D, 0, GL_RGB, _image.width,
+                            _image.height, 0, GL_BGR, GL_UNSIGNED_BYTE,
+                            &_image.pixels[0]);
+
+    // Poor filtering, or ...
+    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    //glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
+
+    // ... nice trilinear filtering.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); 
+    mvGPUMemory::generateMipmap(_memoryCategory, _gpuBytes, GL_TEXTURE_2D);
     break;
-  case PNG_COLOR_TYPE_RGB_ALPHA:
-    format = GL_RGBA;
+
+  case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+  case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    {
+      glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
+	
+      unsigned int blockSize =
+        (_image.format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
+      unsigned int offset = 0;
+      unsigned int width = _image.width;
+      unsigned int height = _image.height;
+
+      /* load the mipmaps */ 
+      for (unsigned int level = 0;
+           level < _image.mipMapCount && (width || height); ++level) { 
+        unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
+        if (offset + size > _image.pixels.size()) break;
+        mvGPUMemory::compressedTexImage2D(_memoryCategory, _gpuBytes,
+                                          GL_TEXTURE_2D, level, _image.format,
+                                          width, height, 0, size,
+                                          &_image.pixels[offset]);
+	 
+        offset += size; 
+        width  /= 2; 
+        height /= 2; 
+
+        // Deal with Non-Power-Of-Two textures.
+        if(width < 1) width = 1;
+        if(height < 1) height = 1;
+      }
+    }
     break;
+
   default:
-    fprintf(stderr, "%s: Unknown libpng color type %d.\n", imagePath.c_str(), color_type);
-    return 0;
+    if (channelCount(_image.format) <= 2) {
+      bool wide = (_image.type == GL_UNSIGNED_SHORT);
+      if (GLEW_ARB_texture_swizzle) {
+        GLint internalFormat = (_image.format == GL_RED) ?
+          (wide ? GL_R16 : GL_R8) : (wide ? GL_RG16 : GL_RG8);
+        mvGPUMemory::texImage2D(_memoryCategory, _gpuBytes,
+                                GL_TEXTURE_2D, 0, internalFormat,
+                                _image.width, _image.height, 0, _image.format,
+                                _image.type, &_image.pixels[0]);
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, _image.swizzle);
+      } else if (wide) {
+        // 16-bit images are always gray, or gray and alpha, which the
+        // old luminance formats can still do.
+        bool alpha = (_image.format == GL_RG);
+        mvGPUMemory::texImage2D(_memoryCategory, _gpuBytes,
+                                GL_TEXTURE_2D, 0,
+                                alpha ? GL_LUMINANCE16_ALPHA16 : GL_LUMINANCE16,
+                                _image.width, _image.height, 0,
+                                alpha ? GL_LUMINANCE_ALPHA : GL_LUMINANCE,
+                                GL_UNSIGNED_SHORT, &_image.pixels[0]);
+      } else {
+        expandChannels();
+        mvGPUMemory::texImage2D(_memoryCategory, _gpuBytes,
+                                GL_TEXTURE_2D, 0, _image.format, _image.width,
+                                _image.height, 0, _image.format,
+                                GL_UNSIGNED_BYTE, &_image.pixels[0]);
+      }
+      setFiltering();
+      break;
+    }
+    mvGPUMemory::texImage2D(_memoryCategory, _gpuBytes,
+                            GL_TEXTURE_2D, 0, _image.format, _image.width,
+                            _image.height, 0, _image.format, GL_UNSIGNED_BYTE,
+                            &_image.pixels[0]);
+    setFiltering();
+    break;
   }
 
-  // Update the png info struct.
-  png_read_update_info(png_ptr, info_ptr);
-
-  // Row size in bytes.
-  int rowbytes = png_get_rowbytes(png_ptr, info_ptr);
+  _textureBufferID = textureID;
 
-  // glTexImage2d requires rows to be 4-byte aligned
-  rowbytes += 3 - ((rowbytes-1) % 4);
+  // OpenGL has its own copy now.
+  _image = mvImageData();
+}
 
-  // Allocate the image_data as a big block, to be given to opengl
-  png_byte * image_data = (png_byte *)malloc(rowbytes * temp_height * sizeof(png_byte)+15);
-  if (image_data == NULL) {
-    fprintf(stderr, "error: could not allocate memory for PNG image data\n");
-    png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    fclose(fp);
-    return 0;
+void mvTexture::setFiltering() {
+
+  // A keyed image is premultiplied, on a transparent black background
+  // (see keyBackground()), so texels can be blended, and the image
+  // mipmapped.  It's been shrunk no further than the most it can
+  // cover on the screen (see shrinkToNeededSize()), and the mipmaps
+  // take it the rest of the way down, for images seen from farther
+  // off.  An image that isn't keyed is drawn with a shader that looks
+  // for its gray background pixel by pixel, which blending would
+  // smear, so it gets no filtering at all.
+  if (_keyed) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    mvGPUMemory::generateMipmap(_memoryCategory, _gpuBytes, GL_TEXTURE_2D);
+  } else {
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   }
+}
 
-  // row_pointers is for pointing to image_data for reading the png with libpng
-  png_byte ** row_pointers = (png_byte **)malloc(temp_height * sizeof(png_byte *));
-  if (row_pointers == NULL) {
-    fprintf(stderr, "error: could not allocate memory for PNG row pointers\n");
-    png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-    free(image_data);
-    fclose(fp);
-    return 0;
-  }
+void mvTexture::load(GLuint programID) {
 
-  // set the individual row_pointers to point at the correct offsets of image_data
-  for (unsigned int i = 0; i < temp_height; i++) {
-    row_pointers[temp_height - 1 - i] = image_data + i * rowbytes;
+  // For a deferred texture, this is where it goes to OpenGL.
+  if (_textureBufferID == 0) {
+    decode();
+    upload();
   }
 
-  // read the png into image_data through row_pointers
-  png_read_image(png_ptr, row_pointers);
-
-  // Generate the OpenGL texture object
-  GLuint texture;
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
-  glTexImage2D(GL_TEXTURE_2D, 0, format, temp_width, temp_height, 0, format, GL_UNSIGNED_BYTE, image_data);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-  // clean up
-  png_destroy_read_struct(&png_ptr, &info_ptr, &end_info);
-  free(image_data);
-  free(row_pointers);
-  fclose(fp);
-  return texture;
+  // Get a handle for our "myTextureSampler" uniform
+  _textureAttribID  = glGetUniformLocation(programID, _textureAttribName.c_str());
+
+}
+
+void mvTexture::draw(GLuint programID) {
+
+  // Bind our texture in Texture Unit 0
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, _textureBufferID);
+  // Set our "myTextureSampler" sampler to user Texture Unit 0
+  glUniform1i(_textureAttribID, 0);
+
 }
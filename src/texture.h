@@ -6,23 +6,130 @@
 #include <cstring>
 #include <iostream>
 #include <stdexcept>
+#include <vector>
+#include <mutex>
+#include <atomic>
 
 
 #include <GL/glew.h>
 
 
-#include <png.h>
+#include "vecTypes.h"
+#include "imagedecoder.h"
+#include "gpumemory.h"
 
+class mvTextureCache;
+class mvTexture;
+
+// A counted reference to a texture.  Textures are shared: by the
+// shapes that show them, and by textures that turn out to be copies
+// of others.  Each holds one of these, and the texture is deleted,
+// along with its OpenGL texture, when the last one goes.  A texture
+// made with new starts with no references, so the first handle made
+// from it takes it over.
+class mvTextureHandle {
+ private:
+  mvTexture* _texture;
+
+ public:
+  mvTextureHandle() : _texture(NULL) {};
+  explicit mvTextureHandle(mvTexture* texture);
+  mvTextureHandle(const mvTextureHandle& other);
+  mvTextureHandle& operator=(const mvTextureHandle& other);
+  ~mvTextureHandle();
+
+  mvTexture* get() const { return _texture; };
+  mvTexture* operator->() const { return _texture; };
+};
+
+// The kind of image file a texture is read from.  With textureAuto,
+// it's worked out from the file itself (see mvImageDecoderRegistry).
 typedef enum {
   texturePNG = 0,
   textureDDS = 1,
-  textureBMP = 2
+  textureBMP = 2,
+  textureJPG = 3,
+  textureAuto = 4
 } mvTextureType;
 
+// A texture for a shape.  The image file can be read as soon as the
+// object is made, or later in two steps: decode() reads the file, and
+// can be called from any thread, and load() sends it to OpenGL.  If
+// decode() hasn't been called by the time of load(), load() calls it.
+// See mvLoadQueue for why you'd want to do it that way.
 class mvTexture {
  private:
   GLfloat _width, _height;
 
+  mvTextureType _type;
+  std::string _fileName;
+
+  // The decoded image, between decode() and load().
+  mvImageData _image;
+  bool _decoded;
+  std::mutex _decodeMutex;
+
+  // The size of the decoded image, kept after it's gone to OpenGL.
+  size_t _byteSize;
+
+  // What the OpenGL texture takes, as counted by mvGPUMemory, and
+  // what it's counted as.  A copy of another texture takes nothing.
+  size_t _gpuBytes;
+  mvGPUMemoryCategory _memoryCategory;
+
+  // How many mvTextureHandles there are to this.
+  std::atomic<int> _referenceCount;
+  friend class mvTextureHandle;
+  friend class mvTextureCache;
+  void addReference() { _referenceCount++; };
+  void release();
+
+  // A texture from an mvTextureCache can turn out to have the same
+  // pixels as another one.  Then _original is the other one, whose
+  // OpenGL texture this one uses.
+  mvTextureCache* _cache;
+  mvTextureHandle _original;
+  uint64_t hashPixels();
+
+  // No copying; share a handle instead.
+  mvTexture(const mvTexture&);
+  mvTexture& operator=(const mvTexture&);
+
+  // Whether to trim the background off the image when it's decoded,
+  // and how many pixels of it to leave.  See setTrim().
+  bool _trim;
+  int _trimMargin;
+
+  // The part of the original image this texture holds, as (u0, v0,
+  // u1, v1) in the texture coordinates of the original.
+  MVec4 _cropWindow;
+  void trimToContent();
+
+  // Whether to work out which pixels are background when the image is
+  // decoded, instead of in the shader, and whether that was done.  See
+  // setKeyBackground().
+  bool _keyBackground;
+  bool _keyed;
+  void keyBackground();
+
+  // Most plankton images are gray, and need only one or two bytes a
+  // pixel instead of three or four.  This packs an RGB or RGBA image
+  // into GL_RED or GL_RG if nothing visible is lost, and
+  // expandChannels() undoes it for OpenGL versions that can't swizzle.
+  void packGray();
+  void expandChannels();
+
+  // Shrinks _image to the needed size, if it's bigger.  See
+  // setNeededSize().
+  void shrinkToNeededSize();
+
+  // Sets the filtering of an uncompressed texture just given to
+  // OpenGL, and makes its mipmaps if it gets them.
+  void setFiltering();
+
+  // See setKeep16Bit() and setNeededSize().
+  mvDecodeOptions _options;
+
   GLuint _textureAttribID;
   std::string _textureAttribName;
 
@@ -32,13 +139,67 @@ class mvTexture {
 
   GLuint _textureBufferID;
 
-  GLuint loadBMP(const std::string imagepath);
-  GLuint loadDDS(const std::string imagepath);
-  GLuint loadPNG(const std::string imagePath);
+  // Create the OpenGL texture from _image, and then let _image go.
+  void upload();
   
  public:
-  mvTexture(const mvTextureType t, const std::string fileName);
-  ~mvTexture() {};
+  // If deferred is true, the file isn't read until decode() or
+  // load().  Otherwise it is read and sent to OpenGL right away, so
+  // there has to be a current OpenGL context.
+  mvTexture(const mvTextureType t, const std::string fileName,
+            bool deferred = false);
+  // Use a handle instead of deleting it.  This needs the OpenGL
+  // context, if the texture has been loaded.
+  ~mvTexture();
+
+  // Read the image file.  This does no OpenGL calls, so it can be
+  // done on a worker thread, or several at once.  Calling it again
+  // does nothing.
+  void decode();
+
+  // Many images are mostly background: pixels the plankton shader
+  // doesn't draw, because they aren't gray (see isBackground() in
+  // texture.cpp).  With trimming on, decode() cuts the image down to
+  // the smallest rectangle that holds everything else, plus margin
+  // pixels on each side, and only that goes to OpenGL.  A shape using
+  // the texture should draw only the crop window.  This has to be set
+  // before decode(), so it only works with a deferred texture.
+  void setTrim(bool trim, int margin = 0) {
+    _trim = trim;
+    _trimMargin = margin;
+  };
+  MVec4 getCropWindow() { return _cropWindow; };
+
+  // The plankton shader draws a pixel only if its red and green are
+  // equal.  With this set, decode() does that test instead, once: the
+  // background is made transparent black and everything else opaque,
+  // premultiplied, to suit the blending (see keyRGBA8()).  Gray images
+  // go to OpenGL as gray and alpha, or just gray if there's no
+  // background, and others as RGBA.  Draw them with a shader that uses
+  // the texture's alpha, like KeyedShading.fragmentshader.  16-bit and
+  // compressed images can't be keyed, and aren't changed; isKeyed()
+  // says which happened, after decode(), and a shader set can name
+  // another to draw the ones that weren't (see
+  // mvShaderSet::setUnkeyedShaders()).  Set it before decode().
+  void setKeyBackground(bool key) { _keyBackground = key; };
+  bool isKeyed() { return _keyed; };
+
+  // PNGs with 16-bit samples are narrowed to 8 bits when they're
+  // decoded, unless this is set, in which case gray ones are kept as
+  // GL_R16, or GL_RG16 with alpha.  Set it before decode().
+  void setKeep16Bit(bool keep) { _options.keep16Bit = keep; };
+
+  // The most pixels across and down the texture can use, as when it
+  // can never take up more of the screen than that.  Zero means no
+  // limit.  A bigger image is shrunk to fit, keeping its shape, when
+  // it's decoded: a JPEG at a reduced scale as it's read, and then
+  // anything still too big with an area filter (see shrinkImage8()).
+  // Only images that are keyed are shrunk (see setKeyBackground()),
+  // and so only 8-bit, uncompressed ones.  Set it before decode().
+  void setNeededSize(int width, int height) {
+    _options.neededWidth = width;
+    _options.neededHeight = height;
+  };
 
   void load(GLuint programID);
   void draw(GLuint programID);
@@ -46,12 +207,42 @@ class mvTexture {
   void setTextureID(GLuint textureID) { _textureBufferID = textureID; };
   GLuint getTextureID() { return _textureBufferID; };
 
+  // The size of the decoded image in bytes, about what it takes on
+  // the GPU.  Zero until it's decoded.
+  size_t getByteSize() { return _byteSize; };
+
+  // What the OpenGL texture takes, as far as we can tell.  Zero until
+  // it's loaded.
+  size_t getGPUByteSize() { return _gpuBytes; };
+
+  // ROI images count as gpuTEXTURE, which is the default.  Set this
+  // before load() for textures that are something else.
+  void setMemoryCategory(mvGPUMemoryCategory category) { _memoryCategory = category; };
+
   GLfloat getWidth() { return _width; };
   GLfloat getHeight() { return _height; };
 
 };
-  
 
-  
+inline mvTextureHandle::mvTextureHandle(mvTexture* texture) : _texture(texture) {
+  if (_texture) _texture->addReference();
+}
+
+inline mvTextureHandle::mvTextureHandle(const mvTextureHandle& other) :
+  _texture(other._texture) {
+  if (_texture) _texture->addReference();
+}
+
+inline mvTextureHandle& mvTextureHandle::operator=(const mvTextureHandle& other) {
+  // Take the new reference first, in case it's the same texture.
+  if (other._texture) other._texture->addReference();
+  if (_texture) _texture->release();
+  _texture = other._texture;
+  return *this;
+}
+
+inline mvTextureHandle::~mvTextureHandle() {
+  if (_texture) _texture->release();
+}
 
 #endif
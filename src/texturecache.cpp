@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <limits.h>
+
+#include "texturecache.h"
+
+mvTextureCache::~mvTextureCache() {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  for (std::map<mvTexture*, entry>::iterator it = _entries.begin();
+       it != _entries.end(); it++)
+    it->first->_cache = NULL;
+}
+
+mvTextureHandle mvTextureCache::get(mvTextureType type, const std::string& fileName) {
+  return get(type, fileName, _options);
+}
+
+mvTextureHandle mvTextureCache::get(mvTextureType type, const std::string& fileName,
+                                    const mvDecodeOptions& options) {
+
+  // A file that can't be found keeps its name; the decoder will
+  // complain about it later.
+  std::string path = fileName;
+  char* canonical = realpath(fileName.c_str(), NULL);
+  if (canonical) {
+    path = canonical;
+    free(canonical);
+  }
+
+  // Unkeyed images are never shrunk, so the needed size doesn't make
+  // them any different.
+  int neededWidth = _keyBackground ? options.neededWidth : 0;
+  int neededHeight = _keyBackground ? options.neededHeight : 0;
+
+  std::stringstream key;
+  key << path << "|" << type << "|" << _trim << ":" << _trimMargin << "|"
+      << _keyBackground << "|"
+      << options.keep16Bit << ":" << neededWidth << "x" << neededHeight;
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  std::map<std::string, mvTexture*>::iterator it = _byKey.find(key.str());
+  if (it != _byKey.end()) {
+    _entries[it->second].handedOut++;
+    return mvTextureHandle(it->second);
+  }
+
+  mvTexture* texture = new mvTexture(type, path, true);
+  texture->_cache = this;
+  if (_trim) texture->setTrim(true, _trimMargin);
+  texture->setKeyBackground(_keyBackground);
+  texture->setKeep16Bit(options.keep16Bit);
+  texture->setNeededSize(neededWidth, neededHeight);
+
+  _byKey[key.str()] = texture;
+  _entries[texture].key = key.str();
+  _entries[texture].handedOut = 1;
+  return mvTextureHandle(texture);
+}
+
+mvTextureHandle mvTextureCache::findDuplicate(mvTexture* texture, uint64_t pixelHash) {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  entry& e = _entries[texture];
+  e.hashed = true;
+  e.pixelHash = pixelHash;
+
+  std::map<uint64_t, mvTexture*>::iterator it = _byHash.find(pixelHash);
+  if (it == _byHash.end()) {
+    _byHash[pixelHash] = texture;
+    return mvTextureHandle();
+  }
+
+  e.duplicate = true;
+  return mvTextureHandle(it->second);
+}
+
+void mvTextureCache::release(mvTexture* texture) {
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (--texture->_referenceCount > 0) return;
+
+    std::map<mvTexture*, entry>::iterator it = _entries.find(texture);
+    if (it != _entries.end()) {
+      _byKey.erase(it->second.key);
+      if (it->second.hashed && !it->second.duplicate)
+        _byHash.erase(it->second.pixelHash);
+      _entries.erase(it);
+    }
+    texture->_cache = NULL;
+  }
+
+  // Outside the lock, since a copy lets go of its original here.
+  delete texture;
+}
+
+std::string mvTextureCache::print() const {
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  // Every reference after the first to a texture saves a texture, and
+  // so does every texture that turned out to be a copy of another.
+  int references = 0, sharedByPath = 0, duplicates = 0;
+  size_t bytesSaved = 0;
+  for (std::map<mvTexture*, entry>::const_iterator it = _entries.begin();
+       it != _entries.end(); it++) {
+    references += it->second.handedOut;
+    sharedByPath += it->second.handedOut - 1;
+    bytesSaved += (it->second.handedOut - 1) * it->first->getByteSize();
+    if (it->second.duplicate) {
+      duplicates++;
+      bytesSaved += it->first->getByteSize();
+    }
+  }
+
+  std::stringstream out;
+  out << "Textures: " << references << " references to " << _entries.size()
+      << " files; " << sharedByPath << " shared by path, "
+      << duplicates << " more with identical pixels; "
+      << _entries.size() - duplicates << " distinct, "
+      << bytesSaved / (1024.0 * 1024.0) << " MB saved.";
+  return out.str();
+}
+
+std::ostream & operator<<(std::ostream &os, const mvTextureCache& cache) {
+  return os << cache.print();
+}
@@ -0,0 +1,97 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <sstream>
+#include <map>
+#include <set>
+#include <mutex>
+
+#include "texture.h"
+
+// Reports often show the same image many times, either by naming the
+// same file again or with byte-for-byte copies under other names.
+// This makes sure each distinct image is decoded, and sent to OpenGL,
+// only once.
+//
+// get() hands out one texture per file and set of decoding settings,
+// going by the canonical path, so "a/../b.png" and "b.png" are the
+// same.  Then, when a texture has been decoded, its pixels are hashed,
+// and if another texture already had the same pixels, the new one lets
+// its copy go and borrows the other's OpenGL texture (see
+// mvTexture::decode()).
+//
+// The cache doesn't keep textures alive.  They belong to the handles
+// given out, and when the last one goes, the texture drops out of the
+// cache and is deleted.  Textures that outlive the cache carry on
+// without it.
+class mvTextureCache {
+ private:
+
+  // What the cache knows about each texture.
+  struct entry {
+    std::string key;
+    int handedOut;
+    bool hashed;
+    uint64_t pixelHash;
+    bool duplicate;
+    entry() : handedOut(0), hashed(false), pixelHash(0), duplicate(false) {};
+  };
+
+  std::map<std::string, mvTexture*> _byKey;
+  std::map<uint64_t, mvTexture*> _byHash;
+  std::map<mvTexture*, entry> _entries;
+
+  // Textures are decoded and released on different threads.
+  mutable std::mutex _mutex;
+
+  // Applied to the textures get() makes, and part of the key.
+  bool _trim;
+  int _trimMargin;
+  bool _keyBackground;
+  mvDecodeOptions _options;
+
+  friend class mvTexture;
+  void release(mvTexture* texture);
+
+  // No copying.
+  mvTextureCache(const mvTextureCache&);
+  mvTextureCache& operator=(const mvTextureCache&);
+
+ public:
+  mvTextureCache() : _trim(false), _trimMargin(0), _keyBackground(false) {};
+  ~mvTextureCache();
+
+  // A deferred texture for the file, shared with everyone else who
+  // asks for the same one with the same settings.
+  mvTextureHandle get(mvTextureType type, const std::string& fileName);
+
+  // The same, decoded with other options, like a needed size of its
+  // own (see mvTexture::setNeededSize()).  Only textures with the same
+  // options are shared this way, but copies are still found by their
+  // pixels.
+  mvTextureHandle get(mvTextureType type, const std::string& fileName,
+                      const mvDecodeOptions& options);
+
+  // How the textures made from here on are decoded.  See
+  // mvTexture::setTrim(), setKeyBackground(), setKeep16Bit() and
+  // setNeededSize().
+  void setTrim(bool trim, int margin = 0) {
+    _trim = trim;
+    _trimMargin = margin;
+  };
+  void setKeyBackground(bool key) { _keyBackground = key; };
+  void setDecodeOptions(const mvDecodeOptions& options) { _options = options; };
+  mvDecodeOptions getDecodeOptions() { return _options; };
+
+  // Called by a texture once it's decoded.  Returns an earlier texture
+  // with the same pixels, or an empty handle if this is the first.
+  mvTextureHandle findDuplicate(mvTexture* texture, uint64_t pixelHash);
+
+  // How much sharing there is among the textures alive now.
+  std::string print() const;
+  friend std::ostream & operator<<(std::ostream &os, const mvTextureCache& cache);
+};
+
+#endif
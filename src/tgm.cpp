@@ -1,7 +1,13 @@
 #include <iostream>
 #include <vector>
 #include <list>
+#include <map>
+#include <algorithm>
+#include <set>
+#include <chrono>
+#include <future>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -16,20 +22,17 @@
 #include "objloader.h"
 
 #include "mvShape.h"
+#include "loadqueue.h"
+#include "depthsort.h"
+#include "scenegraph.h"
+#include "roitable.h"
+#include "roiscene.h"
+#include "texturecache.h"
+#include "gpumemory.h"
+#include "lightclusters.h"
 #include "tinyxml2.h"
 #include "MVR.h"
 
-// This class holds information about the image of plankton we're going to show.
-class ImageToDisplay {
-public:
-  std::string fileName;
-  float x, y, z;
-  float height, width;
-
-  ImageToDisplay(std::string f, float xx, float yy, float zz, float h, float w) :
-    fileName(f), x(xx), y(yy), z(zz), height(h), width(w) {};
-}; 
-
 
 class mvImageApp : public MinVR::VREventHandler, public MinVR::VRRenderHandler {
 private:
@@ -39,13 +42,145 @@ private:
   float _xpos, _ypos, _zpos, _stepDist;
   bool _initialized;
 
-  std::list<ImageToDisplay> _images;
+  // The reports to show, in order, and the one on display.  With one
+  // report, it's watched for changes.  With more, they're played back
+  // as a sequence, one scene at a time.
+  std::vector<std::string> _reportNames;
+  size_t _current;
+
+  // The scene on display, and the ROIs main() read for it.
+  mvROITable _rois;
+  mvROIScene* _roiScene;
+
+  // The report is checked every _reportCheckSeconds, and if it's been
+  // rewritten, the scene is changed to match.  See
+  // mvROIScene::update().
+  time_t _reportTime;
+  off_t _reportSize;
+  double _reportCheckSeconds;
+  std::chrono::steady_clock::time_point _lastReportCheck;
+
+  // Called each frame.  If the report has been rewritten, starts
+  // reading it again on another thread, into _nextROIs, as
+  // stepPlayback() reads the next report of a sequence, and once
+  // that's done, changes the scene to match.  Only the rendering
+  // waits on the changes, not on the reading.
+  void stepReload();
+
+  // Whether the report has changed since we last looked.  Only looks
+  // every _reportCheckSeconds.
+  bool reportChanged();
+
+  // Playing back a sequence.  While one report is on display, the one
+  // after it is read on another thread into _nextROIs, and then made
+  // into _nextScene, which loads a bit each frame alongside the one
+  // on display but isn't drawn.  When it's time to move on, and
+  // _nextScene is all there, the two are swapped between frames.  The
+  // scenes share the texture cache, so an image in both is loaded
+  // once, and stays loaded through the swap.
+  //
+  // _wanted is the report to show next, and _next the one being read
+  // or in _nextScene, which differ for a moment when the N or P key
+  // changes our mind.  The scene taken off display is deleted a bit at
+  // a time, from _retiredScenes.
+  //
+  // With just one report, _nextROIs and _nextParse are used by
+  // stepReload() instead.
+  size_t _wanted, _next;
+  int _direction;
+  mvROITable _nextROIs;
+  std::future<bool> _nextParse;
+  mvROIScene* _nextScene;
+  std::vector<mvROIScene*> _retiredScenes;
+
+  // How long each report is shown for when playing, and whether it's
+  // playing.  The space bar starts and stops it.  Once it's time to
+  // move on, _advance is set until the swap happens.
+  double _playSeconds;
+  bool _playing;
+  bool _advance;
+  std::chrono::steady_clock::time_point _shownSince;
+
+  // Makes a scene for a report, with the filter set.  It isn't hung
+  // from anything yet.
+  mvROIScene* createScene(const mvROITable& rois, const std::string& reportName);
+
+  // Starts on the way to another report.
+  void showReport(size_t report, int direction);
+
+  // Called each frame, with whatever's left of the load budget, to do
+  // the next bit of getting the next scene ready, and to swap it in
+  // when it's time.
+  void stepPlayback(double budgetMs);
+
+  // What the ROI images are drawn with, and whether their background
+  // is keyed out ahead of time, which needs a shader of its own.  With
+  // it keyed, each image can also be lit once, on the CPU, instead of
+  // at every pixel.
+  mvShaderSet* _roiShaders;
+  bool _keyBackground;
+  bool _flatLighting;
+
+  // For scenes with more lights than are worth looping over at every
+  // pixel, the lights can be binned into clusters of the view, for
+  // each eye, and each pixel lit by just the ones that reach it.  See
+  // lightclusters.h.  _lightCutoff, if more than zero, is how dim a
+  // light gets before it's cut off.
+  bool _clusteredLighting;
+  float _lightCutoff;
+  mvLightClusters* _lightClusters;
+
+  // Which ROIs to show, like "ESD=100:400 CLASS=copepod,diatom".  See
+  // mvROIFilter::parse().  The F key turns it on and off, in every
+  // scene.
+  std::string _filterText;
+  bool _filtering;
+
+  // Shapes are loaded a few at a time, a frame at a time, so the
+  // display stays live while a big report loads.  Each frame spends
+  // at most _loadBudgetMs milliseconds on it, shared among the scenes.
+  // The scenes all load through _loadQueue, so there is one set of
+  // worker threads however many scenes there are.
+  double _loadBudgetMs;
+  bool _loading;
+  mvLoadQueue _loadQueue;
+
+  // Each image file is read once, however many times the reports
+  // name it, and copies of one image share a texture.  The shapes
+  // hold the textures, and the last one to go deletes it.
+  mvTextureCache _textureCache;
+
+  // No ROI image is read at more pixels than it could ever cover on
+  // the screen, which depends on how sharp the sharpest display is, in
+  // pixels per radian at its center, and how close the viewer can get
+  // to an image.  See mvROIScene::setTextureLimit().
+  float _pixelsPerRadian;
+  float _minViewDistance;
+
+  // A single big image, shown from a tile file as a virtual texture,
+  // behind the ROIs.  The config's /VirtualTexture names the file (see
+  // vtbuild.cpp), and the image is _backdropWidth wide, at z of
+  // _backdropDepth, in the scene's coordinates.
+  std::string _backdropFile;
+  float _backdropWidth;
+  float _backdropDepth;
+  mvShapeVirtualRect* _backdrop;
+
+  // The images are blended with the depth test off, so they have to
+  // be drawn back to front.  This works out the order for each eye.
+  mvDepthSorter _depthSorter;
   
 public:
   
-  std::list<mvShape*> _shapeList;
+  // The factory keeps each type of shape together in memory (see
+  // shapepool.h), so going through them in order is cheap.
   mvShapeFactory _shapeFactory;
 
+  // The transforms above the shapes.  The scene on display hangs from
+  // _roiNode, so the images can be moved together.
+  mvTransformNode _scene;
+  mvTransformNode _roiNode;
+
   // We keep track of these because multiple shapes can use the same
   // shaders and multiple shaders can use the same lights.  So they
   // have to be tracked outside their meager little boundaries,
@@ -53,8 +188,19 @@ public:
   std::list<mvShaderSet*> _shaderList;
   std::list<mvLights*> _lightList;
   
-  mvImageApp(int argc, char** argv, std::list<ImageToDisplay> images) :
-    _initialized(false), _quit(false), _images(images) {
+  mvImageApp(int argc, char** argv, const mvROITable& rois,
+             const std::vector<std::string>& reportNames) :
+    _initialized(false), _quit(false), _reportNames(reportNames),
+    _current(0), _rois(rois), _roiScene(NULL),
+    _reportTime(0), _reportSize(0), _reportCheckSeconds(1.0),
+    _wanted(0), _next(0), _direction(1), _nextScene(NULL),
+    _playSeconds(0.0), _playing(false), _advance(false),
+    _roiShaders(NULL), _keyBackground(true), _flatLighting(true),
+    _clusteredLighting(false), _lightCutoff(0.0f), _lightClusters(NULL),
+    _filtering(false),
+    _loadBudgetMs(8.0), _loading(false),
+    _pixelsPerRadian(1200.0f), _minViewDistance(0.5f),
+    _backdropWidth(40.0f), _backdropDepth(-50.0f), _backdrop(NULL) {
 
     _vrMain = new MinVR::VRMain();
     std::string configFile = argv[1];
@@ -73,10 +219,141 @@ public:
     _vrMain->getConfig()->addData("/HeadLocation/HorizAngle", _horizAngle);
     _vrMain->getConfig()->addData("/HeadLocation/VertAngle", _vertAngle);
 
+    // How far off, in pixels, a simplified mesh may be before we draw
+    // a more detailed one.  Bigger is faster.
+    if (_vrMain->getConfig()->exists("/LODPixelError")) {
+      mvShapeObj::setMaxPixelError(
+        (double)_vrMain->getConfig()->getValue("/LODPixelError"));
+    }
+
+    // How long each frame may spend loading shapes, in milliseconds.
+    if (_vrMain->getConfig()->exists("/LoadBudgetMs")) {
+      _loadBudgetMs = (double)_vrMain->getConfig()->getValue("/LoadBudgetMs");
+    }
+
+    // The images are trimmed to their contents when they're read,
+    // less this many pixels of background around the edges.  Negative
+    // turns trimming off.  See mvTexture::setTrim().
+    int trimMargin = 0;
+    if (_vrMain->getConfig()->exists("/TrimMargin")) {
+      trimMargin = (int)_vrMain->getConfig()->getValue("/TrimMargin");
+    }
+    if (trimMargin >= 0) _textureCache.setTrim(true, trimMargin);
+
+    // The background of the images is keyed out when they're read,
+    // and they're drawn with a shader that doesn't have to look for it,
+    // unless this is set to 0.  Compressed images aren't keyed, so they
+    // need it off.  See mvTexture::setKeyBackground().
+    if (_vrMain->getConfig()->exists("/KeyBackground")) {
+      _keyBackground = (int)_vrMain->getConfig()->getValue("/KeyBackground") != 0;
+    }
+    _textureCache.setKeyBackground(_keyBackground);
+
+    // The images are flat, and small next to how far away the lights
+    // are, so unless this is set to 0, each is lit once as it's drawn
+    // rather than at every pixel.  See mvShaderSet::setFlatLighting().
+    if (_vrMain->getConfig()->exists("/FlatLighting")) {
+      _flatLighting = (int)_vrMain->getConfig()->getValue("/FlatLighting") != 0;
+    }
+
+    // With this set to 1, the images are lit from clusters of lights
+    // instead, which suits many lights, each reaching only part of the
+    // scene, better.  It needs the background keyed.  /LightCutoff is
+    // the fraction of a light's color below which it's dropped.
+    if (_vrMain->getConfig()->exists("/ClusteredLighting")) {
+      _clusteredLighting =
+        (int)_vrMain->getConfig()->getValue("/ClusteredLighting") != 0;
+    }
+    if (_vrMain->getConfig()->exists("/LightCutoff")) {
+      _lightCutoff = (double)_vrMain->getConfig()->getValue("/LightCutoff");
+    }
+
+    // Warn when the textures and buffers take more than this many
+    // megabytes of GPU memory.
+    if (_vrMain->getConfig()->exists("/GPUMemoryBudgetMB")) {
+      double budgetMB =
+        (double)_vrMain->getConfig()->getValue("/GPUMemoryBudgetMB");
+      mvGPUMemory::setBudget((size_t)(budgetMB * 1024.0 * 1024.0));
+    }
+
+    // Which ROIs to show, like "ESD=100:400 CLASS=copepod,diatom".  See
+    // mvROIFilter::parse().  A filter given here starts out on.
+    if (_vrMain->getConfig()->exists("/ROIFilter")) {
+      _filterText = (std::string)_vrMain->getConfig()->getValue("/ROIFilter");
+      _filtering = true;
+    }
+
+    // With a sequence of reports, how many seconds to show each one
+    // for.  Zero or less means they're stepped through with the N and
+    // P keys instead.
+    if (_vrMain->getConfig()->exists("/PlaybackSeconds")) {
+      _playSeconds = (double)_vrMain->getConfig()->getValue("/PlaybackSeconds");
+    }
+    _playing = (_playSeconds > 0.0);
+    _wanted = (_reportNames.size() > 1) ? 1 : 0;
+
+    // The most pixels a radian of the view covers on the sharpest of
+    // the displays.  A 1920-pixel wall seen across 90 degrees has
+    // about 1200.  Zero or less reads every image at full size.
+    if (_vrMain->getConfig()->exists("/PixelsPerRadian")) {
+      _pixelsPerRadian =
+        (double)_vrMain->getConfig()->getValue("/PixelsPerRadian");
+    }
+
+    // The closest, in scene units, that the viewer can get to an
+    // image, wherever they can move to.
+    if (_vrMain->getConfig()->exists("/MinViewDistance")) {
+      _minViewDistance =
+        (double)_vrMain->getConfig()->getValue("/MinViewDistance");
+    }
+
+    // A big image to show behind the ROIs, as a tile file.
+    if (_vrMain->getConfig()->exists("/VirtualTexture")) {
+      _backdropFile = (std::string)_vrMain->getConfig()->getValue("/VirtualTexture");
+    }
+    if (_vrMain->getConfig()->exists("/VirtualTextureWidth")) {
+      _backdropWidth =
+        (double)_vrMain->getConfig()->getValue("/VirtualTextureWidth");
+    }
+    if (_vrMain->getConfig()->exists("/VirtualTextureDepth")) {
+      _backdropDepth =
+        (double)_vrMain->getConfig()->getValue("/VirtualTextureDepth");
+    }
+
+    // How often to check whether the report has been rewritten.  Zero
+    // or less means never.  We start from the version main() read.
+    if (_vrMain->getConfig()->exists("/ReportCheckSeconds")) {
+      _reportCheckSeconds =
+        (double)_vrMain->getConfig()->getValue("/ReportCheckSeconds");
+    }
+    struct stat info;
+    if (stat(_reportNames[0].c_str(), &info) == 0) {
+      _reportTime = info.st_mtime;
+      _reportSize = info.st_size;
+    }
+    _lastReportCheck = std::chrono::steady_clock::now();
+
   };
 
   ~mvImageApp() {
 
+    // The scenes delete their shapes, so do this while there's still
+    // an OpenGL context.  A report still being read has to be finished
+    // first.
+    if (_nextParse.valid()) _nextParse.wait();
+    delete _roiScene;
+    delete _nextScene;
+    delete _backdrop;
+    for (size_t i = 0; i < _retiredScenes.size(); i++) {
+      delete _retiredScenes[i];
+    }
+
+    // And the shapes they still had loading, once the workers are
+    // done with them.
+    while (!_loadQueue.deleteCancelled(1000.0)) std::this_thread::yield();
+
+    delete _lightClusters;
+
     for (std::list<mvLights*>::iterator it = _lightList.begin();
          it != _lightList.end(); it++) {
       delete *it;
@@ -88,11 +365,6 @@ public:
       delete *it;
     }
 
-    for (std::list<mvShape*>::iterator it = _shapeList.begin();
-         it != _shapeList.end(); it++) {
-      delete *it;
-    }
-
     // Close OpenGL window and terminate GLFW
     // glfwTerminate();
     _vrMain->shutdown();
@@ -168,6 +440,33 @@ public:
     } else if ((eventName == "KbdX_Down") || (eventName == "Kbdx_Down") ||
                (eventName == "KbdX_Repeat")) {
       _ypos -= _stepDist;
+
+    } else if ((eventName == "KbdF_Down") || (eventName == "Kbdf_Down")) {
+      // Turn the ROI filter on or off.
+      if (_roiScene && _roiScene->hasFilter()) {
+        _filtering = !_filtering;
+        _roiScene->setFiltering(_filtering);
+        if (_nextScene) _nextScene->setFiltering(_filtering);
+        std::cout << "ROI filter " << (_filtering ? "on" : "off") << std::endl;
+      }
+
+    } else if ((eventName == "KbdN_Down") || (eventName == "Kbdn_Down")) {
+      // On to the next report in the sequence.
+      if (_reportNames.size() > 1)
+        showReport((_current + 1) % _reportNames.size(), 1);
+
+    } else if ((eventName == "KbdP_Down") || (eventName == "Kbdp_Down")) {
+      // Back to the previous one.
+      if (_reportNames.size() > 1)
+        showReport((_current + _reportNames.size() - 1) % _reportNames.size(), -1);
+
+    } else if (eventName == "KbdSpace_Down") {
+      // Start or stop playing the sequence.
+      if (_reportNames.size() > 1 && _playSeconds > 0.0) {
+        _playing = !_playing;
+        _shownSince = std::chrono::steady_clock::now();
+        std::cout << "Playback " << (_playing ? "on" : "off") << std::endl;
+      }
     }
       
     if (_horizAngle > 6.283185) _horizAngle -= 6.283185;
@@ -249,13 +548,73 @@ public:
       
       //////////////////////////////////////////////////////////
       // Create and compile our GLSL program from the shaders
-      mvShaderSet* shaders =
-        new mvShaderSet("../src/StandardShading.vertexshader",
-                        "",
-                        "../src/PlanktonShading.fragmentshader",
-                        lights);
+      mvShaderSet* shaders;
+      if (_keyBackground && _clusteredLighting) {
+        _lightClusters = new mvLightClusters(lights);
+        if (_lightCutoff > 0.0f) _lightClusters->setCutoff(_lightCutoff);
+        shaders = new mvShaderSet("../src/ClusteredShading.vertexshader",
+                                  "",
+                                  "../src/ClusteredShading.fragmentshader",
+                                  lights);
+        shaders->setLightClusters(_lightClusters);
+      } else if (_keyBackground && _flatLighting) {
+        shaders = new mvShaderSet("../src/FlatShading.vertexshader",
+                                  "",
+                                  "../src/FlatShading.fragmentshader",
+                                  lights);
+        shaders->setFlatLighting(true);
+      } else {
+        shaders = new mvShaderSet("../src/StandardShading.vertexshader",
+                                  "",
+                                  _keyBackground ?
+                                  "../src/KeyedShading.fragmentshader" :
+                                  "../src/PlanktonShading.fragmentshader",
+                                  lights);
+      }
       _shaderList.push_back(shaders);
+      _roiShaders = shaders;
+
+      // Compressed and 16-bit images can't be keyed, so they're drawn
+      // with the shader that finds the background itself.
+      if (_keyBackground) {
+        mvShaderSet* unkeyedShaders =
+          new mvShaderSet("../src/StandardShading.vertexshader",
+                          "",
+                          "../src/PlanktonShading.fragmentshader",
+                          lights);
+        _shaderList.push_back(unkeyedShaders);
+        shaders->setUnkeyedShaders(unkeyedShaders);
+      }
     
+      // The backdrop, if there is one, has a shader of its own, that
+      // reads the tiles.  It's one shape, so it's loaded right here.
+      if (!_backdropFile.empty()) {
+        mvShaderSet* virtualShaders =
+          new mvShaderSet("../src/StandardShading.vertexshader",
+                          "",
+                          "../src/VirtualShading.fragmentshader",
+                          lights);
+        _shaderList.push_back(virtualShaders);
+
+        _backdrop = (mvShapeVirtualRect*)
+          _shapeFactory.createShape(shapeVIRTUAL, virtualShaders, NULL);
+        if (_backdrop->setTileFile(_backdropFile)) {
+          mvVirtualTexture* image = _backdrop->getVirtualTexture();
+          _backdrop->setDimensions(_backdropWidth, _backdropWidth *
+                                   image->getHeight() / image->getWidth());
+          _backdrop->setPosition(0.0f, 0.0f, _backdropDepth);
+          _backdrop->load();
+          _scene.addShape(_backdrop);
+        } else {
+          delete _backdrop;
+          _backdrop = NULL;
+        }
+      }
+
+      // Meshes are the shapes with enough vertices for the vertex
+      // format to matter.  Store theirs compactly.
+      _shapeFactory.setVertexLayout(shapeOBJ, vertexQUANTIZED);
+
       // Switch to axes.  These use the default shader, which you get
       // by initializing the shader object with no args.
       //      mvShaderSet* axisShaders = new mvShaderSet();
@@ -264,28 +623,13 @@ public:
       //////////////////////////////////////////////////////////
       // Create objects to display
       // mvShape* axes = _shapeFactory.createShape(shapeAXES, axisShaders);
-      // _shapeList.push_back(axes);
+      // _shapes.push_back(axes);
 
-      int width, height;
-    
-      for (std::list<ImageToDisplay>::iterator it = _images.begin();
-           it != _images.end(); it++) {
-        //        if (it->width < 100.0) continue;
-        
-        // Add the appropriate shader and texture to this object.
-        mvTexture* tex = new mvTexture(texturePNG, it->fileName);
-
-        // Create a rectangle with the new texture and our favorite shader.
-        _shapeList.push_back(_shapeFactory.createShape(shapeRECT, shaders, tex));
-
-        width = tex->getWidth();
-        height = tex->getHeight();
-
-        // Size the object and place it in the scene.
-        _shapeList.back()->setDimensions(it->width/100.0, it->height/100.0);
-        _shapeList.back()->setPosition(it->x/100.0, -4 + it->y/100.0, it->z/(-5000.0));
-	//_shapeList.back()->setRotation(MQuat(0.0, 1.0, 0.0, 1.0));
-      }
+      // The scene for the first report, which has its own copy of the
+      // ROIs.  Its shapes are made and loaded below, a few each frame.
+      _roiScene = createScene(_rois, _reportNames[0]);
+      _rois = mvROITable();
+      _loading = true;
 
       // mvTexture* officeTex = new mvTexture(texturePNG, "../data/office-test.png");
       
@@ -293,16 +637,46 @@ public:
       // ((mvShapeObj*)suzanne)->setObjFile("suzanne.obj");
       // //((mvShapeObj*)suzanne)->setObjFile("../data/office-test.obj");
       // suzanne->setPosition(MVec3(0.0, 0.0, -18.0));
-      // _shapeList.push_back(suzanne);
+      // _loadQueue->add(suzanne);
 
-      
-      // Load all the shapes.  Initializes whatever needs to be
-      // initialized, etc.    
-      for (std::list<mvShape*>::iterator it = _shapeList.begin();
-           it != _shapeList.end(); it++) (*it)->load();
+      // The report's coordinates put the images a little high.
+      _scene.addChild(&_roiNode);
+      _roiNode.setPosition(0.0, -4.0, 0.0);
+      _roiNode.addChild(_roiScene->getNode());
+      _shownSince = std::chrono::steady_clock::now();
 
       _initialized = true;
+
+    } else if (_reportNames.size() == 1) {
+      stepReload();
+    }
+
+    // Bring in whatever shapes are ready, for the scene on display
+    // first.  They get drawn from then on.  The next scene in a
+    // sequence gets what's left of the time.
+    double usedMs = _roiScene->step(_loadBudgetMs);
+    if (_reportNames.size() > 1) stepPlayback(_loadBudgetMs - usedMs);
+
+    if (_loading && _roiScene->isLoaded()) {
+      _loading = false;
+      std::cout << "Loaded " << _roiScene->getShapes().size() << " shapes."
+                << std::endl;
+      std::cout << _shapeFactory;
+      std::cout << _textureCache << std::endl;
+      std::cout << mvGPUMemory::print() << std::endl;
     }
+
+    // The shapes may have moved, or new ones arrived, or the scene
+    // changed, since the last frame, so the depth order has to be
+    // worked out again.
+    _depthSorter.newFrame();
+
+    // Work out where everything that moved, or was added, is now.
+    _scene.update();
+
+    // The backdrop's tiles are loaded once a frame, for all the views
+    // drawn last frame, so the eyes and walls see the same ones.
+    if (_backdrop) _backdrop->update();
   }
 
   void draw(MMat4 ViewMatrix, MMat4 ProjectionMatrix) {
@@ -310,9 +684,21 @@ public:
     // Clear the screen
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
-    // Now draw the objects.
-    for (std::list<mvShape*>::iterator it = _shapeList.begin();
-         it != _shapeList.end(); it++) {
+    // What every shape in this view shares, worked out once.
+    mvShape::beginView(ViewMatrix);
+
+    // The lights are binned for this eye before anything lit by them
+    // is drawn.
+    if (_lightClusters) _lightClusters->update(ViewMatrix, ProjectionMatrix);
+
+    // The backdrop is behind everything else.
+    if (_backdrop) _backdrop->draw(ViewMatrix, ProjectionMatrix);
+
+    // Now draw the objects that are in view, farthest first.
+    const std::vector<mvShape*>& order =
+      _depthSorter.sort(_roiScene->getDrawShapes(), ViewMatrix, ProjectionMatrix);
+    for (std::vector<mvShape*>::const_iterator it = order.begin();
+         it != order.end(); it++) {
       (*it)->draw(ViewMatrix, ProjectionMatrix);
     }
   };
@@ -410,11 +796,153 @@ public:
   
 
 
+// How long it's been since start, in milliseconds.
+static double msSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>
+    (std::chrono::steady_clock::now() - start).count();
+}
+
+bool mvImageApp::reportChanged() {
+
+  if (_reportCheckSeconds <= 0.0) return false;
+
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (std::chrono::duration<double>(now - _lastReportCheck).count() <
+      _reportCheckSeconds) return false;
+  _lastReportCheck = now;
+
+  struct stat info;
+  if (stat(_reportNames[0].c_str(), &info) != 0) return false;
+  if (info.st_mtime == _reportTime && info.st_size == _reportSize) return false;
+
+  _reportTime = info.st_mtime;
+  _reportSize = info.st_size;
+  return true;
+}
+
+void mvImageApp::stepReload() {
+
+  // A report caught half written won't read.  Try it again at the
+  // next check.
+  if (_nextParse.valid() &&
+      _nextParse.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+    if (_nextParse.get() && _roiScene->update(_nextROIs)) {
+      _loading = true;
+    } else {
+      _reportTime = 0;
+    }
+    _nextROIs = mvROITable();
+  }
+
+  // One read at a time.  A rewrite during the read is seen at the
+  // next check after it.
+  if (!_nextParse.valid() && reportChanged()) {
+    _nextParse = std::async(std::launch::async, &mvROITable::load,
+                            &_nextROIs, _reportNames[_current]);
+  }
+}
+
+mvROIScene* mvImageApp::createScene(const mvROITable& rois,
+                                    const std::string& reportName) {
+
+  // The images are in the same directory as the report.
+  size_t slash = reportName.find_last_of("/");
+  std::string imageDir =
+    (slash == std::string::npos) ? "." : reportName.substr(0, slash);
+
+  // A report without the fields that place the images gives an empty
+  // scene.
+  mvROIScene* scene =
+    new mvROIScene(&_shapeFactory, &_loadQueue, &_textureCache, _roiShaders,
+                   imageDir);
+  scene->setTextureLimit(_pixelsPerRadian, _minViewDistance);
+  scene->update(rois);
+  scene->setFilter(_filterText, _filtering);
+  return scene;
+}
+
+void mvImageApp::showReport(size_t report, int direction) {
+
+  _wanted = report;
+  _direction = direction;
+  _advance = true;
+
+  // A next scene for some other report won't be needed.
+  if (_nextScene && _next != _wanted) {
+    _retiredScenes.push_back(_nextScene);
+    _nextScene = NULL;
+  }
+}
+
+void mvImageApp::stepPlayback(double budgetMs) {
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  size_t nReports = _reportNames.size();
+
+  if (_playing && std::chrono::duration<double>(start - _shownSince).count() >=
+      _playSeconds) _advance = true;
+
+  // Swap in the next scene if it's time, and it's ready.  This is
+  // before anything is drawn this frame, so the whole frame shows one
+  // scene.
+  if (_advance && _nextScene && _nextScene->isLoaded()) {
+    _roiNode.removeChild(_roiScene->getNode());
+    _retiredScenes.push_back(_roiScene);
+    _roiScene = _nextScene;
+    _nextScene = NULL;
+    _roiNode.addChild(_roiScene->getNode());
+
+    _current = _next;
+    _wanted = (_current + nReports + _direction) % nReports;
+    _advance = false;
+    _shownSince = start;
+    std::cout << "Showing " << _reportNames[_current] << " ("
+              << _roiScene->getShapes().size() << " shapes)" << std::endl;
+  }
+
+  // A report that's been read becomes the next scene, unless we've
+  // changed our mind about which one is next.  One that can't be read
+  // is skipped.
+  if (_nextParse.valid() &&
+      _nextParse.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+    bool read = _nextParse.get();
+    if (_next == _wanted) {
+      if (read) {
+        _nextScene = createScene(_nextROIs, _reportNames[_next]);
+      } else {
+        std::cerr << "Skipping " << _reportNames[_next] << std::endl;
+        _wanted = (_next + nReports + _direction) % nReports;
+      }
+    }
+    _nextROIs = mvROITable();
+  }
+
+  // Start reading the next report, if nothing else is.  It can take a
+  // while, so it's done on another thread.
+  if (!_nextParse.valid() && _nextScene == NULL && _wanted != _current) {
+    _next = _wanted;
+    _nextParse = std::async(std::launch::async, &mvROITable::load,
+                            &_nextROIs, _reportNames[_next]);
+  }
+
+  // Take down the old scenes, and whatever they still had loading.
+  // Neither waits on the load queue's workers.
+  while (!_retiredScenes.empty() && msSince(start) < budgetMs) {
+    if (!_retiredScenes[0]->clear(budgetMs - msSince(start))) break;
+    delete _retiredScenes[0];
+    _retiredScenes.erase(_retiredScenes.begin());
+  }
+  if (msSince(start) < budgetMs)
+    _loadQueue.deleteCancelled(budgetMs - msSince(start));
+
+  // And load some more of the next one.
+  if (_nextScene && msSince(start) < budgetMs)
+    _nextScene->step(budgetMs - msSince(start));
+}
+
 int main( int argc, char **argv )
 {
 
-  std::list<ImageToDisplay> images;
-  
   // std::cout << "argc: " << argc << std::endl;
   // for (int i = 0; i < argc; i++) {
   //   std::cout << "    [" << i << "]: " << std::string(argv[i]) << std::endl;
@@ -422,44 +950,26 @@ int main( int argc, char **argv )
 
   if (argc < 3) 
     throw std::runtime_error(std::string("need a config file and a report: ") +
-			     std::string("tgm config.xml report.xml"));
+			     std::string("tgm config.xml report.xml [report.xml ...]"));
 
-  std::string reportName = std::string(argv[2]);
+  // More than one report is a sequence, to be played back in order.
+  std::vector<std::string> reportNames;
+  for (int i = 2; i < argc; i++) reportNames.push_back(std::string(argv[i]));
+
+  std::string reportName = reportNames[0];
   std::string pathName = reportName.substr(0, reportName.find_last_of("/"));
   std::cout << "opening: " << reportName << std::endl;
   std::cout << "found in:" << pathName << std::endl;
-
-  tinyxml2::XMLDocument doc;
-  int d = doc.LoadFile(reportName.c_str()); 
-	if (d != tinyxml2::XML_SUCCESS) {
-    std::cout << "ouch:" << doc.ErrorName() << std::endl;
-  } else {
-
-		tinyxml2::XMLElement* root = doc.FirstChildElement();
-    tinyxml2::XMLElement* data = root->FirstChildElement("DATA");
-
-		for (tinyxml2::XMLElement* e = data->FirstChildElement("ROI");
-         e != NULL; e = e->NextSiblingElement("ROI")) {
-
-      // std::cout << "IMAGE: " << e->FirstChildElement("IMAGE")->GetText() << std::endl;
-      // std::cout << "X:     " << e->FirstChildElement("X")->GetText() << std::endl;
-      // std::cout << "Y:     " << e->FirstChildElement("Y")->GetText() << std::endl;
-      // std::cout << "Z:     " << e->FirstChildElement("DEPTH")->GetText() << std::endl;
-      // std::cout << "HEIGHT:" << e->FirstChildElement("HEIGHT")->GetText() << std::endl;
-      // std::cout << "WIDTH: " << e->FirstChildElement("WIDTH")->GetText() << std::endl;
-      std::string pngName = pathName + std::string("/") +
-        std::string(e->FirstChildElement("IMAGE")->GetText()); 
-      images.push_back(ImageToDisplay(pngName,
-                                      strtof(e->FirstChildElement("X")->GetText(),NULL),
-                                      strtof(e->FirstChildElement("Y")->GetText(),NULL),
-                                      strtof(e->FirstChildElement("DEPTH")->GetText(),NULL),
-                                      strtof(e->FirstChildElement("HEIGHT")->GetText(),NULL),
-                                      strtof(e->FirstChildElement("WIDTH")->GetText(),NULL)));
-
-		}
-	}
+  if (reportNames.size() > 1)
+    std::cout << "and " << reportNames.size() - 1 << " more reports" << std::endl;
+
+  // Every field of every ROI is kept, for filtering.  A report that
+  // can't be read leaves nothing to show.  The rest of a sequence is
+  // read as it's needed.
+  mvROITable rois;
+  if (rois.load(reportName)) std::cout << rois << std::endl;
   
-  mvImageApp app(argc, argv, images);
+  mvImageApp app(argc, argv, rois, reportNames);
 
   app.run();
 
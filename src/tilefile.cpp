@@ -0,0 +1,244 @@
+#include "tilefile.h"
+#include "pixelops.h"
+
+#include <stdio.h>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Bump this whenever the layout of the file changes.
+static const uint32_t tileFileVersion = 1;
+static const char tileFileMagic[8] = { 'M','V','T','I','L','E','S', 0 };
+static const uint32_t tileFileByteOrder = 0x01020304;
+
+static inline uint64_t alignUp(uint64_t offset) {
+  return (offset + 15) & ~(uint64_t)15;
+}
+
+bool mvTileFile::open(const std::string& fileName) {
+
+  close();
+  if (!_file.open(fileName)) {
+    std::cerr << "Can't read tile file " << fileName << std::endl;
+    return false;
+  }
+
+  const mvTileFileHeader* header = (const mvTileFileHeader*)_file.getData();
+  if ((_file.getSize() < sizeof(mvTileFileHeader)) ||
+      (memcmp(header->magic, tileFileMagic, sizeof(tileFileMagic)) != 0) ||
+      (header->byteOrder != tileFileByteOrder) ||
+      (header->version != tileFileVersion) ||
+      (header->channels != 4) || (header->levels < 1) || (header->levels > 14)) {
+    std::cerr << fileName << " isn't a tile file we can read." << std::endl;
+    close();
+    return false;
+  }
+  _header = header;
+
+  // Make sure the tiles are all really there.
+  uint64_t tileBytes = (uint64_t)getStoredTileSize() * getStoredTileSize() * 4;
+  uint64_t count = getTileCount();
+  uint64_t fileSize = _file.getSize();
+  bool truncated = (_header->offsetTable + count * sizeof(uint64_t) > fileSize);
+  if (!truncated) {
+    _offsets = (const uint64_t*)(_file.getData() + _header->offsetTable);
+    for (uint64_t i = 0; i < count; i++)
+      if (_offsets[i] + tileBytes > fileSize) truncated = true;
+  }
+  if (truncated) {
+    std::cerr << fileName << ": truncated tile file." << std::endl;
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void mvTileFile::close() {
+
+  _file.close();
+  _header = NULL;
+  _offsets = NULL;
+}
+
+int mvTileFile::getTileCount() {
+
+  int count = 0;
+  for (int level = 0; level < getLevels(); level++)
+    count += getTilesAcross(level) * getTilesAcross(level);
+  return count;
+}
+
+int mvTileFile::getTileNumber(int level, int x, int y) {
+
+  // Level r starts after the levels before it, each a quarter the size
+  // of the one before.  The sum of those is (4^L - 4^(L-r)) / 3 for L
+  // levels, counting the tiles of level 0 as 4^(L-1).
+  int levels = getLevels();
+  uint64_t first = (((uint64_t)1 << (2 * levels)) -
+                    ((uint64_t)1 << (2 * (levels - level)))) / 3;
+  return (int)first + y * getTilesAcross(level) + x;
+}
+
+const unsigned char* mvTileFile::getTile(int tileNumber) {
+
+  uint64_t offset = _offsets[tileNumber];
+  if (offset == 0) return NULL;
+  return (const unsigned char*)_file.getData() + offset;
+}
+
+// Turns a decoded image into plain RGBA, 8 bits a sample, using the
+// swizzle for the gray formats.
+static bool toRGBA8(const mvImageData& image, std::vector<unsigned char>& out) {
+
+  int channels;
+  switch (image.format) {
+  case GL_RED:  channels = 1; break;
+  case GL_RG:   channels = 2; break;
+  case GL_RGB:
+  case GL_BGR:  channels = 3; break;
+  case GL_RGBA: channels = 4; break;
+  default:
+    std::cerr << "Can't make tiles from a compressed image." << std::endl;
+    return false;
+  }
+  if (image.type != GL_UNSIGNED_BYTE) {
+    std::cerr << "Can't make tiles from a 16-bit image." << std::endl;
+    return false;
+  }
+
+  // Where each of R, G, B and A comes from: a channel, or 0 or 255.
+  int source[4];
+  for (int c = 0; c < 4; c++) {
+    switch (image.swizzle[c]) {
+    case GL_RED:   source[c] = 0; break;
+    case GL_GREEN: source[c] = 1; break;
+    case GL_BLUE:  source[c] = 2; break;
+    case GL_ALPHA: source[c] = 3; break;
+    case GL_ZERO:  source[c] = -1; break;
+    default:       source[c] = -2; break;
+    }
+    if (source[c] >= channels) source[c] = (c == 3) ? -2 : -1;
+  }
+  if (image.format == GL_BGR) {
+    source[0] = 2;
+    source[2] = 0;
+  }
+
+  out.resize((size_t)image.width * image.height * 4);
+  for (int y = 0; y < image.height; y++) {
+    const unsigned char* in = &image.pixels[(size_t)y * image.rowBytes];
+    unsigned char* o = &out[(size_t)y * image.width * 4];
+    for (int x = 0; x < image.width; x++, in += channels, o += 4) {
+      for (int c = 0; c < 4; c++)
+        o[c] = (source[c] >= 0) ? in[source[c]] : ((source[c] == -1) ? 0 : 255);
+    }
+  }
+  return true;
+}
+
+bool mvWriteTileFile(const mvImageData& image, const std::string& fileName,
+                     int tileSize, int border) {
+
+  std::vector<unsigned char> level;
+  if (!toRGBA8(image, level)) return false;
+  int width = image.width, height = image.height;
+
+  mvTileFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, tileFileMagic, sizeof(tileFileMagic));
+  header.byteOrder = tileFileByteOrder;
+  header.version = tileFileVersion;
+  header.width = width;
+  header.height = height;
+  header.tileSize = tileSize;
+  header.border = border;
+  header.channels = 4;
+  header.levels = 1;
+  while (((uint64_t)tileSize << (header.levels - 1)) < (uint64_t)width ||
+         ((uint64_t)tileSize << (header.levels - 1)) < (uint64_t)height)
+    header.levels++;
+  if (header.levels > 14) {
+    std::cerr << "The image is too big for tiles of " << tileSize
+              << " pixels." << std::endl;
+    return false;
+  }
+  header.offsetTable = alignUp(sizeof(header));
+
+  uint64_t tileCount = 0;
+  for (uint32_t r = 0; r < header.levels; r++)
+    tileCount += (uint64_t)1 << (2 * (header.levels - 1 - r));
+  std::vector<uint64_t> offsets(tileCount, 0);
+
+  FILE* fp = fopen(fileName.c_str(), "wb");
+  if (fp == NULL) {
+    std::cerr << "Can't write tile file " << fileName << std::endl;
+    return false;
+  }
+
+  uint64_t position = alignUp(header.offsetTable + tileCount * sizeof(uint64_t));
+  bool ok = (fseek(fp, position, SEEK_SET) == 0);
+
+  int stored = tileSize + 2 * border;
+  std::vector<unsigned char> tile((size_t)stored * stored * 4);
+  std::vector<unsigned char> next;
+  uint64_t first = 0;
+
+  for (uint32_t r = 0; ok && r < header.levels; r++) {
+
+    int across = 1 << (header.levels - 1 - r);
+    int usedX = (width + tileSize - 1) / tileSize;
+    int usedY = (height + tileSize - 1) / tileSize;
+
+    for (int ty = 0; ok && ty < usedY; ty++) {
+      for (int tx = 0; ok && tx < usedX; tx++) {
+
+        // Past the edges of the image, the edge pixels are repeated.
+        for (int j = 0; j < stored; j++) {
+          int y = ty * tileSize + j - border;
+          y = (y < 0) ? 0 : ((y >= height) ? height - 1 : y);
+          const unsigned char* row = &level[(size_t)y * width * 4];
+          unsigned char* out = &tile[(size_t)j * stored * 4];
+          for (int i = 0; i < stored; i++) {
+            int x = tx * tileSize + i - border;
+            x = (x < 0) ? 0 : ((x >= width) ? width - 1 : x);
+            memcpy(out + 4 * i, row + 4 * x, 4);
+          }
+        }
+
+        offsets[first + (uint64_t)ty * across + tx] = position;
+        ok = (fwrite(&tile[0], tile.size(), 1, fp) == 1);
+        position += tile.size();
+      }
+    }
+    first += (uint64_t)across * across;
+
+    // Then the next level down.
+    if (r + 1 < header.levels) {
+      int nextWidth = (width + 1) / 2, nextHeight = (height + 1) / 2;
+      next.resize((size_t)nextWidth * nextHeight * 4);
+      for (int y = 0; y < nextHeight; y++) {
+        const unsigned char* row0 = &level[(size_t)(2 * y) * width * 4];
+        const unsigned char* row1 = (2 * y + 1 < height) ? row0 + width * 4 : row0;
+        halveRGBA8(row0, row1, width, &next[(size_t)y * nextWidth * 4]);
+      }
+      level.swap(next);
+      width = nextWidth;
+      height = nextHeight;
+    }
+  }
+
+  if (ok) {
+    ok = (fseek(fp, 0, SEEK_SET) == 0) &&
+      (fwrite(&header, sizeof(header), 1, fp) == 1) &&
+      (fseek(fp, header.offsetTable, SEEK_SET) == 0) &&
+      (fwrite(&offsets[0], sizeof(uint64_t), tileCount, fp) == tileCount);
+  }
+  if (fclose(fp) != 0) ok = false;
+
+  if (!ok) {
+    std::cerr << "Couldn't write all of " << fileName << std::endl;
+    remove(fileName.c_str());
+  }
+  return ok;
+}
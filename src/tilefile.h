@@ -0,0 +1,101 @@
+#ifndef TILEFILE_H
+#define TILEFILE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "mappedfile.h"
+#include "imagedecoder.h"
+
+// An image too big to go to OpenGL in one piece, cut into tiles ahead
+// of time (see vtbuild.cpp) so that mvVirtualTexture can load only the
+// tiles it needs.
+//
+// The image is kept at a series of levels, each half the size of the
+// one before, down to one tile.  Level 0 is the full image.  Each
+// level is cut into square tiles of tileSize pixels, plus a border of
+// pixels copied from the neighbouring tiles (or repeated, at the edge
+// of the image) so that they can be filtered without seams.
+//
+// To keep the arithmetic simple, the image is taken to sit in the
+// top-left corner of a square tileSize * 2^(levels - 1) pixels across,
+// so that level r is 2^(levels - 1 - r) tiles across and down.  Tiles
+// entirely outside the image aren't stored.
+//
+// The file looks like this, all in the native byte order of the
+// machine that wrote it:
+//
+//   mvTileFileHeader
+//   offsets     a uint64_t for each tile, level 0 first, then by row;
+//               0 for tiles that aren't stored
+//   tiles       (tileSize + 2 * border)^2 RGBA pixels each
+//
+// The tiles start on a 16-byte boundary.
+struct mvTileFileHeader {
+  char magic[8];
+  uint32_t byteOrder;
+  uint32_t version;
+
+  // The size of the image at level 0.
+  uint32_t width;
+  uint32_t height;
+
+  uint32_t tileSize;
+  uint32_t border;
+  uint32_t levels;
+
+  // Bytes per pixel.  Always 4, RGBA.
+  uint32_t channels;
+
+  uint64_t offsetTable;
+};
+
+// Reads a tile file.  The file is mapped into memory, so a tile is a
+// pointer into it, and reading one is a matter of the OS paging it in.
+class mvTileFile {
+ private:
+  mvMappedFile _file;
+  const mvTileFileHeader* _header;
+  const uint64_t* _offsets;
+
+  // No copying.
+  mvTileFile(const mvTileFile&);
+  mvTileFile& operator=(const mvTileFile&);
+
+ public:
+  mvTileFile() : _header(NULL), _offsets(NULL) {};
+
+  // Returns false, with a message, if the file can't be read or
+  // isn't a tile file.
+  bool open(const std::string& fileName);
+  void close();
+  bool isOpen() { return _header != NULL; };
+
+  int getWidth() { return _header->width; };
+  int getHeight() { return _header->height; };
+  int getTileSize() { return _header->tileSize; };
+  int getBorder() { return _header->border; };
+  int getLevels() { return _header->levels; };
+
+  // The pixels across and down a tile, border and all.
+  int getStoredTileSize() { return _header->tileSize + 2 * _header->border; };
+
+  // Tiles across and down a level, counting the ones outside the
+  // image.
+  int getTilesAcross(int level) { return 1 << (_header->levels - 1 - level); };
+
+  // Tiles are numbered from 0 at the top left of level 0, along the
+  // rows, and on through the levels.
+  int getTileCount();
+  int getTileNumber(int level, int x, int y);
+
+  // A tile's pixels, or NULL if it isn't in the file.
+  const unsigned char* getTile(int tileNumber);
+};
+
+// Cuts an image into a tile file.  Returns false, with a message, if
+// it can't.
+bool mvWriteTileFile(const mvImageData& image, const std::string& fileName,
+                     int tileSize, int border);
+
+#endif
@@ -0,0 +1,375 @@
+#include "virtualtexture.h"
+
+#include <math.h>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+// The grid requestTiles() cuts the rectangle into, cells each way.
+static const int requestGrid = 16;
+
+// Marks the coarsest tile's slot, so it's never let go.
+static const uint32_t pinned = 0xFFFFFFFF;
+
+mvVirtualTexture::mvVirtualTexture(const std::string& fileName, int atlasSize) :
+  _fileName(fileName), _atlasSize(atlasSize), _slotsAcross(0), _slotSize(0),
+  _atlasID(0), _pageTableID(0), _gpuBytes(0), _frame(1), _maxUploads(8),
+  _atlasSamplerID(-1), _pageTableSamplerID(-1), _imageScaleID(-1),
+  _pageTableBiasID(-1), _levelsID(-1), _tileSizeID(-1), _tileBorderID(-1),
+  _slotSizeID(-1), _atlasSizeID(-1) {}
+
+mvVirtualTexture::~mvVirtualTexture() {
+
+  if (_atlasID) glDeleteTextures(1, &_atlasID);
+  if (_pageTableID) glDeleteTextures(1, &_pageTableID);
+  mvGPUMemory::release(gpuATLAS, _gpuBytes);
+}
+
+bool mvVirtualTexture::open() {
+
+  if (_tiles.isOpen()) return true;
+  if (!_tiles.open(_fileName)) return false;
+
+  // The slot's column and row go in a byte each of the page table.
+  _slotSize = _tiles.getStoredTileSize();
+  _slotsAcross = std::min(_atlasSize / _slotSize, 255);
+  if (_slotsAcross < 1) {
+    std::cerr << _fileName << ": the tiles don't fit in a " << _atlasSize
+              << "-pixel atlas." << std::endl;
+    _tiles.close();
+    return false;
+  }
+
+  int slotCount = _slotsAcross * _slotsAcross;
+  _slotTile.assign(slotCount, -1);
+  _slotUsed.assign(slotCount, 0);
+  _freeSlots.clear();
+  for (int slot = slotCount - 1; slot >= 0; slot--) _freeSlots.push_back(slot);
+
+  int tileCount = _tiles.getTileCount();
+  _tileSlot.assign(tileCount, -1);
+  _tileRequested.assign(tileCount, 0);
+
+  _pageTable.resize(_tiles.getLevels());
+  for (int level = 0; level < _tiles.getLevels(); level++) {
+    int across = _tiles.getTilesAcross(level);
+    _pageTable[level].assign((size_t)across * across * 4, 0);
+  }
+
+  return true;
+}
+
+void mvVirtualTexture::load(GLuint programID) {
+
+  if (!open()) throw std::runtime_error("can't read tile file " + _fileName);
+
+  if (_atlasID == 0) {
+    int atlasPixels = _slotsAcross * _slotSize;
+
+    glGenTextures(1, &_atlasID);
+    glBindTexture(GL_TEXTURE_2D, _atlasID);
+    mvGPUMemory::texImage2D(gpuATLAS, _gpuBytes, GL_TEXTURE_2D, 0, GL_RGBA8,
+                            atlasPixels, atlasPixels, 0,
+                            GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    // The tiles' borders take care of filtering across their edges.
+    // There are no mipmaps; the tiles are the mipmaps.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &_pageTableID);
+    glBindTexture(GL_TEXTURE_2D, _pageTableID);
+    for (int level = 0; level < _tiles.getLevels(); level++) {
+      int across = _tiles.getTilesAcross(level);
+      mvGPUMemory::texImage2D(gpuATLAS, _gpuBytes, GL_TEXTURE_2D, level, GL_RGBA8,
+                              across, across, 0,
+                              GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    // One texel for each tile: no blending between them.
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, _tiles.getLevels() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // The coarsest tile stays for good, so every part of the image
+    // has something to show.
+    int top = _tiles.getTileNumber(_tiles.getLevels() - 1, 0, 0);
+    int slot = findSlot();
+    uploadTile(top, slot);
+    _slotUsed[slot] = pinned;
+    updatePageTable();
+  }
+
+  // The names in VirtualShading.fragmentshader.
+  _atlasSamplerID = glGetUniformLocation(programID, "mvTileAtlas");
+  _pageTableSamplerID = glGetUniformLocation(programID, "mvPageTable");
+  _imageScaleID = glGetUniformLocation(programID, "mvImageScale");
+  _pageTableBiasID = glGetUniformLocation(programID, "mvPageTableBias");
+  _levelsID = glGetUniformLocation(programID, "mvLevels");
+  _tileSizeID = glGetUniformLocation(programID, "mvTileSize");
+  _tileBorderID = glGetUniformLocation(programID, "mvTileBorder");
+  _slotSizeID = glGetUniformLocation(programID, "mvSlotSize");
+  _atlasSizeID = glGetUniformLocation(programID, "mvAtlasSize");
+}
+
+void mvVirtualTexture::uploadTile(int tile, int slot) {
+
+  const unsigned char* pixels = _tiles.getTile(tile);
+  if (pixels == NULL) return;
+
+  glBindTexture(GL_TEXTURE_2D, _atlasID);
+  glTexSubImage2D(GL_TEXTURE_2D, 0,
+                  (slot % _slotsAcross) * _slotSize,
+                  (slot / _slotsAcross) * _slotSize,
+                  _slotSize, _slotSize, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+  if (_slotTile[slot] >= 0) {
+    _tileSlot[_slotTile[slot]] = -1;
+    _changedTiles.push_back(_slotTile[slot]);
+  }
+  _slotTile[slot] = tile;
+  _tileSlot[tile] = slot;
+  _changedTiles.push_back(tile);
+}
+
+int mvVirtualTexture::findSlot() {
+
+  if (!_freeSlots.empty()) {
+    int slot = _freeSlots.back();
+    _freeSlots.pop_back();
+    return slot;
+  }
+
+  int oldest = -1;
+  for (size_t slot = 0; slot < _slotUsed.size(); slot++) {
+    if (_slotUsed[slot] < _frame &&
+        (oldest < 0 || _slotUsed[slot] < _slotUsed[oldest])) oldest = slot;
+  }
+  return oldest;
+}
+
+void mvVirtualTexture::requestTile(int level, int x, int y) {
+
+  int tile = _tiles.getTileNumber(level, x, y);
+  if (_tileRequested[tile] == _frame) return;
+  _tileRequested[tile] = _frame;
+  if (_tiles.getTile(tile)) _requests.push_back(tile);
+}
+
+// Whether a cell, given by the clip coordinates of its corners, is
+// all on the outside of one of the planes of the view frustum.
+static bool outsideView(const MVec4* c) {
+
+  for (int axis = 0; axis < 3; axis++) {
+    bool below = true, above = true;
+    for (int k = 0; k < 4; k++) {
+      if (c[k][axis] >= -c[k].w) below = false;
+      if (c[k][axis] <= c[k].w) above = false;
+    }
+    if (below || above) return true;
+  }
+  return false;
+}
+
+void mvVirtualTexture::requestTiles(const MMat4& uvToClip,
+                                    int viewportWidth, int viewportHeight) {
+
+  if (!_tiles.isOpen()) return;
+
+  const int n = requestGrid + 1;
+  MVec4 corners[n * n];
+  for (int j = 0; j < n; j++) {
+    for (int i = 0; i < n; i++) {
+      corners[j * n + i] = uvToClip * MVec4((float)i / requestGrid,
+                                            (float)j / requestGrid, 0.0f, 1.0f);
+    }
+  }
+
+  int levels = _tiles.getLevels();
+  int tileSize = _tiles.getTileSize();
+  float width = _tiles.getWidth(), height = _tiles.getHeight();
+
+  // The texels of level 0 along the edges of a cell.
+  float cellTexels[2] = { width / requestGrid, height / requestGrid };
+
+  for (int j = 0; j < requestGrid; j++) {
+    for (int i = 0; i < requestGrid; i++) {
+
+      MVec4 c[4] = { corners[j * n + i], corners[j * n + i + 1],
+                     corners[(j + 1) * n + i + 1], corners[(j + 1) * n + i] };
+      if (outsideView(c)) continue;
+
+      // The most texels per pixel along any edge of the cell that's in
+      // front of the eye.  That says which level looks right, as the
+      // hardware would pick a mipmap level.
+      float texelsPerPixel = 0.0f;
+      bool inFront = false;
+      for (int k = 0; k < 4; k++) {
+        const MVec4& a = c[k];
+        const MVec4& b = c[(k + 1) % 4];
+        if (a.w <= 1e-6f || b.w <= 1e-6f) continue;
+        float dx = 0.5f * viewportWidth * (a.x / a.w - b.x / b.w);
+        float dy = 0.5f * viewportHeight * (a.y / a.w - b.y / b.w);
+        float pixels = std::max(sqrtf(dx * dx + dy * dy), 1e-3f);
+        texelsPerPixel = std::max(texelsPerPixel, cellTexels[k % 2] / pixels);
+        inFront = true;
+      }
+      if (!inFront) continue;
+
+      int level = (texelsPerPixel > 1.0f) ? (int)floorf(log2f(texelsPerPixel)) : 0;
+      level = std::min(level, levels - 1);
+
+      // The tiles of that level under the cell.  Each covers this many
+      // pixels of level 0.
+      float span = (float)(tileSize << level);
+      int lastX = (int)((width - 1.0f) / span);
+      int lastY = (int)((height - 1.0f) / span);
+      int x0 = std::min((int)(width * i / requestGrid / span), lastX);
+      int x1 = std::min((int)((width * (i + 1) / requestGrid - 1.0f) / span), lastX);
+      int y0 = std::min((int)(height * j / requestGrid / span), lastY);
+      int y1 = std::min((int)((height * (j + 1) / requestGrid - 1.0f) / span), lastY);
+      for (int y = y0; y <= y1; y++)
+        for (int x = x0; x <= x1; x++) requestTile(level, x, y);
+    }
+  }
+}
+
+void mvVirtualTexture::update() {
+
+  if (_atlasID == 0) {
+    _requests.clear();
+    return;
+  }
+
+  // The tiles are numbered from level 0 up, so this puts the coarse
+  // ones first.  If the atlas can't hold everything in view, what it
+  // does hold covers the view, if blurrily.
+  std::sort(_requests.begin(), _requests.end(), std::greater<int>());
+
+  // Everything wanted this time stays.
+  for (size_t i = 0; i < _requests.size(); i++) {
+    int slot = _tileSlot[_requests[i]];
+    if (slot >= 0 && _slotUsed[slot] != pinned) _slotUsed[slot] = _frame;
+  }
+
+  int uploads = 0;
+  for (size_t i = 0; i < _requests.size() && uploads < _maxUploads; i++) {
+    int tile = _requests[i];
+    if (_tileSlot[tile] >= 0) continue;
+    int slot = findSlot();
+    if (slot < 0) break;
+    uploadTile(tile, slot);
+    _slotUsed[slot] = _frame;
+    uploads++;
+  }
+
+  _requests.clear();
+  _frame++;
+
+  if (!_changedTiles.empty()) updatePageTable();
+}
+
+void mvVirtualTexture::updatePageTable() {
+
+  // The tiles are numbered from level 0 up, so this puts the coarse
+  // ones first.  A tile under another that changed is redone with
+  // that one's subtree, so it's left out.
+  std::sort(_changedTiles.begin(), _changedTiles.end(), std::greater<int>());
+  _changedTiles.erase(std::unique(_changedTiles.begin(), _changedTiles.end()),
+                      _changedTiles.end());
+
+  int levels = _tiles.getLevels();
+  glBindTexture(GL_TEXTURE_2D, _pageTableID);
+  for (size_t i = 0; i < _changedTiles.size(); i++) {
+
+    int level = 0;
+    while (level + 1 < levels &&
+           _changedTiles[i] >= _tiles.getTileNumber(level + 1, 0, 0)) level++;
+    int offset = _changedTiles[i] - _tiles.getTileNumber(level, 0, 0);
+    int x = offset % _tiles.getTilesAcross(level);
+    int y = offset / _tiles.getTilesAcross(level);
+
+    bool covered = false;
+    for (int up = level + 1; up < levels && !covered; up++) {
+      int shift = up - level;
+      covered = std::binary_search(_changedTiles.begin(), _changedTiles.begin() + i,
+                                   _tiles.getTileNumber(up, x >> shift, y >> shift),
+                                   std::greater<int>());
+    }
+    if (!covered) updatePageTable(level, x, y);
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+  _changedTiles.clear();
+}
+
+void mvVirtualTexture::updatePageTable(int top, int topX, int topY) {
+
+  // From the top down, so a tile that isn't there can use its
+  // parent's entry, which is already worked out.  The tile's own
+  // parent hasn't changed.
+  int levels = _tiles.getLevels();
+  for (int level = top; level >= 0; level--) {
+
+    int across = _tiles.getTilesAcross(level);
+    int first = _tiles.getTileNumber(level, 0, 0);
+    std::vector<unsigned char>& table = _pageTable[level];
+
+    int size = 1 << (top - level);
+    int x0 = topX * size, y0 = topY * size;
+    for (int y = y0; y < y0 + size; y++) {
+      for (int x = x0; x < x0 + size; x++) {
+        unsigned char* entry = &table[((size_t)y * across + x) * 4];
+        int slot = _tileSlot[first + y * across + x];
+        if (slot >= 0) {
+          entry[0] = slot % _slotsAcross;
+          entry[1] = slot / _slotsAcross;
+          entry[2] = level;
+          entry[3] = 255;
+        } else if (level + 1 < levels) {
+          const unsigned char* parent =
+            &_pageTable[level + 1][((size_t)(y / 2) * (across / 2) + x / 2) * 4];
+          entry[0] = parent[0];
+          entry[1] = parent[1];
+          entry[2] = parent[2];
+          entry[3] = parent[3];
+        }
+      }
+    }
+
+    // The rows of the piece are a level's width apart.
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, across);
+    glTexSubImage2D(GL_TEXTURE_2D, level, x0, y0, size, size,
+                    GL_RGBA, GL_UNSIGNED_BYTE,
+                    &table[((size_t)y0 * across + x0) * 4]);
+  }
+}
+
+void mvVirtualTexture::draw(GLuint programID) {
+
+  // The atlas goes in texture unit 0, where the other shaders' one
+  // texture goes, and the page table in unit 1.
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, _pageTableID);
+  glUniform1i(_pageTableSamplerID, 1);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, _atlasID);
+  glUniform1i(_atlasSamplerID, 0);
+
+  // The image sits in the top-left corner of the square the tiles
+  // divide up.  The page table's level 0 has a texel per tile, so
+  // the level the hardware picks from it is log2(tileSize) less than
+  // the level of the image we want; the bias makes up the difference,
+  // less a half, so that it rounds down as requestTiles() does.
+  float side = (float)(_tiles.getTileSize() << (_tiles.getLevels() - 1));
+  glUniform2f(_imageScaleID, _tiles.getWidth() / side, _tiles.getHeight() / side);
+  glUniform1f(_pageTableBiasID, log2f((float)_tiles.getTileSize()) - 0.5f);
+  glUniform1f(_levelsID, (float)_tiles.getLevels());
+  glUniform1f(_tileSizeID, (float)_tiles.getTileSize());
+  glUniform1f(_tileBorderID, (float)_tiles.getBorder());
+  glUniform1f(_slotSizeID, (float)_slotSize);
+  glUniform1f(_atlasSizeID, (float)(_slotsAcross * _slotSize));
+}
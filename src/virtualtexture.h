@@ -0,0 +1,154 @@
+#ifndef VIRTUALTEXTURE_H
+#define VIRTUALTEXTURE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "vecTypes.h"
+#include "tilefile.h"
+#include "gpumemory.h"
+
+// A texture too big to give OpenGL in one piece, shown by keeping only
+// the tiles in view, at the level of detail they're seen at, on the
+// GPU.  The tiles come from a tile file (see tilefile.h).
+//
+// The tiles that are loaded sit in slots in one big texture, the
+// atlas.  A second, small texture, the page table, says where each
+// tile is.  It has a mipmap level for each level of the tile file and
+// a texel for each tile, holding the atlas slot of the tile, or, if
+// that tile isn't loaded, of the nearest coarser tile that covers the
+// same part of the image.  The coarsest level is a single tile, which
+// is always loaded, so there's always something to show.  The shader
+// (see VirtualShading.fragmentshader) looks a texture coordinate up
+// in the page table, at the level the hardware would have picked for
+// a mipmapped texture, and then reads the pixel from the atlas.
+//
+// Which tiles are needed is worked out on the CPU, from the matrices
+// the texture is drawn with, instead of rendering a feedback buffer
+// and reading it back: requestTiles() cuts the texture's rectangle
+// into a grid, works out how many texels each cell covers per pixel
+// on the screen, and asks for the tiles of that level under each cell
+// that is in view, in any of the frame's views.  update(), once a
+// frame, then loads up to a few of the missing tiles, coarsest first,
+// and lets go of the tiles that have been out of view longest when
+// the atlas is full.
+//
+// All of it except requestTiles() needs the OpenGL context.
+class mvVirtualTexture {
+ private:
+  std::string _fileName;
+  mvTileFile _tiles;
+
+  // The atlas is _slotsAcross slots across and down, each big enough
+  // for a tile and its border.
+  int _atlasSize;
+  int _slotsAcross;
+  int _slotSize;
+  GLuint _atlasID;
+  GLuint _pageTableID;
+
+  // What the two textures take, as counted by mvGPUMemory.
+  size_t _gpuBytes;
+
+  // For each tile, the slot it's in, or -1.  For each slot, the tile
+  // in it, or -1, and when it was last wanted.  The coarsest tile is
+  // never let go.
+  std::vector<int> _tileSlot;
+  std::vector<int> _slotTile;
+  std::vector<uint32_t> _slotUsed;
+  std::vector<int> _freeSlots;
+  uint32_t _frame;
+
+  // The tiles asked for since the last update(), each once.
+  std::vector<int> _requests;
+  std::vector<uint32_t> _tileRequested;
+
+  // At most this many tiles are loaded per update().
+  int _maxUploads;
+
+  // The page table, a level at a time, four bytes a tile: the slot's
+  // column and row in the atlas, and the level of the tile in it.
+  std::vector<std::vector<unsigned char> > _pageTable;
+
+  // The tiles loaded or let go since the page table was last updated.
+  // Only the entries under them can have changed.
+  std::vector<int> _changedTiles;
+
+  // Where the shader's uniforms are.  See load() for their names.
+  GLint _atlasSamplerID;
+  GLint _pageTableSamplerID;
+  GLint _imageScaleID;
+  GLint _pageTableBiasID;
+  GLint _levelsID;
+  GLint _tileSizeID;
+  GLint _tileBorderID;
+  GLint _slotSizeID;
+  GLint _atlasSizeID;
+
+  // Sends a tile to a slot in the atlas.
+  void uploadTile(int tile, int slot);
+
+  // A slot to put a new tile in: a free one, or the one wanted least
+  // recently, as long as it wasn't wanted this time.  -1 if there's
+  // none.
+  int findSlot();
+
+  void requestTile(int level, int x, int y);
+
+  // Works out the page table entries under the changed tiles again,
+  // and sends OpenGL just those parts of each level.
+  void updatePageTable();
+  void updatePageTable(int level, int x, int y);
+
+  // No copying; the object owns OpenGL textures.
+  mvVirtualTexture(const mvVirtualTexture&);
+  mvVirtualTexture& operator=(const mvVirtualTexture&);
+
+ public:
+  // The atlas is atlasSize pixels across and down.  4096 holds 961
+  // tiles of 128 pixels.
+  mvVirtualTexture(const std::string& fileName, int atlasSize = 4096);
+  ~mvVirtualTexture();
+
+  // Reads the tile file's header.  This does no OpenGL calls, so it
+  // can be done on a worker thread.  Returns false, with a message, if
+  // the file can't be read.
+  bool open();
+
+  // Makes the atlas and page table, and loads the coarsest tile.
+  // Throws if the file can't be read.
+  void load(GLuint programID);
+
+  // Asks for the tiles needed to draw the texture with uvToClip, which
+  // takes texture coordinates (u, v, 0, 1), with v down the image, to
+  // clip coordinates, in a viewport of the given size.  Call this for
+  // each view; the requests pile up until the next update().
+  void requestTiles(const MMat4& uvToClip, int viewportWidth, int viewportHeight);
+
+  // Loads some of the tiles asked for by all the views since the last
+  // update(), and fixes the page table to match.  Call this once a
+  // frame, before any view is drawn, so that every view sees the same
+  // tiles, and none of them lets go of what another has just asked
+  // for.
+  void update();
+
+  // Binds the atlas and page table for drawing, with the program in
+  // use.
+  void draw(GLuint programID);
+
+  void setMaxUploads(int maxUploads) { _maxUploads = maxUploads; };
+
+  std::string getFileName() { return _fileName; };
+
+  // The size of the image, once it's open().
+  int getWidth() { return _tiles.getWidth(); };
+  int getHeight() { return _tiles.getHeight(); };
+
+  // How many tiles are loaded now, counting the coarsest.
+  int getResidentCount() { return _slotTile.size() - _freeSlots.size(); };
+};
+
+#endif
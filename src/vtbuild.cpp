@@ -0,0 +1,51 @@
+// Cuts a big image into a tile file, for showing as a virtual texture
+// (see tilefile.h and virtualtexture.h):
+//
+//   vtbuild image.png image.mvtiles [tileSize [border]]
+//
+// The whole image is read into memory, four bytes a pixel, so this is
+// meant to be run ahead of time, on a machine with room for it.
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+#include "imagedecoder.h"
+#include "tilefile.h"
+
+int main(int argc, char** argv) {
+
+  if (argc < 3) {
+    std::cerr << "usage: vtbuild image tilefile [tileSize [border]]" << std::endl;
+    return 1;
+  }
+
+  std::string imageName = argv[1];
+  std::string tileName = argv[2];
+  int tileSize = (argc > 3) ? atoi(argv[3]) : 128;
+  int border = (argc > 4) ? atoi(argv[4]) : 1;
+  if (tileSize < 16 || border < 0 || border >= tileSize) {
+    std::cerr << "The tiles need to be at least 16 pixels, with a border "
+              << "narrower than that." << std::endl;
+    return 1;
+  }
+
+  mvImageDecoder* decoder = mvImageDecoderRegistry::get().findForFile(imageName);
+  if (decoder == NULL) {
+    std::cerr << "Don't know how to read " << imageName << std::endl;
+    return 1;
+  }
+
+  mvImageData image;
+  if (!decoder->decode(imageName, image, mvDecodeOptions())) return 1;
+  std::cout << imageName << ": " << image.width << "x" << image.height
+            << std::endl;
+
+  if (!mvWriteTileFile(image, tileName, tileSize, border)) return 1;
+
+  mvTileFile tiles;
+  if (!tiles.open(tileName)) return 1;
+  std::cout << tileName << ": " << tiles.getLevels() << " levels of "
+            << tileSize << "-pixel tiles" << std::endl;
+  return 0;
+}